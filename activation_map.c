@@ -0,0 +1,128 @@
+/*
+ * activation_map.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "activation_map.h"
+
+activation_map_t * new_activation_map(int x, int y, float isoline, const char *filename) {
+// creates an empty map for x by y sheets, to be written to filename
+    activation_map_t *m;
+    size_t n, size = (size_t) x*y;
+
+    MALLOC(m, sizeof(activation_map_t), "activation map alloc failure");
+    m->x = x;
+    m->y = y;
+    m->x0 = 0;
+    m->y0 = 0;
+    m->isoline = isoline;
+    m->filename = filename;
+    MALLOC_D(m->last, size, "activation map alloc failure");
+    MALLOC(m->cycles, size*sizeof(long), "activation map alloc failure");
+    MALLOC_D(m->mean, size, "activation map alloc failure");
+    MALLOC_D(m->m2, size, "activation map alloc failure");
+
+    for (n = 0; n < size; ++n) {
+        m->last[n] = -1.0;
+        m->cycles[n] = 0;
+        m->mean[n] = 0.0;
+        m->m2[n] = 0.0;
+    }
+
+    return m;
+}
+
+void activation_map_frame(activation_map_t *m, float **previous, double previous_time,
+        float **current, double time) {
+// records the activations between two consecutive frames
+    double interval = time - previous_time, when, cycle, delta;
+    float before, after;
+    size_t n;
+    int i, j;
+
+    for (j = 0; j < m->y; ++j) {
+        for (i = 0; i < m->x; ++i) {
+            before = previous[j][i];
+            after = current[j][i];
+            if (!((before < m->isoline) && (after >= m->isoline)))
+                continue;
+
+            // an upward crossing, somewhere between the frames
+            n = (size_t) j*m->x + i;
+            when = previous_time + interval*(m->isoline - before)/(after - before);
+            if (m->last[n] >= 0.0) {
+                cycle = when - m->last[n];
+                m->cycles[n]++;
+                delta = cycle - m->mean[n];
+                m->mean[n] += delta/m->cycles[n];
+                m->m2[n] += delta*(cycle - m->mean[n]);
+            }
+            m->last[n] = when;
+        }
+    }
+}
+
+int write_activation_map(const activation_map_t *m) {
+// atomically replaces the map file with the map so far
+    FILE *file;
+    char *temporary;
+    double mean, sd;
+    size_t n;
+    int i, j, status = 0;
+
+    temporary = malloc(strlen(m->filename) + 5);
+    if (!temporary) {
+        return -1;
+    }
+    sprintf(temporary, "%s.tmp", m->filename);
+
+    file = fopen(temporary, "w");
+    if (!file) {
+        perror(temporary);
+        free(temporary);
+        return -1;
+    }
+
+    fprintf(file, "# x y last_activation cycles cycle_mean cycle_sd\n");
+    for (j = 0; j < m->y; ++j) {
+        for (i = 0; i < m->x; ++i) {
+            n = (size_t) j*m->x + i;
+            mean = (m->cycles[n] > 0) ? m->mean[n] : -1.0;
+            sd = (m->cycles[n] > 1) ? sqrt(m->m2[n]/(m->cycles[n] - 1)) : -1.0;
+            fprintf(file, "%d %d %f %ld %f %f\n", i + m->x0, j + m->y0, m->last[n], m->cycles[n], mean, sd);
+        }
+    }
+
+    if ((0 != fflush(file)) || ferror(file)) {
+        status = -1;
+    }
+    if (0 != fclose(file)) {
+        status = -1;
+    }
+
+    if ((0 == status) && (0 != rename(temporary, m->filename))) {
+        perror(m->filename);
+        status = -1;
+    }
+
+    free(temporary);
+    return status;
+}
+
+void destroy_activation_map(activation_map_t *m) {
+// frees the map
+    if (!m) {
+        return;
+    }
+    free(m->last);
+    free(m->cycles);
+    free(m->mean);
+    free(m->m2);
+    free(m);
+}
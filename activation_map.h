@@ -0,0 +1,57 @@
+/*
+ * activation_map.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Per-pixel activation times and cycle lengths, computed incrementally from
+ * the pairs of consecutive frames the tip trace already holds.
+ *
+ * A pixel activates when it crosses the isoline upwards.  The time of the
+ * crossing is interpolated linearly between the two frames, and the interval
+ * since the pixel's previous activation is a cycle length.  Only the latest
+ * activation and a running mean and variance of the cycle length (Welford's
+ * method) are kept, so memory doesn't grow with the length of the run.
+ *
+ * The map file has a header line, then one line per pixel, row by row:
+ *
+ *   x y last_activation cycles cycle_mean cycle_sd
+ *
+ *  last_activation:    time of the latest activation, -1 if none
+ *  cycles:             number of cycle lengths measured
+ *  cycle_mean:         mean cycle length, -1 if none measured
+ *  cycle_sd:           sample standard deviation, -1 for fewer than two
+ */
+
+#ifndef ACTIVATION_MAP_H
+#define ACTIVATION_MAP_H
+
+typedef struct activation_map {
+    int x;
+    int y;
+    int x0;                     // where the map's first pixel is in the whole
+    int y0;                     // sheet, added to the coordinates written
+    float isoline;
+    const char *filename;
+    double *last;               // latest activation time, <0 for none
+    long *cycles;               // cycle lengths measured
+    double *mean;               // running mean cycle length
+    double *m2;                 // running sum of squared deviations
+} activation_map_t;
+
+activation_map_t * new_activation_map(int x, int y, float isoline, const char *filename);
+// creates an empty map for x by y sheets, to be written to filename
+
+void activation_map_frame(activation_map_t *m, float **previous, double previous_time,
+        float **current, double time);
+// records the activations between two consecutive frames
+
+int write_activation_map(const activation_map_t *m);
+// atomically replaces the map file with the map so far
+//
+// returns:
+//  0:  success
+//  <0: error
+
+void destroy_activation_map(activation_map_t *m);
+// frees the map
+
+#endif // ACTIVATION_MAP_H
@@ -0,0 +1,77 @@
+/*
+ * checkpoint.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Progress records for resuming interrupted runs.  A checkpoint is a small
+ * text file,
+ *
+ *   frame 41999
+ *   offset 1234567
+ *
+ * giving the last frame fully written and the length of the output at that
+ * point.  It is written to a temporary file and renamed into place, so a
+ * crash leaves either the old or the new checkpoint, never a partial one.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tip_trace_binary.h"
+
+int write_checkpoint(const char *filename, long frame, long offset) {
+// atomically records that every frame up to and including frame has been
+// written, the output then being offset bytes long.
+    FILE *file;
+    char *temporary;
+    int status = 0;
+
+    temporary = malloc(strlen(filename) + 5);
+    if (!temporary) {
+        return -1;
+    }
+    sprintf(temporary, "%s.tmp", filename);
+
+    file = fopen(temporary, "w");
+    if (!file) {
+        perror(temporary);
+        free(temporary);
+        return -1;
+    }
+
+    if (fprintf(file, "frame %ld\noffset %ld\n", frame, offset) < 0) {
+        status = -1;
+    }
+    if ((0 != fflush(file)) || (0 != fsync(fileno(file)))) {
+        status = -1;
+    }
+    if (0 != fclose(file)) {
+        status = -1;
+    }
+
+    if ((0 == status) && (0 != rename(temporary, filename))) {
+        perror(filename);
+        status = -1;
+    }
+
+    free(temporary);
+    return status;
+}
+
+int read_checkpoint(const char *filename, long *frame, long *offset) {
+// reads back a checkpoint written by write_checkpoint
+    FILE *file;
+    int status = 0;
+
+    file = fopen(filename, "r");
+    if (!file) {
+        return -1;
+    }
+
+    if (2 != fscanf(file, "frame %ld offset %ld", frame, offset)) {
+        fprintf(stderr, "%s: not a checkpoint file\n", filename);
+        status = -1;
+    }
+
+    fclose(file);
+    return status;
+}
@@ -0,0 +1,193 @@
+/*
+ * contours.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "contours.h"
+
+// segment ends closer than 1/QUANTUM of a cell are taken to be the same point
+#define QUANTUM (1024.0)
+
+typedef struct contour_end {
+    unsigned long long key; // quantised position
+    int end;                // 2*segment, +1 for its b end
+} contour_end_t;
+
+static void * grow(void *p, int *capacity, int needed, size_t size) {
+// makes room for needed elements of the given size, doubling the capacity
+    if (needed <= *capacity) {
+        return p;
+    }
+    if (*capacity < 64)
+        *capacity = 64;
+    while (*capacity < needed)
+        *capacity *= 2;
+    p = realloc(p, (size_t) *capacity * size);
+    if (!p) {
+        oops("contour alloc failure");
+    }
+    return p;
+}
+
+static point_t end_point(const contours_t *c, int end) {
+// the position of a segment end
+    const contour_segment_t *s = &c->segments[end/2];
+    return (end & 1) ? s->b : s->a;
+}
+
+static unsigned long long quantise(point_t p) {
+// a key equal for segment ends at the same point
+    unsigned long long qx = (unsigned int) lround(p.x*QUANTUM);
+    unsigned long long qy = (unsigned int) lround(p.y*QUANTUM);
+    return (qx << 32) | qy;
+}
+
+static int compare_ends(const void *a, const void *b) {
+// orders segment ends by position, then by end, so stitching is repeatable
+    const contour_end_t *ea = a, *eb = b;
+
+    if (ea->key != eb->key)
+        return (ea->key < eb->key) ? -1 : 1;
+    return ea->end - eb->end;
+}
+
+contours_t * new_contours(void) {
+// creates an empty set of contours
+    contours_t *c;
+
+    MALLOC(c, sizeof(contours_t), "contour alloc failure");
+    memset(c, 0, sizeof(contours_t));
+    return c;
+}
+
+void contours_clear(contours_t *c) {
+// forgets all segments and fronts, keeping the memory for reuse
+    c->nsegments = 0;
+    c->nfronts = 0;
+    c->npoints = 0;
+    c->length = 0.0;
+}
+
+void contours_add_segments(contours_t *c, const contour_segment_t *segments, int nsegments) {
+// adds segments, in sheet coordinates, to be stitched
+    c->segments = grow(c->segments, &c->msegments, c->nsegments + nsegments,
+            sizeof(contour_segment_t));
+    memcpy(c->segments + c->nsegments, segments, nsegments*sizeof(contour_segment_t));
+    c->nsegments += nsegments;
+}
+
+static void add_point(contours_t *c, contour_front_t *front, point_t p) {
+// appends a point to the front being built, measuring the step to it
+    if (front->npoints > 0) {
+        point_t last = c->points[c->npoints - 1];
+        front->length += hypotf(p.x - last.x, p.y - last.y);
+    }
+    c->points[c->npoints++] = p;
+    front->npoints++;
+}
+
+int contours_stitch(contours_t *c) {
+// joins the segments added since contours_clear into fronts.  Each segment
+// end is paired with another at the same position, if there is one; fronts
+// are then followed from end to end.
+    int nends = 2*c->nsegments, s, entry, e, p, guard;
+    contour_front_t *front;
+
+    c->nfronts = 0;
+    c->npoints = 0;
+    c->length = 0.0;
+    if (0 == c->nsegments) {
+        return 0;
+    }
+
+    if (nends > c->mwork) {
+        c->mwork = nends;
+        c->ends = realloc(c->ends, nends*sizeof(contour_end_t));
+        c->partner = realloc(c->partner, nends*sizeof(int));
+        c->visited = realloc(c->visited, c->nsegments);
+        if (!c->ends || !c->partner || !c->visited) {
+            oops("contour alloc failure");
+        }
+    }
+    // at most one point more than segments per front
+    c->points = grow(c->points, &c->mpoints, 2*c->nsegments, sizeof(point_t));
+
+    for (e = 0; e < nends; ++e) {
+        c->ends[e].key = quantise(end_point(c, e));
+        c->ends[e].end = e;
+        c->partner[e] = -1;
+    }
+    qsort(c->ends, nends, sizeof(contour_end_t), compare_ends);
+
+    // pair up ends at the same position.  Where more than two meet (the
+    // isoline running through a vertex), they are paired in order.
+    for (e = 0; e + 1 < nends; ++e) {
+        if (c->ends[e].key == c->ends[e+1].key) {
+            c->partner[c->ends[e].end] = c->ends[e+1].end;
+            c->partner[c->ends[e+1].end] = c->ends[e].end;
+            ++e;
+        }
+    }
+
+    memset(c->visited, 0, c->nsegments);
+    for (s = 0; s < c->nsegments; ++s) {
+        if (c->visited[s])
+            continue;
+
+        // walk back to the start of the front, or round the loop to s
+        entry = 2*s;
+        for (guard = 0; guard < c->nsegments; ++guard) {
+            p = c->partner[entry];
+            if ((p < 0) || (p/2 == s) || c->visited[p/2])
+                break;
+            entry = p ^ 1;
+        }
+
+        c->fronts = grow(c->fronts, &c->mfronts, c->nfronts + 1, sizeof(contour_front_t));
+        front = &c->fronts[c->nfronts++];
+        front->first_point = c->npoints;
+        front->npoints = 0;
+        front->length = 0.0;
+        front->closed = 0;
+
+        // and forward to its end
+        add_point(c, front, end_point(c, entry));
+        e = entry;
+        while (1) {
+            c->visited[e/2] = 1;
+            add_point(c, front, end_point(c, e ^ 1));
+            p = c->partner[e ^ 1];
+            if (p < 0)
+                break;
+            if (p == entry) {
+                front->closed = 1;
+                break;
+            }
+            if (c->visited[p/2])
+                break;
+            e = p;
+        }
+        c->length += front->length;
+    }
+
+    return c->nfronts;
+}
+
+void destroy_contours(contours_t *c) {
+// frees the contours
+    if (!c) {
+        return;
+    }
+    free(c->segments);
+    free(c->fronts);
+    free(c->points);
+    free(c->ends);
+    free(c->partner);
+    free(c->visited);
+    free(c);
+}
@@ -0,0 +1,75 @@
+/*
+ * contours.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Assembly of isoline contours (wavefronts) from the crossing segments
+ * find_isoline gives for each cell.  Neighbouring cells compute the crossing
+ * on their shared edge with the same arithmetic, so segment ends are joined
+ * by matching their (finely quantised) coordinates, giving polylines that are
+ * either closed loops or open fronts ending at the edge of the sheet.
+ *
+ * Typical use, once per frame:
+ *
+ *   contours_clear(c);
+ *   contours_add_segments(c, segments, nsegments);   // any number of times
+ *   contours_stitch(c);
+ *   for (n = 0; n < c->nfronts; ++n)
+ *       ... c->fronts[n], points c->points[first_point ...] ...
+ */
+
+#ifndef CONTOURS_H
+#define CONTOURS_H
+
+#include "point_t.h"
+
+typedef struct contour_segment {
+    point_t a;
+    point_t b;
+} contour_segment_t;
+
+typedef struct contour_front {
+    int first_point;        // index of the front's first point in points
+    int npoints;            // closed fronts repeat their first point at the end
+    float length;
+    int closed;
+} contour_front_t;
+
+typedef struct contours {
+    contour_segment_t *segments;
+    int nsegments;
+    int msegments;
+
+    contour_front_t *fronts;
+    int nfronts;
+    int mfronts;
+    point_t *points;
+    int npoints;
+    int mpoints;
+    float length;           // total length of all fronts
+
+    // stitching workspace
+    struct contour_end *ends;
+    int *partner;
+    unsigned char *visited;
+    int mwork;
+} contours_t;
+
+contours_t * new_contours(void);
+// creates an empty set of contours
+
+void contours_clear(contours_t *c);
+// forgets all segments and fronts, keeping the memory for reuse
+
+void contours_add_segments(contours_t *c, const contour_segment_t *segments, int nsegments);
+// adds segments, in sheet coordinates, to be stitched
+
+int contours_stitch(contours_t *c);
+// joins the segments added since contours_clear into fronts
+//
+// returns:
+//  the number of fronts
+
+void destroy_contours(contours_t *c);
+// frees the contours
+
+#endif // CONTOURS_H
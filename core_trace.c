@@ -7,16 +7,64 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "tip_trace_binary.h"
+#include "frame_archive.h"
+#include "frame_file.h"
+#include "fixed_kernels.h"
+#include "frame_bus.h"
+#include "frame_cache.h"
+#include "kernels.h"
+#include "phase_map.h"
+#include "query_server.h"
 #include "utils/string_list.h"
+#include "utils/frame_list.h"
 #include "helper.h"
 
 static void print_help_text(char * progname);
 // help text output
 
+static frame_list_t * expand_files(string_list_t *files, file_type_t type);
+// replaces each archive or multi-frame file in the list with references to
+// all of its frames
+
+static int is_frame_file(const char *name);
+// whether name is an .npy or IGB file
+
+static void take_header(const char *name, file_type_t type, int *nx, int *ny, int size_set,
+        float *dt, int dt_set);
+// takes the sheet size, and any timestep, from an archive's or an .npy or IGB
+// file's header
+
+// long options with no short form
+enum {
+    STATS_OPTION = 256,
+    CONTOURS_OPTION,
+    ACTIVATION_OPTION,
+    ACTIVATION_EVERY_OPTION,
+    CACHE_OPTION,
+    MASK_OPTION,
+    STRIDE_OPTION,
+    REFINE_DISTANCE_OPTION,
+    PHASE_OPTION,
+    PHASE_MEMORY_OPTION,
+    SCRATCH_OPTION,
+    ROI_OPTION,
+    PUBLISH_OPTION,
+    BUS_OPTION,
+    BUS_SLOTS_OPTION,
+    BUS_CONSUMERS_OPTION,
+    SERVE_OPTION,
+    SERVE_MEMORY_OPTION,
+    SERVE_WORKERS_OPTION,
+    QUANTISE_OPTION,
+    ENSEMBLE_OPTION
+};
+
 int main (int argc, char ** argv) {
-    int c, file_set = 0;
+    int c, file_set = 0, dt_set = 0, size_set = 0, type_set = 0;
  
     // dimensions of the sheet.
     int nx, ny;
@@ -29,11 +77,69 @@ int main (int argc, char ** argv) {
 
     // output file
     FILE *output;
+    char *output_name = NULL;
+
+    // frame range and checkpointing
+    process_options_t options;
+    long checkpoint_frame, checkpoint_offset;
+    int resume = 0;
+
+    // progress reporting
+    char *status_file = NULL, *status_socket = NULL;
+    double status_interval = 1.0;
+    long frames_total;
+
+    // trajectory summaries
+    FILE *summary = NULL;
+    float link_radius = 5.0;
+
+    // activation maps
+    char *activation = NULL;
+
+    // cached results
+    char *cache = NULL;
+
+    // tissue mask
+    char *mask_name = NULL;
+    float **tissue;
+    tip_mask_t *mask = NULL;
+
+    // the part of the sheet to trace, and its size
+    sheet_window_t roi;
+    char trailing;
+    int wx, wy;
+
+    // tips as phase singularities
+    int phase = 0;
+
+    // frames shared with other processes
+    char *publish = NULL, *bus_name = NULL;
+    int bus_slots = 8, bus_consumers = 1;
+    frame_bus_t *bus = NULL;
+
+    // resident query daemon
+    char *serve = NULL;
+
+    // ensemble members, each a run of frames
+    char *ensemble = NULL, *member_pattern;
+    frame_list_t **members = NULL;
+    long *member_ids = NULL;
+    long nmembers = 0, m, member_start, member_end, member_step;
+
+    // run statistics
+    int stats = 0;
+    struct timespec run_start, run_end;
+    double elapsed;
+    long frames_run, frames_traced = -1;
 
     // inpit file
     FILE *input;
     string_list_t *filenames;
-    char filename[64];
+    frame_list_t *frames;
+
+    // frame name pattern and range
+    char *pattern = NULL, *range = NULL;
+    long start, end, step;
 
 
     // filetype
@@ -47,6 +153,7 @@ int main (int argc, char ** argv) {
     type = BINARY_FLOAT;
     dt = 1;
     filenames = new_string_list();
+    default_process_options(&options);
 
     while (1)
     {
@@ -61,13 +168,47 @@ int main (int argc, char ** argv) {
             {"isoline",     required_argument, 0, 'i'},
             {"output",      required_argument, 0, 'o'},
             {"type",        required_argument, 0, 'T'},
+            {"pattern",     required_argument, 0, 'p'},
+            {"range",       required_argument, 0, 'r'},
+            {"frames",      required_argument, 0, 'F'},
+            {"checkpoint",  required_argument, 0, 'c'},
+            {"checkpoint-every", required_argument, 0, 'C'},
+            {"resume",      no_argument,       0, 'R'},
+            {"status-file", required_argument, 0, 's'},
+            {"status-socket", required_argument, 0, 'S'},
+            {"status-interval", required_argument, 0, 'I'},
+            {"summary",     required_argument, 0, 'm'},
+            {"link-radius", required_argument, 0, 'L'},
+            {"no-trace",    no_argument,       0, 'N'},
+            {"threads",     required_argument, 0, 'j'},
+            {"stats",       no_argument,       0, STATS_OPTION},
+            {"contours",    required_argument, 0, CONTOURS_OPTION},
+            {"activation",  required_argument, 0, ACTIVATION_OPTION},
+            {"activation-every", required_argument, 0, ACTIVATION_EVERY_OPTION},
+            {"cache",       required_argument, 0, CACHE_OPTION},
+            {"mask",        required_argument, 0, MASK_OPTION},
+            {"stride",      required_argument, 0, STRIDE_OPTION},
+            {"refine-distance", required_argument, 0, REFINE_DISTANCE_OPTION},
+            {"phase",       no_argument,       0, PHASE_OPTION},
+            {"phase-memory", required_argument, 0, PHASE_MEMORY_OPTION},
+            {"scratch",     required_argument, 0, SCRATCH_OPTION},
+            {"roi",         required_argument, 0, ROI_OPTION},
+            {"publish",     required_argument, 0, PUBLISH_OPTION},
+            {"bus",         required_argument, 0, BUS_OPTION},
+            {"bus-slots",   required_argument, 0, BUS_SLOTS_OPTION},
+            {"bus-consumers", required_argument, 0, BUS_CONSUMERS_OPTION},
+            {"serve",       required_argument, 0, SERVE_OPTION},
+            {"serve-memory", required_argument, 0, SERVE_MEMORY_OPTION},
+            {"serve-workers", required_argument, 0, SERVE_WORKERS_OPTION},
+            {"quantise",    no_argument,       0, QUANTISE_OPTION},
+            {"ensemble",    required_argument, 0, ENSEMBLE_OPTION},
             {"help",        no_argument,       0, 'h'},
             {0, 0, 0, 0}
         };
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "x:y:t:f:i:o:T:h",
+        c = getopt_long (argc, argv, "x:y:t:f:i:o:T:p:r:F:c:C:Rs:S:I:m:L:Nj:h",
                 long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -79,14 +220,17 @@ int main (int argc, char ** argv) {
 
             case 'x':
                 nx = atoi(optarg);
+                size_set = 1;
                 break;
 
             case 'y':
                 ny = atoi(optarg);
+                size_set = 1;
                 break;
 
             case 't':
                 dt = atof(optarg);
+                dt_set = 1;
                 break;
 
             case 'i':
@@ -94,10 +238,12 @@ int main (int argc, char ** argv) {
                 break;
 
             case 'o':
-                open(output, "w", optarg);
+                // opened once we know whether we're resuming
+                output_name = optarg;
                 break;
 
             case 'T':
+                type_set = 1;
                 if (0==strcmp("float", optarg)) {
                     type = BINARY_FLOAT;
                     break;
@@ -110,16 +256,157 @@ int main (int argc, char ** argv) {
                     type = TEXT;
                     break;
                 }
-                fprintf(stderr, "Unrecognised type.  Try float or double or text\n");
+                if (0==strcmp("archive", optarg)) {
+                    type = ARCHIVE;
+                    break;
+                }
+                if ((0==strcmp("npy", optarg)) || (0==strcmp("igb", optarg))) {
+                    // either is recognised from its header
+                    type = FRAME_FILE;
+                    break;
+                }
+                fprintf(stderr, "Unrecognised type.  Try float or double or text or archive or npy or igb\n");
                 exit(EXIT_FAILURE);
             case 'f':
                 if ((optarg[0] == '-') && (optarg[1] == 0)) {
                     input = stdin;
+                    file_set = 1;
                     break;
                 }
                 open(input, "r", optarg);
                 file_set = 1;
                 break;
+            case 'p':
+                pattern = optarg;
+                break;
+            case 'r':
+                range = optarg;
+                break;
+            case 'F':
+                if ((0 != parse_frame_range(optarg, &start, &end, &step))
+                        || (1 != step) || (start < 0) || (end < start)) {
+                    fprintf(stderr, "--frames takes START:END\n");
+                    exit(EXIT_FAILURE);
+                }
+                options.first_frame = start;
+                options.end_frame = end;
+                break;
+            case 'c':
+                options.checkpoint = optarg;
+                break;
+            case 'C':
+                options.checkpoint_every = atol(optarg);
+                if (options.checkpoint_every < 1) {
+                    fprintf(stderr, "--checkpoint-every must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                resume = 1;
+                break;
+            case 's':
+                status_file = optarg;
+                break;
+            case 'S':
+                status_socket = optarg;
+                break;
+            case 'I':
+                status_interval = atof(optarg);
+                break;
+            case 'm':
+                if ((optarg[0] == '-') && (optarg[1] == 0)) {
+                    summary = stdout;
+                    break;
+                }
+                summary = fopen(optarg, "w");
+                if (!summary) {
+                    oops(optarg);
+                }
+                break;
+            case 'L':
+                link_radius = atof(optarg);
+                break;
+            case 'N':
+                options.write_trace = 0;
+                break;
+            case 'j':
+                options.nthreads = atoi(optarg);
+                break;
+            case STATS_OPTION:
+                stats = 1;
+                break;
+            case ACTIVATION_OPTION:
+                activation = optarg;
+                break;
+            case ACTIVATION_EVERY_OPTION:
+                options.activation_every = atol(optarg);
+                break;
+            case CACHE_OPTION:
+                cache = optarg;
+                break;
+            case MASK_OPTION:
+                mask_name = optarg;
+                break;
+            case STRIDE_OPTION:
+                options.stride = atol(optarg);
+                break;
+            case REFINE_DISTANCE_OPTION:
+                options.refine_distance = atof(optarg);
+                break;
+            case PHASE_OPTION:
+                phase = 1;
+                break;
+            case PHASE_MEMORY_OPTION:
+                options.phase_memory = (long long) (atof(optarg)*(1 << 20));
+                break;
+            case SCRATCH_OPTION:
+                options.scratch = optarg;
+                break;
+            case ROI_OPTION:
+                if (4 != sscanf(optarg, "%d:%d,%d:%d%c", &roi.x0, &roi.x1, &roi.y0, &roi.y1,
+                            &trailing)) {
+                    fprintf(stderr, "--roi takes X0:X1,Y0:Y1\n");
+                    exit(EXIT_FAILURE);
+                }
+                options.roi = &roi;
+                break;
+            case PUBLISH_OPTION:
+                publish = optarg;
+                break;
+            case BUS_OPTION:
+                bus_name = optarg;
+                break;
+            case BUS_SLOTS_OPTION:
+                bus_slots = atoi(optarg);
+                break;
+            case BUS_CONSUMERS_OPTION:
+                bus_consumers = atoi(optarg);
+                break;
+            case SERVE_OPTION:
+                serve = optarg;
+                break;
+            case SERVE_MEMORY_OPTION:
+                options.serve_memory = (long long) (atof(optarg)*(1 << 20));
+                break;
+            case SERVE_WORKERS_OPTION:
+                options.serve_workers = atoi(optarg);
+                break;
+            case QUANTISE_OPTION:
+                options.quantise = 1;
+                break;
+            case ENSEMBLE_OPTION:
+                ensemble = optarg;
+                break;
+            case CONTOURS_OPTION:
+                if ((optarg[0] == '-') && (optarg[1] == 0)) {
+                    options.contours = stdout;
+                    break;
+                }
+                options.contours = fopen(optarg, "w");
+                if (!options.contours) {
+                    oops(optarg);
+                }
+                break;
             case 'h':
                 print_help_text(argv[0]);
             case '?':
@@ -133,40 +420,497 @@ int main (int argc, char ** argv) {
     }
 
 
-    // if we didn't set a file, use the spare args from the commandline
-    if (0 == file_set) {
-        while (optind < argc) {
-            string_list_push(filenames, argv[optind++]);
+    if (serve && (publish || bus_name || phase || cache || mask_name || activation || summary
+                || options.contours || options.checkpoint || (options.stride > 1)
+                || (options.first_frame > 0) || (options.end_frame >= 0))) {
+        // requests choose the frames, isoline and region; nothing else
+        fprintf(stderr, "--serve can't be used with --publish, --bus, --phase, --cache, --mask, --activation, --summary, --contours, --checkpoint, --stride or --frames\n");
+        exit(EXIT_FAILURE);
+    }
+    if (serve && (options.serve_workers < 1)) {
+        fprintf(stderr, "--serve-workers must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (ensemble && (!pattern || serve || publish || bus_name || phase || cache || mask_name
+                || activation || summary || options.contours || options.checkpoint || options.roi
+                || (options.stride > 1) || (ARCHIVE == type))) {
+        // members are traced together, each frame of all of them at once
+        fprintf(stderr, "--ensemble needs a --pattern, and can't be used with --serve, --publish, --bus, --phase, --cache, --mask, --activation, --summary, --contours, --checkpoint, --roi, --stride or archives\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (publish && bus_name) {
+        fprintf(stderr, "--publish and --bus can't be used together\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((publish || bus_name) && (options.roi || cache || phase || options.checkpoint
+                || (options.stride > 1))) {
+        // frames are decoded whole, and each consumer sees them once, in order
+        fprintf(stderr, "--publish and --bus can't be used with --roi, --cache, --phase, --checkpoint or --stride\n");
+        exit(EXIT_FAILURE);
+    }
+    if (publish && (options.contours || activation || summary || mask_name)) {
+        fprintf(stderr, "--publish only decodes frames; trace them with --bus\n");
+        exit(EXIT_FAILURE);
+    }
+    if (publish && ((bus_slots < 2) || (bus_consumers < 0) || (bus_consumers > FRAME_BUS_MAX_CONSUMERS))) {
+        fprintf(stderr, "--bus-slots must be at least 2, and --bus-consumers at most %d\n",
+                FRAME_BUS_MAX_CONSUMERS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (bus_name) {
+        // the frames, and their size, come from the producer
+        if (file_set || pattern || (optind < argc)) {
+            fprintf(stderr, "--bus takes its frames from the bus, not a file list\n");
+            exit(EXIT_FAILURE);
+        }
+        bus = frame_bus_attach(bus_name);
+        if (!bus) {
+            exit(EXIT_FAILURE);
         }
+        frame_bus_dimensions(bus, &nx, &ny);
+        frames = NULL;
+        destroy_string_list(filenames);
+    } else if (ensemble) {
+        // the pattern's first conversion is the member, its second the frame
+        if (file_set || (optind < argc)) {
+            fprintf(stderr, "--pattern can't be combined with a file list\n");
+            exit(EXIT_FAILURE);
+        }
+        if ((0 != parse_frame_range(ensemble, &member_start, &member_end, &member_step))
+                || (member_step < 1) || (member_end <= member_start)) {
+            fprintf(stderr, "--ensemble takes START:END[:STEP]\n");
+            exit(EXIT_FAILURE);
+        }
+        if (!range || (0 != parse_frame_range(range, &start, &end, &step))) {
+            fprintf(stderr, "--pattern needs a --range START:END[:STEP]\n");
+            exit(EXIT_FAILURE);
+        }
+        nmembers = (member_end - member_start + member_step - 1)/member_step;
+        MALLOC(members, nmembers*sizeof(frame_list_t *), "ensemble");
+        MALLOC(member_ids, nmembers*sizeof(long), "ensemble");
+        for (m = 0; m < nmembers; ++m) {
+            member_ids[m] = member_start + m*member_step;
+            member_pattern = bind_pattern(pattern, member_ids[m]);
+            members[m] = member_pattern ? new_pattern_frame_list(member_pattern, start, end, step) : NULL;
+            free(member_pattern);
+            if (!members[m]) {
+                fprintf(stderr, "--ensemble needs a --pattern with two integer conversions, the member then the frame\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        frames = members[0];
+        if (!type_set && is_frame_file(frame_list_at(frames, 0))) {
+            type = FRAME_FILE;
+        }
+        destroy_string_list(filenames);
+    } else if (pattern) {
+        // frame names generated from the pattern; nothing else to read
+        if (file_set || (optind < argc)) {
+            fprintf(stderr, "--pattern can't be combined with a file list\n");
+            exit(EXIT_FAILURE);
+        }
+        if (!range || (0 != parse_frame_range(range, &start, &end, &step))) {
+            fprintf(stderr, "--pattern needs a --range START:END[:STEP]\n");
+            exit(EXIT_FAILURE);
+        }
+        frames = new_pattern_frame_list(pattern, start, end, step);
+        if (!frames) {
+            exit(EXIT_FAILURE);
+        }
+        if (!type_set && is_frame_file(frame_list_at(frames, 0))) {
+            type = FRAME_FILE;
+        }
+        destroy_string_list(filenames);
     } else {
-        // read the file
-        while(EOF != fscanf(input, "%s", filename)) {
-            string_list_push(filenames, filename);
+        // if we didn't set a file, use the spare args from the commandline
+        if (0 == file_set) {
+            while (optind < argc) {
+                string_list_push(filenames, argv[optind++]);
+            }
+        } else {
+            // read the file
+            if (-1 == string_list_read(filenames, input)) {
+                oops("filename list");
+            }
         }
+
+        if (string_list_length(filenames) < 1) {
+            fprintf(stderr, "No filenames found!\n");
+            print_help_text(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!type_set && is_frame_file(string_list_at(filenames, 0))) {
+            type = FRAME_FILE;
+        }
+        if ((ARCHIVE == type) || (FRAME_FILE == type)) {
+            frames = expand_files(filenames, type);
+        } else {
+            frames = new_frame_list(filenames);
+        }
+    }
+
+    if (!bus && (frame_list_length(frames) < 1)) {
+        fprintf(stderr, "No frames to process!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!bus && ((ARCHIVE == type) || (FRAME_FILE == type))) {
+        // the files say how big their sheets are
+        take_header(frame_list_at(frames, 0), type, &nx, &ny, size_set, &dt, dt_set);
+    }
+
+    // everything after reading works on the window alone
+    wx = nx;
+    wy = ny;
+    if (options.roi) {
+        if ((roi.x0 < 0) || (roi.x1 > nx) || (roi.x1 - roi.x0 < 3)
+                || (roi.y0 < 0) || (roi.y1 > ny) || (roi.y1 - roi.y0 < 3)) {
+            fprintf(stderr, "--roi must be at least 3 by 3, and within the %d by %d sheet\n", nx, ny);
+            exit(EXIT_FAILURE);
+        }
+        wx = roi.x1 - roi.x0;
+        wy = roi.y1 - roi.y0;
     }
 
-    if (string_list_length(filenames) < 1) {
-        fprintf(stderr, "No filenames found!\n");
-        print_help_text(argv[0]);
+    if (options.stride < 1) {
+        fprintf(stderr, "--stride must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((options.stride > 1) && (activation || cache)) {
+        // both need every frame, paired with the one before it
+        fprintf(stderr, "--stride can't be used with --activation or --cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (phase && (options.checkpoint || options.contours || activation || cache
+                || (options.stride > 1))) {
+        // the phase of a frame depends on the whole run
+        fprintf(stderr, "--phase can't be used with --checkpoint, --contours, --activation, --cache or --stride\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (resume && (!options.checkpoint || !output_name)) {
+        fprintf(stderr, "--resume needs both --checkpoint and --output\n");
         exit(EXIT_FAILURE);
     }
 
+    if (resume && (0 == read_checkpoint(options.checkpoint, &checkpoint_frame, &checkpoint_offset))) {
+        // drop anything written after the checkpoint, and carry on from there
+        output = fopen(output_name, "r+");
+        if (!output) {
+            oops(output_name);
+        }
+        if ((checkpoint_offset < 0) || (0 != ftruncate(fileno(output), checkpoint_offset))
+                || (0 != fseek(output, 0, SEEK_END))) {
+            oops(output_name);
+        }
+        if (checkpoint_frame + 1 > options.first_frame) {
+            options.first_frame = checkpoint_frame + 1;
+        }
+    } else if (output_name) {
+        output = fopen(output_name, "w");
+        if (!output) {
+            oops(output_name);
+        }
+    }
+
+    if (status_file || status_socket) {
+        // a consumer doesn't know how many frames are coming
+        frames_total = bus ? 0 : frame_list_length(frames);
+        if ((options.end_frame >= 0) && (options.end_frame < frames_total)) {
+            frames_total = options.end_frame;
+        }
+        frames_total -= options.first_frame;
+        options.telemetry = telemetry_start(status_file, status_socket,
+                status_interval, frames_total > 0 ? frames_total : 0);
+        if (!options.telemetry) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (summary) {
+        options.stats = new_trajectory_stats(link_radius, summary);
+    }
+
+    if (activation) {
+        options.activation = new_activation_map(wx, wy, isoline, activation);
+        if (options.roi) {
+            options.activation->x0 = roi.x0;
+            options.activation->y0 = roi.y0;
+        }
+    }
+
+    if (mask_name) {
+        // a text sheet, non-zero for tissue
+        F_ARRAY_2D(tissue, wy, wx);
+        if (0 != read_file_window(NULL, TEXT, nx, ny, options.roi, tissue, mask_name)) {
+            fprintf(stderr, "Problem reading mask %s\n", mask_name);
+            exit(EXIT_FAILURE);
+        }
+        mask = tip_mask_create(wx, wy, tissue);
+        free(tissue[0]);
+        free(tissue);
+        if (!mask) {
+            oops("mask");
+        }
+        options.mask = mask;
+    }
+
+    if (cache) {
+        options.cache = new_frame_cache(cache, nx, ny, options.roi, isoline, type, mask_name);
+        if (!options.cache) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (serve) {
+        // runs until interrupted; there's no trace to write
+        if (0 != serve_queries(serve, nx, ny, dt, frames, type, &options)) {
+            exit(EXIT_FAILURE);
+        }
+        destroy_frame_list(frames);
+        return 0;
+    }
+
     // scan in all the filelist!
 
-    process_file_list(nx, ny, dt, isoline, filenames, type, output);
+    clock_gettime(CLOCK_MONOTONIC, &run_start);
+    if (publish) {
+        bus = frame_bus_create(publish, nx, ny, bus_slots);
+        if (!bus) {
+            exit(EXIT_FAILURE);
+        }
+        frame_bus_wait_consumers(bus, bus_consumers);
+        publish_file_list(nx, ny, frames, type, bus, &options);
+        frame_bus_destroy(bus);
+    } else if (ensemble) {
+        process_ensemble(nx, ny, dt, isoline, members, member_ids, nmembers, type, output, &options);
+    } else if (bus) {
+        frames_traced = process_frame_bus(dt, isoline, bus, output, &options);
+        frame_bus_detach(bus);
+    } else if (phase) {
+        process_phase(nx, ny, dt, frames, type, output, &options);
+    } else {
+        process_file_list(nx, ny, dt, isoline, frames, type, output, &options);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &run_end);
+
+    if (stats) {
+        if (bus_name) {
+            // the producer chose the frames
+            frames_run = (frames_traced > 0) ? frames_traced : 0;
+        } else {
+            frames_run = frame_list_length(frames);
+            if ((options.end_frame >= 0) && (options.end_frame < frames_run)) {
+                frames_run = options.end_frame;
+            }
+            frames_run -= options.first_frame;
+        }
+        if (frames_run < 0)
+            frames_run = 0;
+        elapsed = (run_end.tv_sec - run_start.tv_sec) + 1e-9*(run_end.tv_nsec - run_start.tv_nsec);
+        fprintf(stderr, "kernels: %s\n", tip_kernels()->name);
+        if (fixed_kernels_match(wx, wy)) {
+            fprintf(stderr, "fixed size kernels: %dx%d\n", wx, wy);
+        } else {
+            fprintf(stderr, "fixed size kernels: %s\n", fixed_kernels_enabled() ? "none" : "off");
+        }
+        fprintf(stderr, "threads: %d\n", options.nthreads);
+        fprintf(stderr, "frames: %ld\n", frames_run);
+        fprintf(stderr, "bytes decoded: %llu\n", read_file_bytes());
+        if (mask) {
+            fprintf(stderr, "tissue cells: %ld of %ld\n", mask->ncells, (long) (wx - 1)*(wy - 1));
+        }
+        if (options.cache) {
+            fprintf(stderr, "cache hits: %ld\n", options.cache->hits);
+            fprintf(stderr, "cache misses: %ld\n", options.cache->misses);
+        }
+        fprintf(stderr, "elapsed: %.3f s (%.1f frames/s)\n", elapsed,
+                (elapsed > 0.0) ? frames_run/elapsed : 0.0);
+    }
+
+    telemetry_stop(options.telemetry);
+    destroy_trajectory_stats(options.stats);
+    destroy_activation_map(options.activation);
+    destroy_frame_cache(options.cache);
+    tip_mask_destroy(mask);
+    if (summary && summary != stdout) {
+        fclose(summary);
+    }
+    if (options.contours && options.contours != stdout) {
+        fclose(options.contours);
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    if (members) {
+        // frames is the first member's list
+        for (m = 0; m < nmembers; ++m) {
+            destroy_frame_list(members[m]);
+        }
+        free(members);
+        free(member_ids);
+    } else {
+        destroy_frame_list(frames);
+    }
 
+    // a bus consumer whose producer died has only part of the trace
+    if (bus_name && (frames_traced < 0)) {
+        return EXIT_FAILURE;
+    }
     return 0;
 } /* end of main() */
 
+frame_list_t * expand_files(string_list_t *files, file_type_t type) {
+// replaces each archive or multi-frame .npy or IGB file in the list with
+// references to all of its frames.  Entries already of the form FILE@FRAME,
+// and files of a single frame, are kept as they are.  A lone file becomes a
+// pattern list, so its frame names are never stored.
+    string_list_t *references;
+    frame_archive_t *archive;
+    frame_file_t header, *file;
+    frame_list_t *frames;
+    char *reference;
+    const char *name, *c;
+    size_t length;
+    int index;
+    long frame, nframes;
+
+    references = new_string_list();
+    for (index = 0; index < string_list_length(files); ++index) {
+        name = string_list_at(files, index);
+        if (strchr(name, '@')) {
+            string_list_push(references, name);
+            continue;
+        }
+
+        if (ARCHIVE == type) {
+            archive = frame_archive_open(name);
+            if (!archive) {
+                exit(EXIT_FAILURE);
+            }
+            nframes = archive->nframes;
+            frame_archive_close(archive);
+        } else {
+            // only the header is read; the frames are mapped, or decoded
+            // one at a time, when traced
+            if (1 != frame_file_probe(name, &header)) {
+                fprintf(stderr, "%s: can't be opened, or has no .npy or IGB header\n", name);
+                exit(EXIT_FAILURE);
+            }
+            nframes = header.nframes;
+            if (nframes < 0) {
+                // a compressed IGB file without t: is decoded through once
+                // to count its frames, never held whole
+                file = frame_file_open(name);
+                if (!file) {
+                    exit(EXIT_FAILURE);
+                }
+                nframes = frame_file_count(file);
+                frame_file_close(file);
+            }
+            if (nframes < 1) {
+                fprintf(stderr, "%s holds no complete frames\n", name);
+                exit(EXIT_FAILURE);
+            }
+            if (1 == nframes) {
+                string_list_push(references, name);
+                continue;
+            }
+        }
+
+        length = strlen(name) + 32;
+        MALLOC_C(reference, 2*length, "frame reference alloc failure");
+
+        if (1 == string_list_length(files)) {
+            // name@%d, escaping any % already in the name
+            char *r = reference;
+            for (c = name; *c; ++c) {
+                if ('%' == *c)
+                    *r++ = '%';
+                *r++ = *c;
+            }
+            strcpy(r, "@%ld");
+            frames = new_pattern_frame_list(reference, 0, nframes, 1);
+            free(reference);
+            destroy_string_list(files);
+            destroy_string_list(references);
+            return frames;
+        }
+
+        for (frame = 0; frame < nframes; ++frame) {
+            snprintf(reference, length, "%s@%ld", name, frame);
+            string_list_push(references, reference);
+        }
+        free(reference);
+    }
+
+    destroy_string_list(files);
+    return new_frame_list(references);
+}
+
+int is_frame_file(const char *name) {
+// whether name, a file or FILE@FRAME, starts with an .npy or IGB header
+    frame_file_t header;
+
+    return name && (1 == frame_file_probe(name, &header));
+}
+
+void take_header(const char *name, file_type_t type, int *nx, int *ny, int size_set,
+        float *dt, int dt_set) {
+// takes the sheet size, and any timestep, from the header of the first
+// file, checking it against any size given
+    frame_archive_t *archive;
+    frame_file_t header;
+    char *path;
+    long frame;
+
+    if (ARCHIVE == type) {
+        // ARCHIVE@FRAME names the archive's header as well as its frame
+        path = strndup(name, frame_file_path(name, &frame));
+        if (!path) {
+            oops("archive name alloc failure");
+        }
+        archive = frame_archive_open(path);
+        free(path);
+        if (!archive) {
+            exit(EXIT_FAILURE);
+        }
+        header.nx = archive->nx;
+        header.ny = archive->ny;
+        header.dt = archive->dt;
+        frame_archive_close(archive);
+    } else if (1 != frame_file_probe(name, &header)) {
+        fprintf(stderr, "%s: can't be opened, or has no .npy or IGB header\n", name);
+        exit(EXIT_FAILURE);
+    }
+    if (size_set && ((*nx != header.nx) || (*ny != header.ny))) {
+        fprintf(stderr, "%s holds %d by %d frames, not the %d by %d given\n", name,
+                header.nx, header.ny, *nx, *ny);
+        exit(EXIT_FAILURE);
+    }
+    *nx = header.nx;
+    *ny = header.ny;
+    if (!dt_set && (header.dt > 0)) {
+        *dt = header.dt;
+    }
+}
+
 void print_help_text(char * progname) {
     fprintf(stderr, "Usage: %s [OPTIONS] [FILE, FILE, ...]\n", progname);
     fprintf(stderr, "Calculates the spiral tip trajectories in files...\n\n");
     fprintf(stderr, "  -x NX, --x-dim NX\n");
-    fprintf(stderr, "                 The x dimension of the sheet (defaults to 375)\n");
+    fprintf(stderr, "                 The x dimension of the sheet (defaults to 375, or the size in an archive, .npy or IGB header)\n");
     fprintf(stderr, "  -y NY, --y-dim NY\n");
-    fprintf(stderr, "                 The y dimension of the sheet (defaults to 375)\n");
+    fprintf(stderr, "                 The y dimension of the sheet (defaults to 375, or the size in an archive, .npy or IGB header)\n");
     fprintf(stderr, "  -t DT, --timestep DT\n");
-    fprintf(stderr, "                 The timestep between successive frames of the sheet (defaults to 1)\n");
+    fprintf(stderr, "                 The timestep between successive frames of the sheet (defaults to 1, or an archive's dt or an IGB file's inc_t)\n");
     fprintf(stderr, "  -i LEVEL, --isoline LEVEL\n");
     fprintf(stderr, "                 The isoline to track the tips alone (defaults to -30 mV)\n");
     fprintf(stderr, "  -o FILE, --output FILE\n");
@@ -174,7 +918,75 @@ void print_help_text(char * progname) {
     fprintf(stderr, "  -f FILE, --file FILE\n");
     fprintf(stderr, "                 File to read framelist from.  - for stdin.  argv otherwise\n");
     fprintf(stderr, "  -T TYPE, --type TYPE\n");
-    fprintf(stderr, "                 Type of input files.  One of float (binary floats), double (binary doubles) or text (whitespace delimited text).  Defaults to float.\n");
+    fprintf(stderr, "                 Type of input files.  One of float (binary floats), double (binary doubles), text (whitespace delimited text), archive (frame archives from pack_frames, or ARCHIVE@FRAME) or npy or igb (NumPy or openCARP IGB files of one frame or many, or FILE@FRAME).  Defaults to float, or npy/igb when the first file has such a header.\n");
+    fprintf(stderr, "  -p PATTERN, --pattern PATTERN\n");
+    fprintf(stderr, "                 Generate frame names from a printf pattern, e.g. 'run7/frame_%%06d.bin.gz', instead of a file list\n");
+    fprintf(stderr, "  -r START:END[:STEP], --range START:END[:STEP]\n");
+    fprintf(stderr, "                 Frame numbers for --pattern, from START up to but not including END.  Times are frame number * DT, whatever the STEP\n");
+    fprintf(stderr, "  -F START:END, --frames START:END\n");
+    fprintf(stderr, "                 Only report frames START up to but not including END, for splitting a run into shards\n");
+    fprintf(stderr, "  -c FILE, --checkpoint FILE\n");
+    fprintf(stderr, "                 Periodically record the last frame written in FILE\n");
+    fprintf(stderr, "  -C N, --checkpoint-every N\n");
+    fprintf(stderr, "                 Frames between checkpoints (defaults to 1000)\n");
+    fprintf(stderr, "  -R, --resume\n");
+    fprintf(stderr, "                 Continue an interrupted run from its checkpoint, appending to --output\n");
+    fprintf(stderr, "  -s FILE, --status-file FILE\n");
+    fprintf(stderr, "                 Periodically rewrite FILE with progress and throughput figures\n");
+    fprintf(stderr, "  -S PATH, --status-socket PATH\n");
+    fprintf(stderr, "                 Serve the same progress report to connections on a Unix-domain socket\n");
+    fprintf(stderr, "  -I SECONDS, --status-interval SECONDS\n");
+    fprintf(stderr, "                 Interval between progress updates (defaults to 1)\n");
+    fprintf(stderr, "  -m FILE, --summary FILE\n");
+    fprintf(stderr, "                 Link tips into trajectories and write a summary of each (period, meander, drift...) to FILE\n");
+    fprintf(stderr, "  -L R, --link-radius R\n");
+    fprintf(stderr, "                 Furthest a tip may move between frames and stay on the same trajectory (defaults to 5)\n");
+    fprintf(stderr, "  -N, --no-trace\n");
+    fprintf(stderr, "                 Don't write the individual tip positions, e.g. when only --summary is wanted\n");
+    fprintf(stderr, "  -j N, --threads N\n");
+    fprintf(stderr, "                 Threads to search each frame with (defaults to 1)\n");
+    fprintf(stderr, "  --contours FILE\n");
+    fprintf(stderr, "                 Write the isoline fronts of each frame (points, length, closed or open) to FILE, found in the same pass as the tips\n");
+    fprintf(stderr, "  --activation FILE\n");
+    fprintf(stderr, "                 Write per-pixel activation times and cycle length mean and deviation to FILE at the end of the run\n");
+    fprintf(stderr, "  --activation-every N\n");
+    fprintf(stderr, "                 Also rewrite the --activation map every N frames\n");
+    fprintf(stderr, "  --cache DIR\n");
+    fprintf(stderr, "                 Keep each frame's tips in DIR, and use them instead of decoding frames whose files haven't changed\n");
+    fprintf(stderr, "  --mask FILE\n");
+    fprintf(stderr, "                 Only look for tips (and contours) in tissue: FILE is a text sheet of NX*NY values, non-zero for tissue\n");
+    fprintf(stderr, "  --stride K\n");
+    fprintf(stderr, "                 Trace every Kth frame (and the last), tracing the frames in between only where tips appear, vanish or jump\n");
+    fprintf(stderr, "  --refine-distance D\n");
+    fprintf(stderr, "                 Furthest a tip may move between --stride samples without tracing the frames in between (defaults to 1)\n");
+    fprintf(stderr, "  --phase\n");
+    fprintf(stderr, "                 Find tips as singularities of each pixel's phase, from a Hilbert transform of its whole series, instead of pairing frames\n");
+    fprintf(stderr, "  --phase-memory MB\n");
+    fprintf(stderr, "                 Memory --phase may use, the rest of the run being kept in a scratch file (defaults to 256)\n");
+    fprintf(stderr, "  --scratch DIR\n");
+    fprintf(stderr, "                 Directory for the --phase scratch file (defaults to $TMPDIR or /tmp)\n");
+    fprintf(stderr, "  --roi X0:X1,Y0:Y1\n");
+    fprintf(stderr, "                 Only read and trace columns X0 to X1-1 and rows Y0 to Y1-1; tips are still reported in whole sheet coordinates\n");
+    fprintf(stderr, "  --publish NAME\n");
+    fprintf(stderr, "                 Decode the frames into a shared memory frame bus NAME (e.g. /run7) for --bus consumers, instead of tracing them\n");
+    fprintf(stderr, "  --bus-slots N\n");
+    fprintf(stderr, "                 Frames the --publish bus holds, bounding how far the producer runs ahead of the slowest consumer (defaults to 8)\n");
+    fprintf(stderr, "  --bus-consumers N\n");
+    fprintf(stderr, "                 Consumers --publish waits for before it starts (defaults to 1)\n");
+    fprintf(stderr, "  --bus NAME\n");
+    fprintf(stderr, "                 Trace the frames published on frame bus NAME, taking the sheet size from it, instead of reading files\n");
+    fprintf(stderr, "  --serve SOCKET\n");
+    fprintf(stderr, "                 Keep the frames (of the --roi) in memory and answer requests for tips on the Unix-domain SOCKET until interrupted; see query_server.h\n");
+    fprintf(stderr, "  --serve-memory MB\n");
+    fprintf(stderr, "                 Memory --serve may keep frames in, the least recently used being dropped (defaults to 1024)\n");
+    fprintf(stderr, "  --serve-workers N\n");
+    fprintf(stderr, "                 Connections --serve answers at once (defaults to 4)\n");
+    fprintf(stderr, "  --quantise\n");
+    fprintf(stderr, "                 Keep --serve frames as 16 bit levels between each frame's extremes, halving their memory\n");
+    fprintf(stderr, "  --ensemble START:END[:STEP]\n");
+    fprintf(stderr, "                 Trace ensemble members START to END-1 together, --pattern's first conversion being the member and its second the frame; tips are written as 'time member x y'\n");
+    fprintf(stderr, "  --stats\n");
+    fprintf(stderr, "                 Report the kernel variant used (see TIP_TRACE_ISA), frames and throughput on stderr when done\n");
     fprintf(stderr, "  -h, --help\n");
     fprintf(stderr, "                 This help\n");
     exit(EXIT_FAILURE);
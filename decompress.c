@@ -0,0 +1,589 @@
+/*
+ * decompress.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "decompress.h"
+
+struct decompressor {
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_dctx *lz4;
+#endif
+    int unused;                 // so the struct is never empty
+};
+
+static int grow_buffer(unsigned char **out, size_t *out_size) {
+// doubles the size of a growable output buffer
+    size_t size = (*out_size < 4096) ? 4096 : 2 * (*out_size);
+    unsigned char *p = realloc(*out, size);
+
+    if (!p) {
+        return -1;
+    }
+    *out = p;
+    *out_size = size;
+    return 0;
+}
+
+compression_t detect_compression(const unsigned char *magic, size_t length) {
+// identifies the compression of a file from its first bytes.
+    if (length >= 2 && 0x1f == magic[0] && 0x8b == magic[1]) {
+        return COMPRESSION_GZIP;
+    }
+    if (length >= 4 && 0x28 == magic[0] && 0xb5 == magic[1]
+            && 0x2f == magic[2] && 0xfd == magic[3]) {
+        return COMPRESSION_ZSTD;
+    }
+    if (length >= 4 && 0x04 == magic[0] && 0x22 == magic[1]
+            && 0x4d == magic[2] && 0x18 == magic[3]) {
+        return COMPRESSION_LZ4;
+    }
+    return COMPRESSION_NONE;
+}
+
+const char * compression_name(compression_t compression) {
+// printable name of a compression format
+    switch (compression) {
+        case COMPRESSION_NONE:
+            return "none";
+        case COMPRESSION_GZIP:
+            return "gzip";
+        case COMPRESSION_ZSTD:
+            return "zstd";
+        case COMPRESSION_LZ4:
+            return "lz4";
+        default:
+            return "unknown";
+    }
+}
+
+static long inflate_buffer(const unsigned char *in, size_t in_length,
+        unsigned char **out, size_t *out_size, int grow) {
+// gzip, possibly several concatenated members as gzread would accept.
+    z_stream z;
+    int status;
+    size_t produced = 0;
+
+    memset(&z, 0, sizeof(z));
+    if (Z_OK != inflateInit2(&z, 16 + MAX_WBITS)) {
+        return -1;
+    }
+
+    z.next_in = (unsigned char *) in;
+    z.avail_in = in_length;
+
+    while (1) {
+        if (produced == *out_size) {
+            if (!grow)
+                break;
+            if (0 != grow_buffer(out, out_size)) {
+                inflateEnd(&z);
+                return -1;
+            }
+        }
+        z.next_out = *out + produced;
+        z.avail_out = *out_size - produced;
+
+        status = inflate(&z, Z_NO_FLUSH);
+        produced = *out_size - z.avail_out;
+
+        if (Z_STREAM_END == status) {
+            // another member may follow
+            if (z.avail_in > 0 && 0x1f == z.next_in[0]) {
+                inflateReset(&z);
+                continue;
+            }
+            break;
+        }
+        if (Z_OK != status && !(Z_BUF_ERROR == status && 0 == z.avail_out)) {
+            inflateEnd(&z);
+            return -1;
+        }
+    }
+
+    inflateEnd(&z);
+    return produced;
+}
+
+decompressor_t * new_decompressor(void) {
+// creates a decompressor, with its contexts still to be allocated
+    return calloc(1, sizeof(decompressor_t));
+}
+
+static void free_contexts(decompressor_t *d) {
+// frees the contexts a decompressor has allocated
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(d->zstd);
+    d->zstd = NULL;
+#endif
+#ifdef HAVE_LZ4
+    if (d->lz4) {
+        LZ4F_freeDecompressionContext(d->lz4);
+        d->lz4 = NULL;
+    }
+#endif
+    (void) d;
+}
+
+void destroy_decompressor(decompressor_t *d) {
+// frees a decompressor and its contexts
+    if (!d) {
+        return;
+    }
+    free_contexts(d);
+    free(d);
+}
+
+#ifdef HAVE_ZSTD
+static long zstd_buffer(decompressor_t *d, const unsigned char *in, size_t in_length,
+        unsigned char **out, size_t *out_size, int grow) {
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer input = { in, in_length, 0 };
+    ZSTD_outBuffer output;
+    size_t status, produced = 0;
+    unsigned long long content;
+
+    if (!d->zstd) {
+        d->zstd = ZSTD_createDCtx();
+        if (!d->zstd)
+            return -1;
+    }
+    dctx = d->zstd;
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+
+    // size the buffer from the frame header when we can
+    content = ZSTD_getFrameContentSize(in, in_length);
+    if (grow && content != ZSTD_CONTENTSIZE_UNKNOWN
+            && content != ZSTD_CONTENTSIZE_ERROR && content > *out_size) {
+        unsigned char *p = realloc(*out, content);
+        if (!p)
+            return -1;
+        *out = p;
+        *out_size = content;
+    }
+
+    while (input.pos < input.size) {
+        if (produced == *out_size) {
+            if (!grow)
+                break;
+            if (0 != grow_buffer(out, out_size))
+                return -1;
+        }
+        output.dst = *out;
+        output.size = *out_size;
+        output.pos = produced;
+
+        status = ZSTD_decompressStream(dctx, &output, &input);
+        produced = output.pos;
+        if (ZSTD_isError(status)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(status));
+            return -1;
+        }
+    }
+
+    return produced;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static long lz4_buffer(decompressor_t *d, const unsigned char *in, size_t in_length,
+        unsigned char **out, size_t *out_size, int grow) {
+    LZ4F_dctx *dctx;
+    size_t status, produced = 0, consumed = 0, dst_size, src_size;
+
+    if (!d->lz4) {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&d->lz4, LZ4F_VERSION))) {
+            d->lz4 = NULL;
+            return -1;
+        }
+    }
+    dctx = d->lz4;
+    LZ4F_resetDecompressionContext(dctx);
+
+    while (consumed < in_length) {
+        if (produced == *out_size) {
+            if (!grow)
+                break;
+            if (0 != grow_buffer(out, out_size))
+                return -1;
+        }
+        dst_size = *out_size - produced;
+        src_size = in_length - consumed;
+
+        status = LZ4F_decompress(dctx, *out + produced, &dst_size,
+                in + consumed, &src_size, NULL);
+        produced += dst_size;
+        consumed += src_size;
+        if (LZ4F_isError(status)) {
+            fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(status));
+            return -1;
+        }
+        if (0 == status) {
+            // end of frame; another may follow
+            LZ4F_resetDecompressionContext(dctx);
+        }
+    }
+
+    return produced;
+}
+#endif
+
+static long inflate_stream(const unsigned char *in, size_t in_length,
+        decompress_sink_t sink, void *arg) {
+// gzip, as inflate_buffer, through a small buffer
+    unsigned char piece[65536];
+    z_stream z;
+    int status, done = 0;
+    long produced = 0;
+
+    memset(&z, 0, sizeof(z));
+    if (Z_OK != inflateInit2(&z, 16 + MAX_WBITS)) {
+        return -1;
+    }
+
+    z.next_in = (unsigned char *) in;
+    z.avail_in = in_length;
+
+    while (!done) {
+        z.next_out = piece;
+        z.avail_out = sizeof(piece);
+
+        status = inflate(&z, Z_NO_FLUSH);
+        if (Z_OK != status && Z_STREAM_END != status
+                && !(Z_BUF_ERROR == status && 0 == z.avail_out)) {
+            inflateEnd(&z);
+            return -1;
+        }
+        if (sizeof(piece) > z.avail_out) {
+            produced += sizeof(piece) - z.avail_out;
+            done = sink(arg, piece, sizeof(piece) - z.avail_out);
+        }
+
+        if (Z_STREAM_END == status) {
+            // another member may follow
+            if (z.avail_in > 0 && 0x1f == z.next_in[0]) {
+                inflateReset(&z);
+                continue;
+            }
+            break;
+        }
+    }
+
+    inflateEnd(&z);
+    return produced;
+}
+
+long decompress_stream(decompressor_t *d, compression_t compression, const unsigned char *in,
+        size_t in_length, decompress_sink_t sink, void *arg) {
+// decompresses an in-memory file a piece at a time
+    unsigned char *out = NULL;
+    size_t out_size = 0;
+    long length;
+
+    if (COMPRESSION_GZIP == compression) {
+        return inflate_stream(in, in_length, sink, arg);
+    }
+    if (COMPRESSION_NONE == compression) {
+        sink(arg, in, in_length);
+        return in_length;
+    }
+
+    length = decompress_buffer(d, compression, in, in_length, &out, &out_size, 1);
+    if (length > 0) {
+        sink(arg, out, length);
+    }
+    free(out);
+    return length;
+}
+
+long decompress_buffer(decompressor_t *d, compression_t compression, const unsigned char *in,
+        size_t in_length, unsigned char **out, size_t *out_size, int grow) {
+// decompresses the whole of an in-memory file in one call.
+    decompressor_t once;
+    long length;
+
+    if (!d) {
+        // contexts for this call only
+        memset(&once, 0, sizeof(once));
+        length = decompress_buffer(&once, compression, in, in_length, out, out_size, grow);
+        free_contexts(&once);
+        return length;
+    }
+
+    switch (compression) {
+        case COMPRESSION_NONE:
+            if (in_length > *out_size) {
+                if (!grow) {
+                    in_length = *out_size;
+                } else {
+                    unsigned char *p = realloc(*out, in_length);
+                    if (!p)
+                        return -1;
+                    *out = p;
+                    *out_size = in_length;
+                }
+            }
+            memcpy(*out, in, in_length);
+            return in_length;
+        case COMPRESSION_GZIP:
+            return inflate_buffer(in, in_length, out, out_size, grow);
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            return zstd_buffer(d, in, in_length, out, out_size, grow);
+#endif
+#ifdef HAVE_LZ4
+        case COMPRESSION_LZ4:
+            return lz4_buffer(d, in, in_length, out, out_size, grow);
+#endif
+        default:
+            fprintf(stderr, "%s support was not compiled in\n",
+                    compression_name(compression));
+            return -1;
+    }
+}
+
+// compressed bytes a decompress_reader reads at a time
+#define READER_INPUT (65536)
+
+struct decompress_reader {
+    int fd;
+    compression_t compression;
+    off_t offset;               // of the next byte to read from fd
+    unsigned char *input;       // read but not yet decoded, start to end
+    size_t start;
+    size_t end;
+    int at_end;                 // nothing more to read
+    int finished;               // nothing more to decode
+    z_stream z;
+    int member_ended;           // a gzip member ended; another may follow
+    decompressor_t contexts;
+};
+
+decompress_reader_t * new_decompress_reader(int fd, compression_t compression) {
+// starts decoding the file open on fd
+    decompress_reader_t *r;
+
+    if ((COMPRESSION_NONE != compression) && (COMPRESSION_GZIP != compression)
+#ifdef HAVE_ZSTD
+            && (COMPRESSION_ZSTD != compression)
+#endif
+#ifdef HAVE_LZ4
+            && (COMPRESSION_LZ4 != compression)
+#endif
+            ) {
+        fprintf(stderr, "%s support was not compiled in\n", compression_name(compression));
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(decompress_reader_t));
+    if (!r) {
+        return NULL;
+    }
+    r->input = malloc(READER_INPUT);
+    if (!r->input) {
+        free(r);
+        return NULL;
+    }
+    r->fd = fd;
+    r->compression = compression;
+
+    if (COMPRESSION_GZIP == compression) {
+        if (Z_OK != inflateInit2(&r->z, 16 + MAX_WBITS)) {
+            free(r->input);
+            free(r);
+            return NULL;
+        }
+    }
+#ifdef HAVE_ZSTD
+    if (COMPRESSION_ZSTD == compression) {
+        r->contexts.zstd = ZSTD_createDCtx();
+        if (!r->contexts.zstd) {
+            destroy_decompress_reader(r);
+            return NULL;
+        }
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (COMPRESSION_LZ4 == compression) {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&r->contexts.lz4, LZ4F_VERSION))) {
+            r->contexts.lz4 = NULL;
+            destroy_decompress_reader(r);
+            return NULL;
+        }
+    }
+#endif
+    return r;
+}
+
+static int fill_input(decompress_reader_t *r) {
+// reads the next piece of the file, once the last has been decoded
+    ssize_t rw;
+
+    do {
+        rw = pread(r->fd, r->input, READER_INPUT, r->offset);
+    } while ((rw < 0) && (EINTR == errno));
+    if (rw < 0) {
+        perror("decompress");
+        return -1;
+    }
+    r->start = 0;
+    r->end = rw;
+    r->offset += rw;
+    r->at_end = (0 == rw);
+    return 0;
+}
+
+static long decode_some(decompress_reader_t *r, unsigned char *out, size_t length) {
+// decodes what it can of the input read into out, returning the bytes
+// decoded or <0 on error
+    size_t n;
+    int status;
+
+    switch (r->compression) {
+        case COMPRESSION_NONE:
+            n = r->end - r->start;
+            if (n > length) {
+                n = length;
+            }
+            memcpy(out, r->input + r->start, n);
+            r->start += n;
+            return n;
+        case COMPRESSION_GZIP:
+            if (r->member_ended) {
+                // as inflate_buffer, only another gzip member is read on
+                if ((r->start == r->end) || (0x1f != r->input[r->start])) {
+                    r->finished = (r->start < r->end) || r->at_end;
+                    return 0;
+                }
+                inflateReset(&r->z);
+                r->member_ended = 0;
+            }
+            r->z.next_in = r->input + r->start;
+            r->z.avail_in = r->end - r->start;
+            r->z.next_out = out;
+            r->z.avail_out = length;
+            status = inflate(&r->z, Z_NO_FLUSH);
+            r->start = r->end - r->z.avail_in;
+            if (Z_STREAM_END == status) {
+                r->member_ended = 1;
+            } else if ((Z_OK != status) && (Z_BUF_ERROR != status)) {
+                return -1;
+            }
+            return length - r->z.avail_out;
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD: {
+            ZSTD_inBuffer input = { r->input, r->end, r->start };
+            ZSTD_outBuffer output = { out, length, 0 };
+            size_t result;
+
+            result = ZSTD_decompressStream(r->contexts.zstd, &output, &input);
+            if (ZSTD_isError(result)) {
+                fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(result));
+                return -1;
+            }
+            r->start = input.pos;
+            return output.pos;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case COMPRESSION_LZ4: {
+            size_t dst_size = length, src_size = r->end - r->start, result;
+
+            result = LZ4F_decompress(r->contexts.lz4, out, &dst_size, r->input + r->start,
+                    &src_size, NULL);
+            if (LZ4F_isError(result)) {
+                fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(result));
+                return -1;
+            }
+            if (0 == result) {
+                // end of frame; another may follow
+                LZ4F_resetDecompressionContext(r->contexts.lz4);
+            }
+            r->start += src_size;
+            return dst_size;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+long decompress_read(decompress_reader_t *r, unsigned char *out, size_t length) {
+// decodes the next length bytes
+    size_t produced = 0, consumed;
+    long n;
+
+    while ((produced < length) && !r->finished) {
+        if ((r->start == r->end) && !r->at_end && (0 != fill_input(r))) {
+            return -1;
+        }
+        consumed = r->start;
+        n = decode_some(r, out + produced, length - produced);
+        if (n < 0) {
+            return -1;
+        }
+        produced += n;
+        if ((0 == n) && (consumed == r->start)) {
+            if (r->start < r->end) {
+                // input the decoder won't take
+                if (!r->finished) {
+                    return -1;
+                }
+            } else if (r->at_end) {
+                // everything read has been decoded, and held output flushed
+                r->finished = 1;
+            }
+        }
+    }
+    return produced;
+}
+
+int decompress_rewind(decompress_reader_t *r) {
+// starts again from the beginning of the file
+    r->offset = 0;
+    r->start = r->end = 0;
+    r->at_end = r->finished = r->member_ended = 0;
+    if (COMPRESSION_GZIP == r->compression) {
+        return (Z_OK == inflateReset(&r->z)) ? 0 : -1;
+    }
+#ifdef HAVE_ZSTD
+    if (COMPRESSION_ZSTD == r->compression) {
+        ZSTD_DCtx_reset(r->contexts.zstd, ZSTD_reset_session_only);
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (COMPRESSION_LZ4 == r->compression) {
+        LZ4F_resetDecompressionContext(r->contexts.lz4);
+    }
+#endif
+    return 0;
+}
+
+void destroy_decompress_reader(decompress_reader_t *r) {
+// frees a reader and its contexts
+    if (!r) {
+        return;
+    }
+    if (COMPRESSION_GZIP == r->compression) {
+        inflateEnd(&r->z);
+    }
+    free_contexts(&r->contexts);
+    free(r->input);
+    free(r);
+}
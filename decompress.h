@@ -0,0 +1,102 @@
+/*
+ * decompress.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Decompression backends, selected by the magic bytes at the start of a
+ * file, decoding a whole buffer at once or a file as it is read.  gzip is
+ * always available through zlib; zstd and LZ4 are compiled in when the
+ * Makefile is run with HAVE_ZSTD=1 and/or HAVE_LZ4=1.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stddef.h>
+
+typedef enum compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+    COMPRESSION_LZ4
+} compression_t;
+
+// number of bytes needed to recognise any of the formats above
+#define COMPRESSION_MAGIC_LENGTH (4)
+
+compression_t detect_compression(const unsigned char *magic, size_t length);
+// identifies the compression of a file from its first bytes.  Anything not
+// recognised is treated as uncompressed.
+
+const char * compression_name(compression_t compression);
+// printable name of a compression format
+
+typedef struct decompressor decompressor_t;
+// the zstd and LZ4 decoding contexts, kept between calls so their tables
+// are allocated once.  A decompressor is used by one thread at a time.
+
+decompressor_t * new_decompressor(void);
+// creates a decompressor, its contexts being allocated when first needed.
+// Returns NULL if out of memory.
+
+void destroy_decompressor(decompressor_t *d);
+// frees a decompressor.  NULL is ignored.
+
+long decompress_buffer(decompressor_t *d, compression_t compression, const unsigned char *in,
+        size_t in_length, unsigned char **out, size_t *out_size, int grow);
+// decompresses the whole of an in-memory file in one call.
+//
+// d:           contexts to decode with, or NULL for ones made for this call
+// compression: format of the input, from detect_compression
+// in:          compressed data
+// in_length:   length of the compressed data
+// out:         buffer to decompress into
+// out_size:    size of the buffer at *out
+// grow:        if 0, *out is fixed and decoding stops once it is full.
+//              Otherwise *out was allocated with malloc and is grown with
+//              realloc as needed, *out and *out_size being updated.
+//
+// returns:
+//  >=0:    number of bytes decompressed
+//  <0:     error (corrupt input, or format not compiled in)
+
+typedef int (*decompress_sink_t)(void *arg, const unsigned char *data, size_t length);
+// receives decompressed data in order, a piece at a time.  Returns non-zero
+// when it needs no more.
+
+long decompress_stream(decompressor_t *d, compression_t compression, const unsigned char *in,
+        size_t in_length, decompress_sink_t sink, void *arg);
+// decompresses an in-memory file a piece at a time, with d as for
+// decompress_buffer, handing each piece to sink and stopping as soon as sink
+// has had what it needs, so callers wanting only the start of a file, or part
+// of it, don't hold the rest.
+// gzip is decoded in pieces; the other formats are decoded whole and passed
+// on in one piece.
+//
+// returns:
+//  >=0:    number of bytes decompressed
+//  <0:     error
+
+typedef struct decompress_reader decompress_reader_t;
+// decodes a file as it is read, a piece at a time, so that a file far
+// larger than memory can be walked through
+
+decompress_reader_t * new_decompress_reader(int fd, compression_t compression);
+// reads and decodes the file open on fd from its start, with pread, so fd's
+// offset is left alone.  fd stays the caller's, and must stay open until the
+// reader is destroyed.  Returns NULL if out of memory, or if the format
+// wasn't compiled in.
+
+long decompress_read(decompress_reader_t *r, unsigned char *out, size_t length);
+// decodes the next length bytes of the file into out
+//
+// returns:
+//  >=0:    bytes decoded, fewer than length only at the end of the file
+//  <0:     error (corrupt input)
+
+int decompress_rewind(decompress_reader_t *r);
+// goes back to the start of the file.  Returns 0 on success.
+
+void destroy_decompress_reader(decompress_reader_t *r);
+// frees a reader, leaving its file open.  NULL is ignored.
+
+#endif // DECOMPRESS_H
@@ -0,0 +1,147 @@
+/*
+ * fft.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "fft.h"
+
+int fft_length(long n) {
+// returns the smallest power of two at least n, or -1 if that is too long
+    long length = 1;
+
+    while (length < n) {
+        if (length > INT_MAX/2)
+            return -1;
+        length *= 2;
+    }
+    return (int) length;
+}
+
+fft_plan_t * fft_plan_create(int n) {
+// creates a plan for transforms of length n, which must be a power of two
+    fft_plan_t *plan;
+    int i, bits, log2n = 0;
+
+    if ((n < 1) || (n & (n - 1))) {
+        return NULL;
+    }
+    while ((1 << log2n) < n)
+        ++log2n;
+
+    plan = calloc(1, sizeof(fft_plan_t));
+    if (!plan) {
+        return NULL;
+    }
+    plan->n = n;
+    plan->reverse = malloc(n*sizeof(int));
+    plan->cos = malloc((n/2 + 1)*sizeof(double));
+    plan->sin = malloc((n/2 + 1)*sizeof(double));
+    if (!plan->reverse || !plan->cos || !plan->sin) {
+        fft_plan_destroy(plan);
+        return NULL;
+    }
+
+    for (i = 0; i < n; ++i) {
+        plan->reverse[i] = 0;
+        for (bits = 0; bits < log2n; ++bits) {
+            if (i & (1 << bits))
+                plan->reverse[i] |= 1 << (log2n - 1 - bits);
+        }
+    }
+    for (i = 0; i < n/2; ++i) {
+        plan->cos[i] = cos(2.0*M_PI*i/n);
+        plan->sin[i] = sin(2.0*M_PI*i/n);
+    }
+
+    return plan;
+}
+
+void fft_transform(const fft_plan_t *plan, double *re, double *im, int inverse) {
+// transforms re + i im in place, iteratively (Cooley-Tukey, decimation in time)
+    const int n = plan->n;
+    int i, j, k, half, step;
+    double t, wr, wi, tr, ti, sign = inverse ? 1.0 : -1.0;
+
+    for (i = 0; i < n; ++i) {
+        j = plan->reverse[i];
+        if (j > i) {
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (half = 1; half < n; half *= 2) {
+        step = n/(2*half);
+        for (i = 0; i < n; i += 2*half) {
+            for (k = 0; k < half; ++k) {
+                wr = plan->cos[k*step];
+                wi = sign*plan->sin[k*step];
+                j = i + k + half;
+                tr = wr*re[j] - wi*im[j];
+                ti = wr*im[j] + wi*re[j];
+                re[j] = re[i + k] - tr;
+                im[j] = im[i + k] - ti;
+                re[i + k] += tr;
+                im[i + k] += ti;
+            }
+        }
+    }
+
+    if (inverse) {
+        for (i = 0; i < n; ++i) {
+            re[i] /= n;
+            im[i] /= n;
+        }
+    }
+}
+
+void hilbert_phase(const fft_plan_t *plan, const float *signal, long n, float *phase,
+        double *re, double *im) {
+// the analytic signal keeps the positive frequencies, doubled, and drops the
+// negative ones; its argument is the phase
+    const int length = plan->n;
+    double mean = 0.0;
+    long t;
+    int k;
+
+    for (t = 0; t < n; ++t)
+        mean += signal[t];
+    mean /= (n > 0) ? n : 1;
+
+    for (t = 0; t < n; ++t) {
+        re[t] = signal[t] - mean;
+        im[t] = 0.0;
+    }
+    for (k = n; k < length; ++k) {
+        re[k] = im[k] = 0.0;
+    }
+
+    fft_transform(plan, re, im, 0);
+    for (k = 1; k < length/2; ++k) {
+        re[k] *= 2.0;
+        im[k] *= 2.0;
+    }
+    for (k = length/2 + 1; k < length; ++k) {
+        re[k] = im[k] = 0.0;
+    }
+    fft_transform(plan, re, im, 1);
+
+    for (t = 0; t < n; ++t) {
+        phase[t] = atan2(im[t], re[t]);
+    }
+}
+
+void fft_plan_destroy(fft_plan_t *plan) {
+// frees the plan
+    if (!plan) {
+        return;
+    }
+    free(plan->reverse);
+    free(plan->cos);
+    free(plan->sin);
+    free(plan);
+}
@@ -0,0 +1,44 @@
+/*
+ * fft.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * A small in-place radix-2 complex FFT, enough for the per-pixel Hilbert
+ * transforms of the phase engine without depending on an FFT library.  A
+ * plan holds the bit reversal and twiddle tables for one length, and is
+ * only read by fft_transform, so one plan can be shared between threads
+ * transforming different signals.
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+typedef struct fft_plan {
+    int n;                      // length, a power of two
+    int *reverse;               // bit reversed index of each element
+    double *cos;                // cos(2 pi k/n), k < n/2
+    double *sin;                // sin(2 pi k/n), k < n/2
+} fft_plan_t;
+
+int fft_length(long n);
+// returns the smallest power of two at least n, or -1 if that is too long
+
+fft_plan_t * fft_plan_create(int n);
+// creates a plan for transforms of length n, which must be a power of two
+//
+// returns:
+//  the plan, or NULL on failure
+
+void fft_transform(const fft_plan_t *plan, double *re, double *im, int inverse);
+// transforms the signal re[n] + i im[n] in place: forward with exp(-2 pi i
+// jk/n), or inverse with exp(+2 pi i jk/n) and scaled by 1/n
+
+void hilbert_phase(const fft_plan_t *plan, const float *signal, long n, float *phase,
+        double *re, double *im);
+// the phase, atan2 of the analytic signal, of signal[n] (n at most the plan's
+// length, the rest zero padded), after removing its mean.  re and im are
+// work space of the plan's length.  phase may be signal.
+
+void fft_plan_destroy(fft_plan_t *plan);
+// frees the plan
+
+#endif // FFT_H
@@ -0,0 +1,74 @@
+/*
+ * find_phase_singularities.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+
+#include <math.h>
+#include "tip_trace.h"
+
+static float wrap(float d) {
+// a phase difference, wrapped into [-pi, pi)
+    if (d >= M_PI)
+        return d - 2.0*M_PI;
+    if (d < -M_PI)
+        return d + 2.0*M_PI;
+    return d;
+}
+
+static int charge(float ** phase, int i, int j) {
+// the topological charge of cell (j, i): the phase differences summed around
+// its corners, anticlockwise, in turns
+    float winding = wrap(phase[j][i+1] - phase[j][i])
+        + wrap(phase[j+1][i+1] - phase[j][i+1])
+        + wrap(phase[j+1][i] - phase[j+1][i+1])
+        + wrap(phase[j][i] - phase[j+1][i]);
+
+    if (winding > M_PI)
+        return 1;
+    if (winding < -M_PI)
+        return -1;
+    return 0;
+}
+
+static int row_singularities(float ** phase, int j, int first, int end, int tip_count,
+        int ntips, point_t * tips, int * charges) {
+// adds the singularities in cells first to end - 1 of row j to those found
+// so far, tip_count, returning the new count
+    int i, q;
+
+    for (i = first; i < end; ++i) {
+        q = charge(phase, i, j);
+        if (!q)
+            continue;
+        tip_count++;
+        if (tip_count <= ntips) {
+            tips[tip_count-1].x = i + 0.5;
+            tips[tip_count-1].y = j + 0.5;
+            if (charges)
+                charges[tip_count-1] = q;
+        }
+    }
+    return tip_count;
+}
+
+int find_phase_singularities(int x, int y, float ** phase, const tip_mask_t * mask,
+        int ntips, point_t * tips, int * charges) {
+// looks for phase singularities in the same cells as find_tips_masked
+    int j, r, first, end;
+    int tip_count = 0;
+
+    for (j = 1; j < y-1; ++j) {
+        if (!mask) {
+            tip_count = row_singularities(phase, j, 1, x-1, tip_count, ntips, tips, charges);
+            continue;
+        }
+        for (r = mask->row_runs[j]; r < mask->row_runs[j+1]; ++r) {
+            first = (mask->runs[r].first < 1) ? 1 : mask->runs[r].first;
+            end = (mask->runs[r].end > x-1) ? x-1 : mask->runs[r].end;
+            tip_count = row_singularities(phase, j, first, end, tip_count, ntips, tips, charges);
+        }
+    }
+
+    return (tip_count > ntips) ? -tip_count : tip_count;
+}
@@ -5,6 +5,7 @@
  */
 
 #include "tip_trace.h"
+#include "fixed_kernels.h"
 
 int find_tips(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
         float isoline_2, int ntips, point_t * tips) {
@@ -30,10 +31,18 @@ int find_tips(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
 //  >0:             Number of tips found.
     int i, j;
     int nintercepts_1, nintercepts_2;
-    point_t line_1[2], line_2[2], tip;
+    // room for a saddle's four intercepts
+    point_t line_1[4], line_2[4], tip;
     int istip, tip_count;
+    fixed_find_tips_t fixed;
     tip_count = 0;
 
+    // one of the common grid sizes has its own, faster, version
+    fixed = fixed_find_tips(x, y, sheet_1, sheet_2);
+    if (fixed) {
+        return fixed(sheet_1, isoline_1, sheet_2, isoline_2, ntips, tips);
+    }
+
     // loop over the whole sheet, looking for crossing isolines
     for (j = 1; j < y-1; ++j) {
         for (i = 1; i < x-1; ++i) {
@@ -71,3 +80,36 @@ int find_tips(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
         return tip_count;
     }
 }
+
+int find_tips_masked(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
+        float isoline_2, const tip_mask_t * mask, int ntips, point_t * tips) {
+// as find_tips, but only looking in the cells valid in mask
+    int i, j, r, first, end;
+    point_t line_1[4], line_2[4], tip;
+    int tip_count = 0;
+
+    if (!mask) {
+        return find_tips(x, y, sheet_1, isoline_1, sheet_2, isoline_2, ntips, tips);
+    }
+
+    // the same cells as find_tips, in the same order, less those masked out
+    for (j = 1; j < y-1; ++j) {
+        for (r = mask->row_runs[j]; r < mask->row_runs[j+1]; ++r) {
+            first = (mask->runs[r].first < 1) ? 1 : mask->runs[r].first;
+            end = (mask->runs[r].end > x-1) ? x-1 : mask->runs[r].end;
+            for (i = first; i < end; ++i) {
+                if ((2 == find_isoline(isoline_1, sheet_1, i, j, line_1))
+                        && (2 == find_isoline(isoline_2, sheet_2, i, j, line_2))
+                        && calculate_tip_coordinates(line_1, line_2, &tip)) {
+                    tip_count++;
+                    if (tip_count <= ntips) {
+                        tips[tip_count-1].x = tip.x + i;
+                        tips[tip_count-1].y = tip.y + j;
+                    }
+                }
+            }
+        }
+    }
+
+    return (tip_count > ntips) ? -tip_count : tip_count;
+}
@@ -0,0 +1,192 @@
+/*
+ * fixed_kernels.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Built with optimisation (see the Makefile) even in debug builds, as the
+ * specialisations are only worth having once the constants are folded.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fixed_kernels.h"
+#include "sheet_alloc.h"
+#include "tip_trace.h"
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE int isoline_strided(float isoline, const float *E, const size_t stride,
+        point_t *intercepts) {
+// find_isoline, with E pointing at corner (j, i) of the cell.  The
+// arithmetic is kept exactly as find_isoline's.
+    static const int cdx[] = { 0, 1, 1, 0, 0 };
+    static const int cdy[] = { 0, 0, 1, 1, 0 };
+    int intercept_count = 0, n;
+    float prev, next, intercept;
+
+    for (n = 0; n < 4; ++n) {
+        prev = E[cdy[n]*stride + cdx[n]] - isoline;
+        next = E[cdy[n+1]*stride + cdx[n+1]] - isoline;
+
+        if (fabs(next) < 10e-6)
+            continue;
+        if ((next*prev) > 0.0)
+            continue;
+
+        intercept = ((next * cdx[n]) - (prev * cdx[n+1]))/(next - prev);
+        if ((intercept < 0.0)||(intercept > 1.0)) {
+            return -1;
+        }
+        intercepts[intercept_count].x = intercept;
+
+        intercept = ((next * cdy[n]) - (prev * cdy[n+1]))/(next - prev);
+        if ((intercept < 0.0)||(intercept > 1.0)) {
+            return -1;
+        }
+        intercepts[intercept_count].y = intercept;
+
+        ++intercept_count;
+    }
+
+    return intercept_count;
+}
+
+ALWAYS_INLINE int find_tips_strided(const int x, const int y, const size_t stride,
+        const float *sheet_1, float isoline_1, const float *sheet_2, float isoline_2,
+        int ntips, point_t *tips) {
+// find_tips, on sheets stored as single blocks with rows stride apart
+    point_t line_1[4], line_2[4], tip;
+    int i, j, tip_count = 0;
+    size_t offset;
+
+    for (j = 1; j < y-1; ++j) {
+#pragma GCC unroll 4
+        for (i = 1; i < x-1; ++i) {
+            offset = j*stride + i;
+            if ((2 == isoline_strided(isoline_1, sheet_1 + offset, stride, line_1))
+                    && (2 == isoline_strided(isoline_2, sheet_2 + offset, stride, line_2))
+                    && calculate_tip_coordinates(line_1, line_2, &tip)) {
+                tip_count++;
+                if (tip_count <= ntips) {
+                    tips[tip_count-1].x = tip.x + i;
+                    tips[tip_count-1].y = tip.y + j;
+                }
+            }
+        }
+    }
+
+    return (tip_count > ntips) ? -tip_count : tip_count;
+}
+
+// rows of a padded sheet, in floats
+#define PADDED_STRIDE(X) (SHEET_PADDED_ROW_BYTES(X, sizeof(float))/sizeof(float))
+
+#define FIXED_KERNELS(X, Y) \
+    static int find_tips_##X##x##Y(float **sheet_1, float isoline_1, float **sheet_2, \
+            float isoline_2, int ntips, point_t *tips) { \
+        return find_tips_strided(X, Y, X, sheet_1[0], isoline_1, sheet_2[0], isoline_2, \
+                ntips, tips); \
+    } \
+    static int find_isoline_##X##x##Y(float isoline, const float *corner, point_t *intercepts) { \
+        return isoline_strided(isoline, corner, X, intercepts); \
+    } \
+    static int find_isoline_padded_##X##x##Y(float isoline, const float *corner, \
+            point_t *intercepts) { \
+        return isoline_strided(isoline, corner, PADDED_STRIDE(X), intercepts); \
+    }
+
+TIP_TRACE_FIXED_SIZES(FIXED_KERNELS)
+
+typedef struct fixed_size {
+    int x;
+    int y;
+    fixed_find_tips_t find_tips;
+    fixed_find_isoline_t find_isoline;
+    size_t padded_stride;
+    fixed_find_isoline_t find_isoline_padded;
+} fixed_size_t;
+
+#define FIXED_ENTRY(X, Y) \
+    { X, Y, find_tips_##X##x##Y, find_isoline_##X##x##Y, PADDED_STRIDE(X), \
+        find_isoline_padded_##X##x##Y },
+
+static const fixed_size_t fixed_sizes[] = {
+    TIP_TRACE_FIXED_SIZES(FIXED_ENTRY)
+};
+
+#define NFIXED_SIZES (sizeof(fixed_sizes)/sizeof(fixed_sizes[0]))
+
+static int enabled = 1;
+static pthread_once_t enabled_once = PTHREAD_ONCE_INIT;
+
+static void read_enabled(void) {
+// the specialisations are on unless TIP_TRACE_FIXED=0 asks for the generic
+// code, e.g. to check the two agree
+    const char *fixed = getenv("TIP_TRACE_FIXED");
+
+    enabled = !fixed || (0 != strcmp(fixed, "0"));
+}
+
+int fixed_kernels_enabled(void) {
+// whether the specialisations are used
+    pthread_once(&enabled_once, read_enabled);
+    return enabled;
+}
+
+static const fixed_size_t * find_size(int x, int y) {
+// the specialisations for x by y sheets, or NULL
+    size_t n;
+
+    if (!fixed_kernels_enabled()) {
+        return NULL;
+    }
+
+    for (n = 0; n < NFIXED_SIZES; ++n) {
+        if ((fixed_sizes[n].x == x) && (fixed_sizes[n].y == y))
+            return &fixed_sizes[n];
+    }
+    return NULL;
+}
+
+int fixed_kernels_match(int x, int y) {
+// whether x by y sheets get the specialisations
+    return NULL != find_size(x, y);
+}
+
+static int is_block(float **sheet, int x, int y) {
+// whether every row follows the last, x floats on
+    int j;
+
+    for (j = 1; j < y; ++j) {
+        if (sheet[j] != sheet[0] + (size_t) j*x)
+            return 0;
+    }
+    return 1;
+}
+
+fixed_find_tips_t fixed_find_tips(int x, int y, float **sheet_1, float **sheet_2) {
+// returns the find_tips specialised for these sheets, or NULL
+    const fixed_size_t *size = find_size(x, y);
+
+    if (!size || !is_block(sheet_1, x, y) || !is_block(sheet_2, x, y)) {
+        return NULL;
+    }
+    return size->find_tips;
+}
+
+fixed_find_isoline_t fixed_find_isoline(int x, int y, size_t stride) {
+// returns the find_isoline specialised for this size and stride, or NULL
+    const fixed_size_t *size = find_size(x, y);
+
+    if (!size) {
+        return NULL;
+    }
+    if (stride == (size_t) x) {
+        return size->find_isoline;
+    }
+    if (stride == size->padded_stride) {
+        return size->find_isoline_padded;
+    }
+    return NULL;
+}
@@ -0,0 +1,50 @@
+/*
+ * fixed_kernels.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Versions of find_tips and find_isoline specialised for the grid sizes we
+ * run most, with the dimensions and row stride compiled in as constants, so
+ * the bounds fold away and each corner of a cell is a fixed offset from the
+ * last.  find_tips and tip_tracer_t pick them automatically when the sheet
+ * dimensions (and layout) match, and use the generic code otherwise.
+ *
+ * The sizes are listed once, in TIP_TRACE_FIXED_SIZES; adding FIXED(X, Y)
+ * there adds a specialisation.  The results are identical to the generic
+ * functions; to check, TIP_TRACE_FIXED=0 turns the specialisations off, and
+ * a run with it should match one without, tip for tip.
+ */
+
+#ifndef FIXED_KERNELS_H
+#define FIXED_KERNELS_H
+
+#include <stddef.h>
+#include "point_t.h"
+
+#define TIP_TRACE_FIXED_SIZES(FIXED) \
+    FIXED(375, 375)     /* core_trace's default */ \
+    FIXED(512, 512) \
+    FIXED(1024, 1024)
+
+typedef int (*fixed_find_tips_t)(float **sheet_1, float isoline_1, float **sheet_2,
+        float isoline_2, int ntips, point_t *tips);
+// as find_tips, for fixed x and y
+
+typedef int (*fixed_find_isoline_t)(float isoline, const float *corner, point_t *intercepts);
+// as find_isoline, for the cell whose (j, i) corner is at corner, in a sheet
+// with a fixed row stride
+
+int fixed_kernels_enabled(void);
+// whether the specialisations are used: always, unless TIP_TRACE_FIXED=0
+
+int fixed_kernels_match(int x, int y);
+// whether there are specialisations for x by y sheets, and they are used
+
+fixed_find_tips_t fixed_find_tips(int x, int y, float **sheet_1, float **sheet_2);
+// returns the find_tips specialised for x by y sheets, if there is one and
+// both sheets are laid out as a single block with rows x apart, else NULL
+
+fixed_find_isoline_t fixed_find_isoline(int x, int y, size_t stride);
+// returns the find_isoline specialised for x by y sheets with rows stride
+// floats apart (x, or padded as by sheet_alloc's SHEET_PAD), or NULL
+
+#endif // FIXED_KERNELS_H
@@ -0,0 +1,360 @@
+/*
+ * frame_archive.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "helper.h"
+#include "kernels.h"
+#include "sheet_alloc.h"
+#include "frame_archive.h"
+
+static size_t sample_size(file_type_t sample_type) {
+// returns the size in bytes of a single stored sample
+    return (BINARY_DOUBLE == sample_type) ? sizeof(double) : sizeof(float);
+}
+
+static int pread_all(int fd, void *buffer, size_t count, uint64_t offset) {
+// reads exactly count bytes at offset, retrying on short reads.
+    char *p = buffer;
+    ssize_t rw;
+
+    while (count > 0) {
+        rw = pread(fd, p, count, (off_t) offset);
+        if (rw < 0) {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == rw) {
+            return -1;
+        }
+        p += rw;
+        count -= rw;
+        offset += rw;
+    }
+    return 0;
+}
+
+static void pack_header(unsigned char *header, int nx, int ny, file_type_t sample_type,
+        int codec, double dt, uint64_t nframes, uint64_t index_offset) {
+// lays out the fixed size header
+    uint32_t u;
+
+    memset(header, 0, FRAME_ARCHIVE_HEADER_SIZE);
+    memcpy(header, FRAME_ARCHIVE_MAGIC, 4);
+    u = FRAME_ARCHIVE_VERSION;  memcpy(header + 4, &u, 4);
+    u = nx;                     memcpy(header + 8, &u, 4);
+    u = ny;                     memcpy(header + 12, &u, 4);
+    u = sample_type;            memcpy(header + 16, &u, 4);
+    u = codec;                  memcpy(header + 20, &u, 4);
+    memcpy(header + 24, &dt, 8);
+    memcpy(header + 32, &nframes, 8);
+    memcpy(header + 40, &index_offset, 8);
+}
+
+
+frame_archive_t * frame_archive_open(const char *filename) {
+// opens an archive, reading the header and frame index.
+    frame_archive_t *a;
+    unsigned char header[FRAME_ARCHIVE_HEADER_SIZE];
+    uint32_t version, nx, ny, sample_type, codec;
+    uint64_t nframes, index_offset, *index;
+    struct stat st;
+    long n;
+    int fd;
+
+    // parenthesised to avoid helper.h's open() macro
+    fd = (open)(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return NULL;
+    }
+
+    if (0 != pread_all(fd, header, FRAME_ARCHIVE_HEADER_SIZE, 0)
+            || 0 != memcmp(header, FRAME_ARCHIVE_MAGIC, 4)) {
+        fprintf(stderr, "%s: not a frame archive\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    memcpy(&version, header + 4, 4);
+    memcpy(&nx, header + 8, 4);
+    memcpy(&ny, header + 12, 4);
+    memcpy(&sample_type, header + 16, 4);
+    memcpy(&codec, header + 20, 4);
+    memcpy(&nframes, header + 32, 8);
+    memcpy(&index_offset, header + 40, 8);
+
+    if (FRAME_ARCHIVE_VERSION != version) {
+        fprintf(stderr, "%s: unsupported archive version %u\n", filename, version);
+        close(fd);
+        return NULL;
+    }
+    if ((BINARY_FLOAT != sample_type && BINARY_DOUBLE != sample_type)
+            || (FRAME_ARCHIVE_RAW != codec && FRAME_ARCHIVE_ZLIB != codec)) {
+        fprintf(stderr, "%s: unsupported sample type or codec\n", filename);
+        close(fd);
+        return NULL;
+    }
+    if (0 == index_offset) {
+        fprintf(stderr, "%s: archive was not finished (no index)\n", filename);
+        close(fd);
+        return NULL;
+    }
+    // the index must lie within the file, checked before it is allocated,
+    // and without overflowing, so a corrupt header can't ask for more
+    if ((0 != fstat(fd, &st)) || (index_offset > (uint64_t) st.st_size)
+            || (nframes > ((uint64_t) st.st_size - index_offset)/(2*sizeof(uint64_t)))) {
+        fprintf(stderr, "%s: corrupt header (index beyond the end of the file)\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    MALLOC(a, sizeof(frame_archive_t), "frame archive alloc failure");
+    a->fd = fd;
+    a->nx = nx;
+    a->ny = ny;
+    a->sample_type = sample_type;
+    a->codec = codec;
+    memcpy(&a->dt, header + 24, 8);
+    a->nframes = nframes;
+
+    MALLOC(index, 2*nframes*sizeof(uint64_t) + 1, "frame index alloc failure");
+    MALLOC(a->offsets, nframes*sizeof(uint64_t) + 1, "frame index alloc failure");
+    MALLOC(a->lengths, nframes*sizeof(uint64_t) + 1, "frame index alloc failure");
+
+    if (0 != pread_all(fd, index, 2*nframes*sizeof(uint64_t), index_offset)) {
+        fprintf(stderr, "%s: truncated frame index\n", filename);
+        free(index);
+        frame_archive_close(a);
+        return NULL;
+    }
+    for (n = 0; n < a->nframes; ++n) {
+        a->offsets[n] = index[2*n];
+        a->lengths[n] = index[2*n + 1];
+        // and every frame before the index
+        if ((a->offsets[n] > index_offset) || (a->lengths[n] > index_offset - a->offsets[n])) {
+            fprintf(stderr, "%s: corrupt frame index (frame %ld)\n", filename, n);
+            free(index);
+            frame_archive_close(a);
+            return NULL;
+        }
+    }
+    free(index);
+
+    return a;
+}
+
+void frame_archive_close(frame_archive_t *a) {
+// closes an archive, freeing all memory
+    if (NULL != a) {
+        close(a->fd);
+        free(a->offsets);
+        free(a->lengths);
+        free(a);
+    }
+}
+
+int frame_archive_read(frame_archive_t *a, long frame, int x, int y, float **sheet) {
+// decodes a single frame into sheet, converting doubles to floats as needed.
+    unsigned char *stored;
+    void *samples = NULL;
+    void *target;
+    uLongf expected, decoded;
+    int j;
+
+    if ((frame < 0) || (frame >= a->nframes)) {
+        fprintf(stderr, "Frame %ld out of range (%ld frames)\n", frame, a->nframes);
+        return -1;
+    }
+    if ((x != a->nx) || (y != a->ny)) {
+        fprintf(stderr, "Sheet is %dx%d but archive holds %dx%d frames\n",
+                x, y, a->nx, a->ny);
+        return -1;
+    }
+
+    expected = (uLongf) x * y * sample_size(a->sample_type);
+
+    // floats can be decoded straight into a contiguous sheet; doubles, and
+    // sheets with padded rows, need staging
+    if ((BINARY_DOUBLE == a->sample_type) || !sheet_is_contiguous(sheet, y, x, sizeof(float))) {
+        samples = malloc(expected);
+        if (!samples) {
+            return -1;
+        }
+        target = samples;
+    } else {
+        target = sheet[0];
+    }
+
+    if (FRAME_ARCHIVE_RAW == a->codec) {
+        if ((a->lengths[frame] != expected)
+                || (0 != pread_all(a->fd, target, expected, a->offsets[frame]))) {
+            fprintf(stderr, "Problem reading frame %ld\n", frame);
+            free(samples);
+            return -1;
+        }
+    } else {
+        stored = malloc(a->lengths[frame] + 1);
+        if (!stored) {
+            free(samples);
+            return -1;
+        }
+        if (0 != pread_all(a->fd, stored, a->lengths[frame], a->offsets[frame])) {
+            fprintf(stderr, "Problem reading frame %ld\n", frame);
+            free(stored);
+            free(samples);
+            return -1;
+        }
+        decoded = expected;
+        if ((Z_OK != uncompress(target, &decoded, stored, a->lengths[frame]))
+                || (decoded != expected)) {
+            fprintf(stderr, "Problem decompressing frame %ld\n", frame);
+            free(stored);
+            free(samples);
+            return -1;
+        }
+        free(stored);
+    }
+
+    if (samples) {
+        for (j = 0; j < y; ++j) {
+            if (BINARY_DOUBLE == a->sample_type) {
+                tip_kernels()->convert_row((double *) samples + (size_t) j*x, sheet[j], x);
+            } else {
+                memcpy(sheet[j], (float *) samples + (size_t) j*x, x*sizeof(float));
+            }
+        }
+        free(samples);
+    }
+
+    return 0;
+}
+
+
+frame_archive_writer_t * frame_archive_create(const char *filename, int nx, int ny,
+        file_type_t sample_type, double dt, int level) {
+// creates a new archive for writing.
+    frame_archive_writer_t *w;
+    unsigned char header[FRAME_ARCHIVE_HEADER_SIZE];
+
+    if (BINARY_FLOAT != sample_type && BINARY_DOUBLE != sample_type) {
+        fprintf(stderr, "Archives hold float or double samples only\n");
+        return NULL;
+    }
+
+    MALLOC(w, sizeof(frame_archive_writer_t), "frame archive alloc failure");
+    w->file = fopen(filename, "wb");
+    if (!w->file) {
+        perror(filename);
+        free(w);
+        return NULL;
+    }
+    w->nx = nx;
+    w->ny = ny;
+    w->sample_type = sample_type;
+    w->level = level;
+    w->dt = dt;
+    w->nframes = 0;
+    w->mframes = 64;
+    MALLOC(w->offsets, w->mframes*sizeof(uint64_t), "frame index alloc failure");
+    MALLOC(w->lengths, w->mframes*sizeof(uint64_t), "frame index alloc failure");
+    w->buffer_size = compressBound((uLong) nx * ny * sample_size(sample_type));
+    MALLOC(w->buffer, w->buffer_size, "compression buffer alloc failure");
+
+    // placeholder header, rewritten once the index is known
+    pack_header(header, nx, ny, sample_type,
+            level > 0 ? FRAME_ARCHIVE_ZLIB : FRAME_ARCHIVE_RAW, dt, 0, 0);
+    if (1 != fwrite(header, FRAME_ARCHIVE_HEADER_SIZE, 1, w->file)) {
+        perror(filename);
+        fclose(w->file);
+        free(w->offsets);
+        free(w->lengths);
+        free(w->buffer);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+int frame_archive_append(frame_archive_writer_t *w, const void *samples) {
+// compresses and appends a frame of nx*ny samples of the archive sample type
+    uLong size = (uLong) w->nx * w->ny * sample_size(w->sample_type);
+    uLongf stored = w->buffer_size;
+    const void *data = samples;
+    long offset;
+
+    if (w->level > 0) {
+        if (Z_OK != compress2(w->buffer, &stored, samples, size, w->level)) {
+            fprintf(stderr, "Problem compressing frame %ld\n", w->nframes);
+            return -1;
+        }
+        data = w->buffer;
+    } else {
+        stored = size;
+    }
+
+    offset = ftell(w->file);
+    if ((offset < 0) || (1 != fwrite(data, stored, 1, w->file))) {
+        perror("frame archive");
+        return -1;
+    }
+
+    if (w->nframes >= w->mframes) {
+        w->mframes *= 2;
+        w->offsets = realloc(w->offsets, w->mframes*sizeof(uint64_t));
+        w->lengths = realloc(w->lengths, w->mframes*sizeof(uint64_t));
+        if (!w->offsets || !w->lengths) {
+            oops("frame index alloc failure");
+        }
+    }
+    w->offsets[w->nframes] = offset;
+    w->lengths[w->nframes] = stored;
+    w->nframes++;
+
+    return 0;
+}
+
+int frame_archive_finish(frame_archive_writer_t *w) {
+// writes the index and final header, then closes the file and frees the writer
+    unsigned char header[FRAME_ARCHIVE_HEADER_SIZE];
+    long index_offset, n;
+    int status = 0;
+
+    index_offset = ftell(w->file);
+    for (n = 0; n < w->nframes && 0 == status; ++n) {
+        if ((1 != fwrite(&w->offsets[n], sizeof(uint64_t), 1, w->file))
+                || (1 != fwrite(&w->lengths[n], sizeof(uint64_t), 1, w->file))) {
+            status = -1;
+        }
+    }
+
+    pack_header(header, w->nx, w->ny, w->sample_type,
+            w->level > 0 ? FRAME_ARCHIVE_ZLIB : FRAME_ARCHIVE_RAW,
+            w->dt, w->nframes, index_offset);
+    if ((0 != status) || (index_offset < 0) || (0 != fseek(w->file, 0, SEEK_SET))
+            || (1 != fwrite(header, FRAME_ARCHIVE_HEADER_SIZE, 1, w->file))) {
+        perror("frame archive");
+        status = -1;
+    }
+
+    if (0 != fclose(w->file)) {
+        perror("frame archive");
+        status = -1;
+    }
+    free(w->offsets);
+    free(w->lengths);
+    free(w->buffer);
+    free(w);
+
+    return status;
+}
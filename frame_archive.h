@@ -0,0 +1,111 @@
+/*
+ * frame_archive.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * A seekable, indexed container holding many frames of a run in one file.
+ *
+ * The layout is:
+ *
+ *   header     64 bytes: magic, version, nx, ny, sample type, codec, dt,
+ *              number of frames and the offset of the index.
+ *   frames     each frame compressed independently (zlib), back to back.
+ *   index      nframes pairs of (offset, compressed length), 64 bit each.
+ *
+ * As every frame is its own compressed chunk and the index gives its exact
+ * location, any frame can be decoded without touching the others.  Reads use
+ * pread(), so several threads may decode frames from the same open archive
+ * concurrently.  All fields are stored in host byte order.
+ */
+
+#ifndef FRAME_ARCHIVE_H
+#define FRAME_ARCHIVE_H
+
+#include <stdint.h>
+#include "tip_trace_binary.h"
+
+#define FRAME_ARCHIVE_MAGIC "TTFA"
+#define FRAME_ARCHIVE_VERSION (1)
+#define FRAME_ARCHIVE_HEADER_SIZE (64)
+
+// frame codecs
+#define FRAME_ARCHIVE_RAW  (0)
+#define FRAME_ARCHIVE_ZLIB (1)
+
+typedef struct frame_archive {
+    int fd;
+    int nx;
+    int ny;
+    file_type_t sample_type;    // BINARY_FLOAT or BINARY_DOUBLE
+    int codec;
+    double dt;
+    long nframes;
+    uint64_t *offsets;          // file offset of each frame
+    uint64_t *lengths;          // stored length of each frame
+} frame_archive_t;
+
+typedef struct frame_archive_writer {
+    FILE *file;
+    int nx;
+    int ny;
+    file_type_t sample_type;
+    int level;
+    double dt;
+    long nframes;
+    long mframes;
+    uint64_t *offsets;
+    uint64_t *lengths;
+    unsigned char *buffer;      // compression buffer, reused for each frame
+    unsigned long buffer_size;
+} frame_archive_writer_t;
+
+frame_archive_t * frame_archive_open(const char *filename);
+// opens an archive, reading the header and frame index.
+//
+// returns:
+//  the archive, or NULL on failure (with a message to stderr)
+
+void frame_archive_close(frame_archive_t *a);
+// closes an archive, freeing all memory
+
+int frame_archive_read(frame_archive_t *a, long frame, int x, int y, float **sheet);
+// decodes a single frame into sheet, converting doubles to floats as needed.
+// Safe to call from several threads on the same archive.
+//
+// a:           the archive
+// frame:       index of the frame to read
+// x:           x dimension of the sheet, must match the archive
+// y:           y dimension of the sheet, must match the archive
+// sheet[y][x]: 2D sheet of floats
+//
+// returns:
+//  0:  success
+//  <0: error
+
+frame_archive_writer_t * frame_archive_create(const char *filename, int nx, int ny,
+        file_type_t sample_type, double dt, int level);
+// creates a new archive for writing.
+//
+// filename:    file to create
+// nx, ny:      dimensions of each frame
+// sample_type: BINARY_FLOAT or BINARY_DOUBLE
+// dt:          interval between frames
+// level:       zlib compression level, 0 stores frames uncompressed
+//
+// returns:
+//  the writer, or NULL on failure
+
+int frame_archive_append(frame_archive_writer_t *w, const void *samples);
+// compresses and appends a frame of nx*ny samples of the archive sample type
+//
+// returns:
+//  0:  success
+//  <0: error
+
+int frame_archive_finish(frame_archive_writer_t *w);
+// writes the index and final header, then closes the file and frees the writer
+//
+// returns:
+//  0:  success
+//  <0: error
+
+#endif // FRAME_ARCHIVE_H
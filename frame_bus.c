@@ -0,0 +1,515 @@
+/*
+ * frame_bus.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "frame_bus.h"
+
+#define FRAME_BUS_MAGIC (0x42465454)    // "TTFB"
+#define FRAME_BUS_VERSION (1)
+
+// waits are woken at least this often, to look for processes that have died
+#define FRAME_BUS_POLL_SECONDS (1)
+
+// how long a consumer waits for a bus to be created
+#define FRAME_BUS_ATTACH_SECONDS (30)
+
+typedef struct frame_bus_slot {
+    uint64_t sequence;          // of the frame in the slot
+    long index;
+    int refs;                   // consumers yet to release it
+} frame_bus_slot_t;
+
+typedef struct frame_bus_consumer {
+    pid_t pid;                  // 0 for a free entry
+    uint64_t acquired;          // next sequence to acquire
+    uint64_t released;          // next sequence to release
+} frame_bus_consumer_t;
+
+struct frame_bus_header {
+    uint32_t magic;             // set last, once the rest is ready
+    uint32_t version;
+    int x;
+    int y;
+    int nslots;
+    size_t slot_offset;         // from the start of the mapping
+    size_t slot_bytes;
+    pid_t producer;
+
+    // events are counters bumped (under the lock) and waited on as futexes.
+    // Unlike condition variables they keep no record of their waiters, so a
+    // process killed while waiting can't leave them blocked.
+    pthread_mutex_t lock;
+    uint32_t published;         // a frame published, or the bus closed
+    uint32_t released;          // a frame released, or a consumer attached
+    uint64_t next_sequence;     // of the next frame published
+    int closed;
+
+    frame_bus_consumer_t consumers[FRAME_BUS_MAX_CONSUMERS];
+    frame_bus_slot_t slots[];
+};
+
+static size_t round_up(size_t n, size_t to) {
+    return ((n + to - 1)/to)*to;
+}
+
+static void lock(struct frame_bus_header *h) {
+// takes the lock, recovering it from a process that died holding it
+    if (EOWNERDEAD == pthread_mutex_lock(&h->lock)) {
+        pthread_mutex_consistent(&h->lock);
+    }
+}
+
+static void wait_for(struct frame_bus_header *h, uint32_t *event) {
+// waits for event to be signalled, for at most FRAME_BUS_POLL_SECONDS.
+// Called with the lock held, which is dropped while waiting.
+    uint32_t seen = __atomic_load_n(event, __ATOMIC_ACQUIRE);
+#ifdef __linux__
+    struct timespec timeout = {FRAME_BUS_POLL_SECONDS, 0};
+#endif
+
+    pthread_mutex_unlock(&h->lock);
+#ifdef __linux__
+    syscall(SYS_futex, event, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+    // no futexes, so poll
+    (void) seen;
+    usleep(1000);
+#endif
+    lock(h);
+}
+
+static void signal_event(uint32_t *event) {
+// wakes everything waiting for event
+    __atomic_add_fetch(event, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, event, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static int alive(pid_t pid) {
+// whether process pid still exists
+    return (0 == kill(pid, 0)) || (EPERM == errno);
+}
+
+static void detach_consumer(struct frame_bus_header *h, int c) {
+// drops consumer c's references, to the frames it holds and those published
+// since that it hasn't acquired.  Called with the lock held.
+    frame_bus_consumer_t *consumer = &h->consumers[c];
+    uint64_t sequence;
+
+    for (sequence = consumer->released; sequence < h->next_sequence; ++sequence) {
+        h->slots[sequence % h->nslots].refs--;
+    }
+    memset(consumer, 0, sizeof(frame_bus_consumer_t));
+    signal_event(&h->released);
+}
+
+static void reap_consumers(struct frame_bus_header *h) {
+// detaches consumers whose processes have gone.  Called with the lock held.
+    int c;
+
+    for (c = 0; c < FRAME_BUS_MAX_CONSUMERS; ++c) {
+        if (h->consumers[c].pid && !alive(h->consumers[c].pid)) {
+            fprintf(stderr, "frame bus: consumer %d has gone, detaching it\n",
+                    (int) h->consumers[c].pid);
+            detach_consumer(h, c);
+        }
+    }
+}
+
+static int map_slots(frame_bus_t *bus) {
+// builds this process's row pointers into each slot
+    struct frame_bus_header *h = bus->header;
+    float *slot;
+    int s, j;
+
+    bus->slots = calloc(h->nslots, sizeof(float **));
+    if (!bus->slots) {
+        return -1;
+    }
+    for (s = 0; s < h->nslots; ++s) {
+        bus->slots[s] = malloc(h->y*sizeof(float *));
+        if (!bus->slots[s]) {
+            return -1;
+        }
+        slot = (float *) ((char *) h + h->slot_offset + s*h->slot_bytes);
+        for (j = 0; j < h->y; ++j) {
+            bus->slots[s][j] = slot + (size_t) j*h->x;
+        }
+    }
+    return 0;
+}
+
+static void free_bus(frame_bus_t *bus) {
+// unmaps the bus and frees our side of it
+    int s;
+
+    if (bus->slots) {
+        for (s = 0; s < bus->header->nslots; ++s) {
+            free(bus->slots[s]);
+        }
+        free(bus->slots);
+    }
+    if (bus->header) {
+        munmap(bus->header, bus->size);
+    }
+    free(bus->name);
+    free(bus);
+}
+
+static int remove_stale(const char *name) {
+// removes bus name if its producer has gone without destroying it
+//
+// returns:
+//  0:  removed
+//  <0: still in use, or not a bus
+    struct frame_bus_header *h;
+    struct stat st;
+    int fd, stale = 0;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if ((0 == fstat(fd, &st)) && ((size_t) st.st_size >= sizeof(struct frame_bus_header))) {
+        h = mmap(NULL, sizeof(struct frame_bus_header), PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED != h) {
+            stale = (FRAME_BUS_MAGIC == h->magic) && !alive(h->producer);
+            munmap(h, sizeof(struct frame_bus_header));
+        }
+    }
+    close(fd);
+    if (!stale) {
+        return -1;
+    }
+    fprintf(stderr, "%s: removing a bus left by a producer that has gone\n", name);
+    return shm_unlink(name);
+}
+
+frame_bus_t * frame_bus_create(const char *name, int x, int y, int nslots) {
+// creates the shared memory, sized for nslots frames, and initialises it
+    struct frame_bus_header *h;
+    pthread_mutexattr_t mutex_attr;
+    frame_bus_t *bus;
+    size_t slot_offset, slot_bytes, size;
+    int fd;
+
+    if ((x < 1) || (y < 1) || (nslots < 2)) {
+        fprintf(stderr, "frame bus: needs at least two slots of at least 1 by 1\n");
+        return NULL;
+    }
+    slot_offset = round_up(sizeof(struct frame_bus_header) + nslots*sizeof(frame_bus_slot_t), 4096);
+    slot_bytes = round_up((size_t) x*y*sizeof(float), 64);
+    size = slot_offset + nslots*slot_bytes;
+
+    bus = calloc(1, sizeof(frame_bus_t));
+    if (!bus || !(bus->name = strdup(name))) {
+        free(bus);
+        return NULL;
+    }
+    bus->consumer = -1;
+    bus->producer = 1;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (EEXIST == errno) && (0 == remove_stale(name))) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) {
+        perror(name);
+        free_bus(bus);
+        return NULL;
+    }
+    if (0 != ftruncate(fd, size)) {
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        free_bus(bus);
+        return NULL;
+    }
+    h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == h) {
+        perror(name);
+        shm_unlink(name);
+        free_bus(bus);
+        return NULL;
+    }
+    bus->header = h;
+    bus->size = size;
+
+    h->version = FRAME_BUS_VERSION;
+    h->x = x;
+    h->y = y;
+    h->nslots = nslots;
+    h->slot_offset = slot_offset;
+    h->slot_bytes = slot_bytes;
+    h->producer = getpid();
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    if (0 != map_slots(bus)) {
+        shm_unlink(name);
+        free_bus(bus);
+        return NULL;
+    }
+
+    __atomic_store_n(&h->magic, FRAME_BUS_MAGIC, __ATOMIC_RELEASE);
+    return bus;
+}
+
+int frame_bus_wait_consumers(frame_bus_t *bus, int n) {
+// waits for n consumers to attach
+    struct frame_bus_header *h = bus->header;
+    int c, attached;
+
+    lock(h);
+    while (1) {
+        reap_consumers(h);
+        for (c = attached = 0; c < FRAME_BUS_MAX_CONSUMERS; ++c) {
+            attached += (0 != h->consumers[c].pid);
+        }
+        if (attached >= n)
+            break;
+        wait_for(h, &h->released);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+}
+
+float ** frame_bus_next_slot(frame_bus_t *bus) {
+// waits for the next slot to be free of references
+    struct frame_bus_header *h = bus->header;
+    int s = h->next_sequence % h->nslots;
+
+    lock(h);
+    while (h->slots[s].refs > 0) {
+        wait_for(h, &h->released);
+        reap_consumers(h);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return bus->slots[s];
+}
+
+int frame_bus_publish(frame_bus_t *bus, long index) {
+// gives the frame in the next slot a sequence number and a reference for
+// each consumer, and wakes them
+    struct frame_bus_header *h = bus->header;
+    frame_bus_slot_t *slot = &h->slots[h->next_sequence % h->nslots];
+    int c;
+
+    lock(h);
+    if (slot->refs > 0) {
+        pthread_mutex_unlock(&h->lock);
+        return -1;
+    }
+    slot->sequence = h->next_sequence;
+    slot->index = index;
+    slot->refs = 0;
+    for (c = 0; c < FRAME_BUS_MAX_CONSUMERS; ++c) {
+        slot->refs += (0 != h->consumers[c].pid);
+    }
+    h->next_sequence++;
+    signal_event(&h->published);
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+}
+
+void frame_bus_destroy(frame_bus_t *bus) {
+// closes the bus and removes its name; mappings stay valid until unmapped
+    struct frame_bus_header *h;
+
+    if (!bus) {
+        return;
+    }
+    h = bus->header;
+    lock(h);
+    h->closed = 1;
+    signal_event(&h->published);
+    pthread_mutex_unlock(&h->lock);
+
+    shm_unlink(bus->name);
+    free_bus(bus);
+}
+
+frame_bus_t * frame_bus_attach(const char *name) {
+// maps an existing bus, and takes a free entry in its consumer table
+    struct frame_bus_header *h;
+    frame_bus_t *bus;
+    struct stat st;
+    int fd, c, tries;
+
+    bus = calloc(1, sizeof(frame_bus_t));
+    if (!bus || !(bus->name = strdup(name))) {
+        free(bus);
+        return NULL;
+    }
+    bus->consumer = -1;
+
+    // consumers may well be started before the producer
+    for (tries = 0; tries < 10*FRAME_BUS_ATTACH_SECONDS; ++tries) {
+        fd = shm_open(name, O_RDWR, 0);
+        if ((fd >= 0) || (ENOENT != errno))
+            break;
+        usleep(100000);
+    }
+    if (fd < 0) {
+        perror(name);
+        free_bus(bus);
+        return NULL;
+    }
+    // the producer may still be setting it up
+    for (tries = 0; tries < 100; ++tries) {
+        if ((0 == fstat(fd, &st)) && ((size_t) st.st_size >= sizeof(struct frame_bus_header)))
+            break;
+        usleep(10000);
+    }
+    if ((size_t) st.st_size < sizeof(struct frame_bus_header)) {
+        fprintf(stderr, "%s: not a frame bus\n", name);
+        close(fd);
+        free_bus(bus);
+        return NULL;
+    }
+    h = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == h) {
+        perror(name);
+        free_bus(bus);
+        return NULL;
+    }
+    bus->header = h;
+    bus->size = st.st_size;
+
+    for (tries = 0; (tries < 100) && (FRAME_BUS_MAGIC != __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE)); ++tries) {
+        usleep(10000);
+    }
+    if ((FRAME_BUS_MAGIC != h->magic) || (FRAME_BUS_VERSION != h->version)
+            || (bus->size < h->slot_offset + h->nslots*h->slot_bytes)) {
+        fprintf(stderr, "%s: not a frame bus\n", name);
+        free_bus(bus);
+        return NULL;
+    }
+    if (0 != map_slots(bus)) {
+        free_bus(bus);
+        return NULL;
+    }
+
+    lock(h);
+    reap_consumers(h);
+    for (c = 0; c < FRAME_BUS_MAX_CONSUMERS; ++c) {
+        if (0 == h->consumers[c].pid) {
+            h->consumers[c].pid = getpid();
+            h->consumers[c].acquired = h->next_sequence;
+            h->consumers[c].released = h->next_sequence;
+            bus->consumer = c;
+            break;
+        }
+    }
+    signal_event(&h->released);
+    pthread_mutex_unlock(&h->lock);
+
+    if (bus->consumer < 0) {
+        fprintf(stderr, "%s: already has %d consumers\n", name, FRAME_BUS_MAX_CONSUMERS);
+        free_bus(bus);
+        return NULL;
+    }
+    return bus;
+}
+
+int frame_bus_dimensions(const frame_bus_t *bus, int *x, int *y) {
+// the dimensions of the bus's frames
+    *x = bus->header->x;
+    *y = bus->header->y;
+    return 0;
+}
+
+int frame_bus_acquire(frame_bus_t *bus, frame_bus_frame_t *frame) {
+// waits for the frame after the last one acquired
+    struct frame_bus_header *h = bus->header;
+    frame_bus_consumer_t *consumer;
+    frame_bus_slot_t *slot;
+
+    if (bus->consumer < 0) {
+        return -1;
+    }
+    consumer = &h->consumers[bus->consumer];
+
+    lock(h);
+    while ((consumer->acquired >= h->next_sequence) && !h->closed) {
+        if (!alive(h->producer)) {
+            // before finishing, so the frames seen are only part of the run
+            fprintf(stderr, "%s: the producer has gone\n", bus->name);
+            pthread_mutex_unlock(&h->lock);
+            return -2;
+        }
+        wait_for(h, &h->published);
+    }
+    if (consumer->acquired >= h->next_sequence) {
+        pthread_mutex_unlock(&h->lock);
+        return 1;
+    }
+    slot = &h->slots[consumer->acquired % h->nslots];
+    frame->sheet = bus->slots[consumer->acquired % h->nslots];
+    frame->index = slot->index;
+    frame->sequence = slot->sequence;
+    consumer->acquired++;
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+}
+
+int frame_bus_release(frame_bus_t *bus, const frame_bus_frame_t *frame) {
+// drops our reference to the oldest frame held
+    struct frame_bus_header *h = bus->header;
+    frame_bus_consumer_t *consumer;
+
+    if (bus->consumer < 0) {
+        return -1;
+    }
+    consumer = &h->consumers[bus->consumer];
+
+    lock(h);
+    if ((frame->sequence != consumer->released) || (consumer->released >= consumer->acquired)) {
+        pthread_mutex_unlock(&h->lock);
+        return -1;
+    }
+    h->slots[frame->sequence % h->nslots].refs--;
+    consumer->released++;
+    signal_event(&h->released);
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+}
+
+void frame_bus_detach(frame_bus_t *bus) {
+// gives up every reference, and the consumer table entry
+    if (!bus) {
+        return;
+    }
+    if (bus->consumer >= 0) {
+        lock(bus->header);
+        detach_consumer(bus->header, bus->consumer);
+        pthread_mutex_unlock(&bus->header->lock);
+    }
+    free_bus(bus);
+}
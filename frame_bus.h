@@ -0,0 +1,128 @@
+/*
+ * frame_bus.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * A POSIX shared memory ring of decoded frames, so several analyses of the
+ * same run share one decode.  A producer creates the bus and publishes
+ * frames into fixed size slots; consumers, in any process, attach by name
+ * and read the frames in place.
+ *
+ * Every frame published gets the next sequence number and a reference for
+ * each consumer attached at the time.  A consumer acquires frames in
+ * sequence order and releases them in the same order; a slot is only
+ * reused once every reference to its frame is gone, so the producer runs at
+ * most a ring's length ahead of the slowest consumer.  Consumers attaching
+ * late start with the next frame published.  A consumer that exits without
+ * detaching is noticed by the producer (its pid is recorded) and detached
+ * on its behalf.
+ *
+ * Producer:
+ *
+ *   frame_bus_t *bus = frame_bus_create("/run1", nx, ny, 8);
+ *   frame_bus_wait_consumers(bus, 2);
+ *   while (more frames) {
+ *       float **frame = frame_bus_next_slot(bus);
+ *       ... fill frame[y][x] ...
+ *       frame_bus_publish(bus, index);
+ *   }
+ *   frame_bus_destroy(bus);            // consumers see the end
+ *
+ * Consumer:
+ *
+ *   frame_bus_t *bus = frame_bus_attach("/run1");
+ *   while (0 == frame_bus_acquire(bus, &frame)) {
+ *       ... read frame.sheet[y][x], frame.index ...
+ *       frame_bus_release(bus, &frame);
+ *   }
+ *   frame_bus_detach(bus);
+ *
+ * Frames are laid out as single blocks, rows x floats apart.
+ */
+
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include <stdint.h>
+
+#define FRAME_BUS_MAX_CONSUMERS (16)
+
+struct frame_bus_header;
+
+typedef struct frame_bus {
+    char *name;
+    struct frame_bus_header *header;
+    size_t size;                // of the mapping
+    float ***slots;             // rows of each slot, in this process
+    int consumer;               // our entry in the consumer table, or -1
+    int producer;
+} frame_bus_t;
+
+typedef struct frame_bus_frame {
+    float **sheet;              // sheet[y][x], valid until released
+    long index;                 // frame number, as given to frame_bus_publish
+    uint64_t sequence;
+} frame_bus_frame_t;
+
+frame_bus_t * frame_bus_create(const char *name, int x, int y, int nslots);
+// creates a bus (shm_open name, e.g. "/run1") of nslots x by y frames, for
+// the producer.  Fails if the name is already in use, unless by a bus whose
+// producer has gone.
+//
+// returns:
+//  the bus, or NULL on failure
+
+int frame_bus_wait_consumers(frame_bus_t *bus, int n);
+// waits until at least n consumers are attached, so none misses the start
+//
+// returns:
+//  0:  success
+
+float ** frame_bus_next_slot(frame_bus_t *bus);
+// returns the slot the next frame should be written into, sheet[y][x],
+// waiting until every consumer has released the frame last in it
+
+int frame_bus_publish(frame_bus_t *bus, long index);
+// publishes the frame written into the slot from frame_bus_next_slot, as
+// frame number index
+//
+// returns:
+//  0:  success
+//  <0: no slot was taken
+
+void frame_bus_destroy(frame_bus_t *bus);
+// tells consumers no more frames are coming and removes the bus's name.
+// Consumers already attached can still read the frames published.
+
+frame_bus_t * frame_bus_attach(const char *name);
+// attaches to the bus name as a consumer, waiting up to 30 seconds for the
+// producer to create it
+//
+// returns:
+//  the bus, or NULL on failure (no such bus, or too many consumers)
+
+int frame_bus_dimensions(const frame_bus_t *bus, int *x, int *y);
+// the dimensions of the bus's frames
+//
+// returns:
+//  0:  success
+
+int frame_bus_acquire(frame_bus_t *bus, frame_bus_frame_t *frame);
+// waits for the next frame, filling in frame
+//
+// returns:
+//  0:  a frame, to be released with frame_bus_release
+//  1:  the producer has finished, and every frame has been acquired
+//  -2: the producer died without finishing
+//  <0: error
+
+int frame_bus_release(frame_bus_t *bus, const frame_bus_frame_t *frame);
+// releases a frame, which must be the oldest one held
+//
+// returns:
+//  0:  success
+//  <0: not the oldest frame held
+
+void frame_bus_detach(frame_bus_t *bus);
+// releases every frame held or yet to be acquired, and detaches
+
+#endif // FRAME_BUS_H
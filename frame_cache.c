@@ -0,0 +1,296 @@
+/*
+ * frame_cache.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "frame_cache.h"
+
+#define CACHE_MAGIC "TTCE"
+#define CACHE_VERSION (2)
+
+static int reserve(void *buffer, size_t *size, size_t needed) {
+// grows *(char **) buffer to at least needed bytes
+    char **b = buffer, *grown;
+
+    if (needed <= *size) {
+        return 0;
+    }
+    grown = realloc(*b, needed);
+    if (!grown) {
+        return -1;
+    }
+    *b = grown;
+    *size = needed;
+    return 0;
+}
+
+static int identify(const frame_cache_t *c, const char *filename, char *identity, size_t size) {
+// writes the identity of a frame's file (path, size and modification time)
+    struct stat st;
+    char *path;
+    const char *at = NULL;
+    int status;
+
+    // archive and frame file references name the file
+    if ((ARCHIVE == c->file_type) || (FRAME_FILE == c->file_type)) {
+        at = strrchr(filename, '@');
+    }
+    path = at ? strndup(filename, at - filename) : strdup(filename);
+    if (!path) {
+        return -1;
+    }
+    status = stat(path, &st);
+    free(path);
+    if (0 != status) {
+        return -1;
+    }
+
+    snprintf(identity, size, "%s %lld %lld.%09ld", filename, (long long) st.st_size,
+            (long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec);
+    return 0;
+}
+
+static uint64_t hash(const char *key) {
+// FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*key) {
+        h ^= (unsigned char) *key++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int make_directory(const char *path) {
+// creates a directory, unless it's already there
+    if ((0 != mkdir(path, 0777)) && (EEXIST != errno)) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+frame_cache_t * new_frame_cache(const char *directory, int x, int y,
+        const sheet_window_t *window, float isoline, file_type_t file_type, const char *mask) {
+// opens (creating if needed) a cache directory for frames of the given kind
+    frame_cache_t *c;
+    struct stat st;
+    size_t length;
+
+    if (0 != make_directory(directory)) {
+        return NULL;
+    }
+
+    c = calloc(1, sizeof(frame_cache_t));
+    if (!c || !(c->directory = strdup(directory))) {
+        free(c);
+        return NULL;
+    }
+    snprintf(c->window, sizeof(c->window), "%d %d", x, y);
+    if (window) {
+        snprintf(c->window, sizeof(c->window), "%d %d %d:%d,%d:%d", x, y,
+                window->x0, window->x1, window->y0, window->y1);
+        x = window->x1 - window->x0;
+        y = window->y1 - window->y0;
+    }
+    c->x = x;
+    c->y = y;
+    c->isoline = isoline;
+    c->file_type = file_type;
+
+    // the mask is identified like a frame file, but is never an archive
+    length = (mask ? strlen(mask) : 0) + 64;
+    c->mask_identity = malloc(length);
+    if (!c->mask_identity) {
+        destroy_frame_cache(c);
+        return NULL;
+    }
+    if (!mask) {
+        strcpy(c->mask_identity, "-");
+    } else if (0 == stat(mask, &st)) {
+        snprintf(c->mask_identity, length, "%s %lld %lld.%09ld", mask, (long long) st.st_size,
+                (long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec);
+    } else {
+        perror(mask);
+        destroy_frame_cache(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+int frame_cache_select(frame_cache_t *c, const char *filename, const char *previous) {
+// makes the frame in filename, paired with previous, the subject of the
+// next lookup or store
+    size_t length = 2*(strlen(filename) + (previous ? strlen(previous) : 0)) + 256;
+    char *identity, *previous_identity;
+    uint64_t h;
+    int status = -1;
+
+    identity = malloc(length);
+    previous_identity = malloc(length);
+    if (!identity || !previous_identity) {
+        goto done;
+    }
+    if (0 != identify(c, filename, identity, length)) {
+        goto done;
+    }
+    if (!previous) {
+        strcpy(previous_identity, "-");
+    } else if (0 != identify(c, previous, previous_identity, length)) {
+        goto done;
+    }
+
+    // exact isoline, so a rounded value never matches a different one
+    length = strlen(identity) + strlen(previous_identity) + strlen(c->mask_identity)
+        + sizeof(c->window) + 64;
+    if (0 != reserve(&c->key, &c->key_size, length)) {
+        goto done;
+    }
+    snprintf(c->key, c->key_size, "%s %d %a\n%s\n%s\n%s\n", c->window, (int) c->file_type,
+            c->isoline, c->mask_identity, identity, previous_identity);
+
+    // split over subdirectories, DIRECTORY/xx/xxxxxxxxxxxxxx
+    length = strlen(c->directory) + 32;
+    if (0 != reserve(&c->path, &c->path_size, length)) {
+        goto done;
+    }
+    h = hash(c->key);
+    snprintf(c->path, c->path_size, "%s/%02x/%014llx", c->directory,
+            (unsigned int) (h >> 56), (unsigned long long) (h & 0xffffffffffffffULL));
+    status = 0;
+
+done:
+    free(identity);
+    free(previous_identity);
+    return status;
+}
+
+int frame_cache_lookup(frame_cache_t *c, point_t *tips, int max_tips, int *ntips) {
+// reads the selected frame's tips, storing up to max_tips of them
+    FILE *file;
+    char magic[4];
+    uint32_t version, key_length, nstored;
+    int32_t count;
+    char *key = NULL;
+    int status = -1;
+
+    file = fopen(c->path, "rb");
+    if (!file) {
+        c->misses++;
+        return -1;
+    }
+
+    if ((1 != fread(magic, 4, 1, file)) || (0 != memcmp(magic, CACHE_MAGIC, 4))
+            || (1 != fread(&version, sizeof(version), 1, file)) || (CACHE_VERSION != version)
+            || (1 != fread(&key_length, sizeof(key_length), 1, file))
+            || (key_length != strlen(c->key))) {
+        goto done;
+    }
+    key = malloc(key_length);
+    if (!key || (key_length != fread(key, 1, key_length, file))
+            || (0 != memcmp(key, c->key, key_length))) {
+        goto done;
+    }
+    if ((1 != fread(&count, sizeof(count), 1, file))
+            || (1 != fread(&nstored, sizeof(nstored), 1, file))
+            || (nstored > (uint32_t) max_tips)) {
+        goto done;
+    }
+    if (nstored != fread(tips, sizeof(point_t), nstored, file)) {
+        goto done;
+    }
+    *ntips = count;
+    status = 0;
+
+done:
+    if (0 == status) {
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    free(key);
+    fclose(file);
+    return status;
+}
+
+int frame_cache_store(frame_cache_t *c, const point_t *tips, int ntips, int max_tips) {
+// records the selected frame's tips
+    FILE *file;
+    char *temporary;
+    uint32_t version = CACHE_VERSION, key_length = strlen(c->key);
+    int32_t count = ntips;
+    uint32_t nstored = (ntips < 0) ? max_tips : ntips;
+    int status = 0;
+
+    if (nstored > (uint32_t) max_tips) {
+        nstored = max_tips;
+    }
+
+    // the entry's subdirectory, DIRECTORY/xx
+    c->path[strlen(c->directory) + 3] = 0;
+    status = make_directory(c->path);
+    c->path[strlen(c->directory) + 3] = '/';
+    if (0 != status) {
+        return -1;
+    }
+
+    temporary = malloc(strlen(c->path) + 32);
+    if (!temporary) {
+        return -1;
+    }
+    sprintf(temporary, "%s.%ld.tmp", c->path, (long) getpid());
+
+    file = fopen(temporary, "wb");
+    if (!file) {
+        perror(temporary);
+        free(temporary);
+        return -1;
+    }
+
+    fwrite(CACHE_MAGIC, 4, 1, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(&key_length, sizeof(key_length), 1, file);
+    fwrite(c->key, 1, key_length, file);
+    fwrite(&count, sizeof(count), 1, file);
+    fwrite(&nstored, sizeof(nstored), 1, file);
+    fwrite(tips, sizeof(point_t), nstored, file);
+
+    if ((0 != fflush(file)) || ferror(file)) {
+        status = -1;
+    }
+    if (0 != fclose(file)) {
+        status = -1;
+    }
+    if ((0 == status) && (0 != rename(temporary, c->path))) {
+        perror(c->path);
+        status = -1;
+    }
+    if (0 != status) {
+        unlink(temporary);
+    }
+
+    free(temporary);
+    return status;
+}
+
+void destroy_frame_cache(frame_cache_t *c) {
+// frees the cache, leaving the directory in place
+    if (!c) {
+        return;
+    }
+    free(c->directory);
+    free(c->mask_identity);
+    free(c->key);
+    free(c->path);
+    free(c);
+}
@@ -0,0 +1,84 @@
+/*
+ * frame_cache.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * An on-disk cache of per-frame results, so that tracing the same frames
+ * again (with a different timestep, output or tip linking) needn't decode
+ * them.  Each frame's tips depend on the frame and the one before it, so an
+ * entry is keyed by
+ *
+ *   sheet dimensions and window, file type, isoline and tissue mask file,
+ *   the frame's file: path, size and modification time,
+ *   the previous frame's file, likewise,
+ *
+ * (for archive references PATH@N, the archive's identity and N).  Changing
+ * or touching either file invalidates the entry.  Entries are small files
+ * in DIRECTORY/xx/, named by a hash of the key, which they also hold in full
+ * so that a hash collision is only a miss.  They are written to a temporary
+ * file and renamed, so concurrent runs can share a cache directory.
+ *
+ * An entry holds (native byte order)
+ *
+ *   "TTCE", u32 version, u32 key length, key,
+ *   i32 ntips (as returned by find_tips), u32 tips stored, tips (x, y floats)
+ */
+
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include "point_t.h"
+#include "tip_trace_binary.h"
+
+typedef struct frame_cache {
+    char *directory;
+    int x;                      // of the window traced
+    int y;
+    char window[96];            // the sheet's dimensions and the window
+    float isoline;
+    file_type_t file_type;
+    char *mask_identity;        // of the mask file, or "-"
+
+    char *key;                  // key of the current frame
+    size_t key_size;
+    char *path;                 // entry file of the current frame
+    size_t path_size;
+
+    long hits;
+    long misses;
+} frame_cache_t;
+
+frame_cache_t * new_frame_cache(const char *directory, int x, int y,
+        const sheet_window_t *window, float isoline, file_type_t file_type, const char *mask);
+// opens (creating if needed) a cache directory for frames of the given kind,
+// x by y, traced within window (NULL for all of it) and the tissue mask file
+// mask (NULL for none)
+//
+// returns:
+//  the cache, or NULL on failure
+
+int frame_cache_select(frame_cache_t *c, const char *filename, const char *previous);
+// makes the frame in filename, paired with previous (NULL for the first
+// frame), the subject of the next lookup or store
+//
+// returns:
+//  0:  success
+//  <0: a file couldn't be identified, so the frame can't be cached
+
+int frame_cache_lookup(frame_cache_t *c, point_t *tips, int max_tips, int *ntips);
+// reads the selected frame's tips, storing up to max_tips of them
+//
+// returns:
+//  0:  hit, *ntips set as find_tips would return it
+//  <0: miss
+
+int frame_cache_store(frame_cache_t *c, const point_t *tips, int ntips, int max_tips);
+// records the selected frame's tips, ntips as find_tips returned it
+//
+// returns:
+//  0:  success
+//  <0: error
+
+void destroy_frame_cache(frame_cache_t *c);
+// frees the cache, leaving the directory in place
+
+#endif // FRAME_CACHE_H
@@ -0,0 +1,687 @@
+/*
+ * frame_file.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "decompress.h"
+#include "kernels.h"
+#include "frame_file.h"
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_LENGTH (6)
+
+// IGB headers are a whole number of these blocks
+#define IGB_BLOCK (1024)
+
+// furthest into a file a header is looked for
+#define PROBE_SIZE (65536)
+
+static int host_is_little_endian(void) {
+    const uint16_t one = 1;
+    return *(const unsigned char *) &one;
+}
+
+static long read_all(int fd, unsigned char *buffer, size_t count) {
+// reads up to count bytes from fd, retrying on short reads.
+    ssize_t rw;
+    size_t done = 0;
+
+    while (done < count) {
+        rw = read(fd, buffer + done, count - done);
+        if (rw < 0) {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == rw)
+            break;
+        done += rw;
+    }
+    return done;
+}
+
+static const char * npy_value(const char *header, const char *key) {
+// returns the start of the value of key in an .npy header's dictionary, or
+// NULL if it isn't there
+    const char *p = strstr(header, key);
+
+    if (!p) {
+        return NULL;
+    }
+    p = strchr(p + strlen(key), ':');
+    if (!p) {
+        return NULL;
+    }
+    ++p;
+    while (isspace((unsigned char) *p)) {
+        ++p;
+    }
+    return p;
+}
+
+static int parse_npy(const unsigned char *data, size_t length, frame_file_t *f,
+        const char *name) {
+// reads an .npy header, the dictionary
+//
+//   {'descr': '<f4', 'fortran_order': False, 'shape': (t, y, x), }
+//
+// returns 1 if it is one, 0 if it isn't and <0 if it is but can't be used
+    unsigned long header_length;
+    size_t start;
+    char *header, *end;
+    const char *p;
+    long shape[3];
+    int ndims = 0, status = -1;
+    char order;
+
+    if ((length < NPY_MAGIC_LENGTH + 4) || (0 != memcmp(data, NPY_MAGIC, NPY_MAGIC_LENGTH))) {
+        return 0;
+    }
+
+    // version 1 has a 16 bit header length, later versions 32 bits
+    if (1 == data[6]) {
+        header_length = data[8] | (data[9] << 8);
+        start = 10;
+    } else if (((2 == data[6]) || (3 == data[6])) && (length >= 12)) {
+        header_length = data[8] | (data[9] << 8) | ((unsigned long) data[10] << 16)
+            | ((unsigned long) data[11] << 24);
+        start = 12;
+    } else {
+        fprintf(stderr, "%s: unsupported .npy version %d\n", name, data[6]);
+        return -1;
+    }
+    if (start + header_length > length) {
+        fprintf(stderr, "%s: truncated .npy header\n", name);
+        return -1;
+    }
+
+    header = strndup((const char *) data + start, header_length);
+    if (!header) {
+        return -1;
+    }
+
+    // '<f4', the byte order then the type
+    p = npy_value(header, "descr");
+    if (!p || (('\'' != *p) && ('"' != *p))) {
+        fprintf(stderr, "%s: .npy header has no descr\n", name);
+        goto out;
+    }
+    order = p[1];
+    if (!order || !strchr("<>=|", order) || ('f' != p[2]) || !p[3] || !strchr("48", p[3])
+            || (p[4] != *p)) {
+        fprintf(stderr, "%s: .npy data must be float32 or float64, not %.*s\n", name,
+                (int) strcspn(p + 1, "'\""), p + 1);
+        goto out;
+    }
+    f->sample_size = p[3] - '0';
+    if ('<' == order) {
+        f->swap = !host_is_little_endian();
+    } else if ('>' == order) {
+        f->swap = host_is_little_endian();
+    } else {
+        f->swap = 0;
+    }
+
+    p = npy_value(header, "fortran_order");
+    if (p && (0 == strncmp(p, "True", 4))) {
+        fprintf(stderr, "%s: Fortran order .npy files aren't supported; save the array in C order\n", name);
+        goto out;
+    }
+
+    // (y, x) or (t, y, x)
+    p = npy_value(header, "shape");
+    if (!p || ('(' != *p)) {
+        fprintf(stderr, "%s: .npy header has no shape\n", name);
+        goto out;
+    }
+    ++p;
+    while (1) {
+        while (isspace((unsigned char) *p) || (',' == *p)) {
+            ++p;
+        }
+        if (')' == *p) {
+            break;
+        }
+        if (3 == ndims) {
+            ndims = 4;
+            break;
+        }
+        shape[ndims] = strtol(p, &end, 10);
+        if (end == p) {
+            ndims = 0;
+            break;
+        }
+        ++ndims;
+        p = end;
+    }
+    if (2 == ndims) {
+        f->nframes = 1;
+        f->ny = shape[0];
+        f->nx = shape[1];
+    } else if (3 == ndims) {
+        f->nframes = shape[0];
+        f->ny = shape[1];
+        f->nx = shape[2];
+    } else {
+        fprintf(stderr, "%s: .npy arrays must be (y, x) or (t, y, x)\n", name);
+        goto out;
+    }
+
+    f->format = FRAME_FILE_NPY;
+    f->dt = 0;
+    f->offset = start + header_length;
+    status = 1;
+
+out:
+    free(header);
+    return status;
+}
+
+static int parse_igb(const unsigned char *data, size_t length, frame_file_t *f,
+        const char *name) {
+// reads an IGB header, whitespace separated key:value pairs such as
+//
+//   x:64 y:48 z:1 t:1000 type:float systeme:little_endian inc_t:0.5
+//
+// returns 1 if it is one, 0 if it isn't and <0 if it is but can't be used
+    const unsigned char *form_feed;
+    char *text, *line, *token, *value, *save, *save_line;
+    size_t end, i;
+    long x = -1, y = -1, z = 1, t = -1;
+    double inc_t = 0, dim_t = 0;
+    int status = -1;
+
+    end = (length < PROBE_SIZE) ? length : PROBE_SIZE;
+    form_feed = memchr(data, '\f', end);
+    if (form_feed) {
+        end = form_feed - data;
+    } else if (end > IGB_BLOCK) {
+        end = IGB_BLOCK;
+    }
+
+    // a header is text, of key:value pairs
+    for (i = 0; i < end; ++i) {
+        if (!isprint(data[i]) && !isspace(data[i])) {
+            return 0;
+        }
+    }
+    text = strndup((const char *) data, end);
+    if (!text) {
+        return -1;
+    }
+
+    // a line at a time, anything after a # being a comment
+    for (line = strtok_r(text, "\r\n", &save_line); line;
+            line = strtok_r(NULL, "\r\n", &save_line)) {
+        value = strchr(line, '#');
+        if (value) {
+            *value = 0;
+        }
+        for (token = strtok_r(line, " \t\v", &save); token;
+                token = strtok_r(NULL, " \t\v", &save)) {
+            value = strchr(token, ':');
+            if (!value || (value == token)) {
+                // not a key:value pair, so not a header
+                free(text);
+                return 0;
+            }
+            *value++ = 0;
+
+            if (0 == strcmp("x", token)) {
+                x = atol(value);
+            } else if (0 == strcmp("y", token)) {
+                y = atol(value);
+            } else if (0 == strcmp("z", token)) {
+                z = atol(value);
+            } else if (0 == strcmp("t", token)) {
+                t = atol(value);
+            } else if (0 == strcmp("inc_t", token)) {
+                inc_t = atof(value);
+            } else if (0 == strcmp("dim_t", token)) {
+                dim_t = atof(value);
+            } else if (0 == strcmp("type", token)) {
+                if (0 == strcmp("float", value)) {
+                    f->sample_size = sizeof(float);
+                } else if (0 == strcmp("double", value)) {
+                    f->sample_size = sizeof(double);
+                } else {
+                    fprintf(stderr, "%s: IGB data must be float or double, not %s\n", name, value);
+                    goto out;
+                }
+            } else if (0 == strcmp("systeme", token)) {
+                if (0 == strcmp("little_endian", value)) {
+                    f->swap = !host_is_little_endian();
+                } else if (0 == strcmp("big_endian", value)) {
+                    f->swap = host_is_little_endian();
+                } else {
+                    fprintf(stderr, "%s: unknown IGB byte order %s\n", name, value);
+                    goto out;
+                }
+            }
+        }
+    }
+    if ((x < 0) || (y < 0)) {
+        // key:value text, but not an IGB header
+        status = 0;
+        goto out;
+    }
+    if (0 == f->sample_size) {
+        fprintf(stderr, "%s: IGB header has no type\n", name);
+        goto out;
+    }
+    if (1 != z) {
+        fprintf(stderr, "%s: IGB files must hold 2D sheets, not z:%ld\n", name, z);
+        goto out;
+    }
+
+    f->format = FRAME_FILE_IGB;
+    f->nx = x;
+    f->ny = y;
+    f->nframes = t;
+    f->dt = (inc_t > 0) ? inc_t : ((t > 1) ? dim_t/(t - 1) : 0);
+    // the header fills whole blocks, the last ending in the form feed
+    f->offset = form_feed ? (end/IGB_BLOCK + 1)*IGB_BLOCK : IGB_BLOCK;
+    status = 1;
+
+out:
+    free(text);
+    return status;
+}
+
+static int parse_header(const unsigned char *data, size_t length, frame_file_t *f,
+        const char *name) {
+// fills in f from the header at the start of data, nframes being the count
+// the header gives, or -1 if it gives none
+//
+// returns 1 for a header, 0 for none, <0 for an unusable one
+    int status;
+
+    f->swap = 0;
+    f->sample_size = 0;
+    status = parse_npy(data, length, f, name);
+    if (0 == status) {
+        status = parse_igb(data, length, f, name);
+    }
+    if ((1 == status) && ((f->nx < 1) || (f->ny < 1))) {
+        fprintf(stderr, "%s: header gives a %d by %d sheet\n", name, f->nx, f->ny);
+        return -1;
+    }
+    return status;
+}
+
+static void count_frames(frame_file_t *f, size_t length) {
+// limits nframes to the complete frames in length bytes of file
+    size_t frame_bytes = (size_t) f->nx*f->ny*f->sample_size;
+    long available = (length > f->offset) ? (long) ((length - f->offset)/frame_bytes) : 0;
+
+    if ((f->nframes < 0) || (f->nframes > available)) {
+        f->nframes = available;
+    }
+}
+
+size_t frame_file_path(const char *reference, long *frame) {
+// splits FILE@N into FILE and N
+    const char *at = strrchr(reference, '@');
+    char *end;
+
+    *frame = 0;
+    if (at && (at[1] != 0)) {
+        long n = strtol(at + 1, &end, 10);
+        if ((0 == *end) && (n >= 0)) {
+            *frame = n;
+            return at - reference;
+        }
+    }
+    return strlen(reference);
+}
+
+int frame_file_probe(const char *reference, frame_file_t *header) {
+// reads just the header of the file a reference names.  Only the start of a
+// compressed file is decoded.
+    decompress_reader_t *stream = NULL;
+    compression_t compression;
+    unsigned char *prefix;
+    struct stat st;
+    char *name;
+    long frame, length;
+    int fd, status = -1;
+
+    name = strndup(reference, frame_file_path(reference, &frame));
+    if (!name) {
+        return -1;
+    }
+    memset(header, 0, sizeof(frame_file_t));
+    prefix = malloc(PROBE_SIZE);
+    if (!prefix) {
+        free(name);
+        return -1;
+    }
+
+    // parenthesised to avoid helper.h's open() macro.  A file that can't be
+    // opened has no header; reading it will say why.
+    fd = (open)(name, O_RDONLY);
+    if (fd < 0) {
+        status = 0;
+        goto out;
+    }
+    if (0 != fstat(fd, &st)) {
+        perror(name);
+        goto out;
+    }
+
+    length = read_all(fd, prefix, PROBE_SIZE);
+    if (length < 0) {
+        perror(name);
+        goto out;
+    }
+
+    compression = detect_compression(prefix, length);
+    if (COMPRESSION_NONE != compression) {
+        stream = new_decompress_reader(fd, compression);
+        if (!stream) {
+            goto out;
+        }
+        length = decompress_read(stream, prefix, PROBE_SIZE);
+        if (length < 0) {
+            fprintf(stderr, "%s: corrupt %s data\n", name, compression_name(compression));
+            goto out;
+        }
+    }
+
+    status = parse_header(prefix, length, header, name);
+    header->compressed = (COMPRESSION_NONE != compression);
+    if ((1 == status) && !header->compressed) {
+        count_frames(header, st.st_size);
+    }
+
+out:
+    destroy_decompress_reader(stream);
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(prefix);
+    free(name);
+    return status;
+}
+
+static int restart_stream(frame_file_t *f) {
+// decodes the file from the start again, up to its first frame
+    size_t frame_bytes = (size_t) f->nx*f->ny*f->sample_size;
+    size_t skip, n;
+
+    f->frame_index = -1;
+    f->position = 0;
+    if (0 != decompress_rewind(f->stream)) {
+        return -1;
+    }
+    for (skip = f->offset; skip > 0; skip -= n) {
+        n = (skip < frame_bytes) ? skip : frame_bytes;
+        if (decompress_read(f->stream, f->frame, n) != (long) n) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int next_frame(frame_file_t *f) {
+// decodes the frame at f->position into f->frame
+//
+// returns 1 if there was a whole frame, 0 at the end and <0 on error
+    size_t frame_bytes = (size_t) f->nx*f->ny*f->sample_size;
+    long length;
+
+    f->frame_index = -1;
+    length = decompress_read(f->stream, f->frame, frame_bytes);
+    if (length < 0) {
+        fprintf(stderr, "Corrupt data in frame %ld\n", f->position);
+        return -1;
+    }
+    if ((size_t) length < frame_bytes) {
+        return 0;
+    }
+    f->frame_index = f->position++;
+    return 1;
+}
+
+static int stream_frame(frame_file_t *f, long frame) {
+// decodes frames up to the one wanted, starting over if it has been passed
+    int status;
+
+    if (frame == f->frame_index) {
+        return 0;
+    }
+    if ((frame < f->position) && (0 != restart_stream(f))) {
+        fprintf(stderr, "Problem going back to frame %ld\n", frame);
+        return -1;
+    }
+    while (f->position <= frame) {
+        status = next_frame(f);
+        if (status < 0) {
+            return -1;
+        }
+        if (0 == status) {
+            fprintf(stderr, "Frame %ld is past the end of the file (%ld frames)\n", frame,
+                    f->position);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+frame_file_t * frame_file_open(const char *filename) {
+// opens a file, mapping it if it is uncompressed and preparing to decode it
+// if not
+    unsigned char magic[COMPRESSION_MAGIC_LENGTH], *bytes;
+    compression_t compression;
+    frame_file_t *f;
+    struct stat st;
+    long length;
+    int fd, status;
+
+    fd = (open)(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return NULL;
+    }
+    if (0 != fstat(fd, &st)) {
+        perror(filename);
+        close(fd);
+        return NULL;
+    }
+    length = read_all(fd, magic, COMPRESSION_MAGIC_LENGTH);
+    if (length < COMPRESSION_MAGIC_LENGTH) {
+        fprintf(stderr, "%s: not an .npy or IGB file\n", filename);
+        close(fd);
+        return NULL;
+    }
+    compression = detect_compression(magic, length);
+
+    f = calloc(1, sizeof(frame_file_t));
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
+    f->fd = -1;
+    f->frame_index = -1;
+
+    if (COMPRESSION_NONE == compression) {
+        bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == bytes) {
+            perror(filename);
+            free(f);
+            return NULL;
+        }
+#ifdef MADV_SEQUENTIAL
+        // frames are mostly read in order; have the kernel read ahead
+        madvise(bytes, st.st_size, MADV_SEQUENTIAL);
+#endif
+        f->mapping = bytes;
+        f->mapping_size = st.st_size;
+        length = st.st_size;
+    } else {
+        // kept open, the frames being decoded as they are read
+        f->fd = fd;
+        f->compressed = 1;
+        f->stream = new_decompress_reader(fd, compression);
+        bytes = malloc(PROBE_SIZE);
+        if (!f->stream || !bytes) {
+            free(bytes);
+            frame_file_close(f);
+            return NULL;
+        }
+        length = decompress_read(f->stream, bytes, PROBE_SIZE);
+        if (length < 0) {
+            fprintf(stderr, "%s: corrupt %s data\n", filename, compression_name(compression));
+            free(bytes);
+            frame_file_close(f);
+            return NULL;
+        }
+    }
+
+    status = parse_header(bytes, length, f, filename);
+    if (f->compressed) {
+        free(bytes);
+    }
+    if (1 != status) {
+        if (0 == status) {
+            fprintf(stderr, "%s: not an .npy or IGB file\n", filename);
+        }
+        frame_file_close(f);
+        return NULL;
+    }
+
+    if (f->compressed) {
+        f->frame = malloc((size_t) f->nx*f->ny*f->sample_size);
+        if (!f->frame || (0 != restart_stream(f))) {
+            fprintf(stderr, "%s: problem decoding the first frame\n", filename);
+            frame_file_close(f);
+            return NULL;
+        }
+    } else {
+        count_frames(f, length);
+        f->data = bytes + f->offset;
+    }
+    return f;
+}
+
+void frame_file_close(frame_file_t *f) {
+// unmaps or closes the file and frees f
+    if (!f) {
+        return;
+    }
+    if (f->mapping) {
+        munmap(f->mapping, f->mapping_size);
+    }
+    destroy_decompress_reader(f->stream);
+    if (f->fd >= 0) {
+        close(f->fd);
+    }
+    free(f->frame);
+    free(f);
+}
+
+long frame_file_count(frame_file_t *f) {
+// counts a compressed file's frames by decoding it through once, if its
+// header didn't give the count
+    int status;
+
+    if (f->nframes >= 0) {
+        return f->nframes;
+    }
+    if ((f->position > 0) && (0 != restart_stream(f))) {
+        return -1;
+    }
+    while (1 == (status = next_frame(f)))
+        ;
+    if (status < 0) {
+        return -1;
+    }
+    f->nframes = f->position;
+    return f->nframes;
+}
+
+static void copy_samples(const frame_file_t *f, const tip_kernels_t *kernels,
+        const unsigned char *in, float *out, int n) {
+// converts n stored samples to floats
+    unsigned char swapped[sizeof(double)];
+    float value_f;
+    double value_d;
+    size_t k;
+    int i;
+
+    if (!f->swap) {
+        if (sizeof(float) == f->sample_size) {
+            memcpy(out, in, n*sizeof(float));
+        } else {
+            // frames of doubles start 8 byte aligned in both formats
+            kernels->convert_row((const double *) in, out, n);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; ++i) {
+        for (k = 0; k < f->sample_size; ++k) {
+            swapped[k] = in[f->sample_size - 1 - k];
+        }
+        if (sizeof(float) == f->sample_size) {
+            memcpy(&value_f, swapped, sizeof(float));
+            out[i] = value_f;
+        } else {
+            memcpy(&value_d, swapped, sizeof(double));
+            out[i] = (float) value_d;
+        }
+        in += f->sample_size;
+    }
+}
+
+int frame_file_read(frame_file_t *f, long frame, int x, int y,
+        const sheet_window_t *window, float **sheet) {
+// copies the window of a frame out of the mapped file, or out of the frame
+// decoded from a compressed one
+    const tip_kernels_t *kernels = tip_kernels();
+    const unsigned char *base, *row;
+    int x0 = 0, x1 = x, y0 = 0, y1 = y;
+    int j;
+
+    if ((frame < 0) || ((f->nframes >= 0) && (frame >= f->nframes))) {
+        fprintf(stderr, "Frame %ld out of range (%ld frames)\n", frame, f->nframes);
+        return -1;
+    }
+    if ((x != f->nx) || (y != f->ny)) {
+        fprintf(stderr, "Sheet is %dx%d but file holds %dx%d frames\n", x, y, f->nx, f->ny);
+        return -1;
+    }
+    if (window) {
+        x0 = window->x0;
+        x1 = window->x1;
+        y0 = window->y0;
+        y1 = window->y1;
+    }
+
+    if (f->stream) {
+        if (0 != stream_frame(f, frame)) {
+            return -1;
+        }
+        base = f->frame;
+    } else {
+        base = f->data + (size_t) frame*x*y*f->sample_size;
+    }
+
+    for (j = y0; j < y1; ++j) {
+        row = base + ((size_t) j*x + x0)*f->sample_size;
+        copy_samples(f, kernels, row, sheet[j - y0], x1 - x0);
+    }
+    return 0;
+}
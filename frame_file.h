@@ -0,0 +1,108 @@
+/*
+ * frame_file.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Self-describing frame files, whose headers give the sheet dimensions, the
+ * sample type and often the timestep, holding one frame or a whole run:
+ *
+ *   NumPy .npy     float32 or float64 arrays of shape (y, x) for a single
+ *                  frame, or (t, y, x) for a run, in C order and either byte
+ *                  order.
+ *   openCARP IGB   an ASCII header of key:value pairs (x, y, z, t, type,
+ *                  systeme, inc_t...), padded to a multiple of 1024 bytes
+ *                  and ended by a form feed, then t frames of x*y floats or
+ *                  doubles.  z, if given, must be 1.
+ *
+ * Files are recognised by their contents, not their names.  Uncompressed
+ * files are memory mapped, so stepping through the frames of a run copies
+ * each straight out of the page cache, with no read or seek per frame, and
+ * a mapped file mustn't be truncated while it's open.  Compressed ones
+ * (gzip, zstd, lz4) are decoded a frame at a time as they are read, so only
+ * one frame is ever held; reading them in order decodes the file once, and
+ * going back to an earlier frame decodes again from the start.
+ *
+ * Frames are referred to as FILE@N, and a FILE alone means its first frame.
+ */
+
+#ifndef FRAME_FILE_H
+#define FRAME_FILE_H
+
+#include <stddef.h>
+#include "tip_trace_binary.h"
+#include "decompress.h"
+
+typedef enum frame_file_format {
+    FRAME_FILE_NPY,
+    FRAME_FILE_IGB
+} frame_file_format_t;
+
+typedef struct frame_file {
+    frame_file_format_t format;
+    int nx;
+    int ny;
+    long nframes;               // complete frames in the file
+    int compressed;             // so the frames are decoded as read
+    size_t sample_size;         // 4 for floats, 8 for doubles
+    int swap;                   // samples are in the other byte order
+    double dt;                  // from the header, 0 if it doesn't say
+    size_t offset;              // of the first frame from the start of the file
+
+    const unsigned char *data;  // the first frame, if mapped
+    unsigned char *mapping;     // the mapped file, or NULL
+    size_t mapping_size;
+
+    // a compressed file, being decoded
+    int fd;
+    decompress_reader_t *stream;
+    unsigned char *frame;       // the frame last decoded
+    long frame_index;           // which frame that is, -1 for none
+    long position;              // frames decoded since the start
+} frame_file_t;
+
+size_t frame_file_path(const char *reference, long *frame);
+// splits a reference FILE@N into the length of FILE and the frame N.  A
+// reference without an @N suffix is all FILE, and frame 0.
+
+int frame_file_probe(const char *reference, frame_file_t *header);
+// reads the header of the file a reference names, without mapping or
+// decoding its frames.  For a compressed file, header->nframes is only the
+// count the header gives, or -1 if it gives none; frame_file_count counts
+// the frames it holds.
+//
+// returns:
+//  1:  the file has an .npy or IGB header, described in header
+//  0:  it doesn't, or it can't be opened
+//  <0: error (with a message to stderr)
+
+frame_file_t * frame_file_open(const char *filename);
+// opens a file, reading its header and mapping it if it is uncompressed.
+// A compressed file's nframes is the count its header gives, or -1 if it
+// gives none, and a frame the file turns out to be too short for fails to
+// read.
+//
+// returns:
+//  the file, or NULL on failure (with a message to stderr)
+
+void frame_file_close(frame_file_t *f);
+// unmaps or closes the file and frees f.  NULL is ignored.
+
+long frame_file_count(frame_file_t *f);
+// returns the number of frames in the file, decoding a compressed file from
+// start to end to count them if its header doesn't say, or <0 on error
+
+int frame_file_read(frame_file_t *f, long frame, int x, int y,
+        const sheet_window_t *window, float **sheet);
+// copies the window (NULL for all) of a frame into sheet, converting doubles
+// to floats and swapping bytes as needed
+//
+// f:           the file
+// frame:       index of the frame to read
+// x:           x dimension of the sheet, must match the file
+// y:           y dimension of the sheet, must match the file
+// sheet:       sheet[y1-y0][x1-x0]
+//
+// returns:
+//  0:  success
+//  <0: error
+
+#endif // FRAME_FILE_H
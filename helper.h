@@ -137,7 +137,8 @@
 // float array 2d
 // Allocates to give 2d array accessible through array[j][i] notation but with
 // contiguous storage of the variables, allowing for easy output to files and
-// transmission via mpi etc.
+// transmission via mpi etc.  For frames that are worked on heavily, prefer
+// the aligned sheets of sheet_alloc.h.
 #define F_ARRAY_2D(p,rows,cols) { \
                                     int _i_; \
                                     MALLOC_FP(p,(rows),"row alloc failure"); \
@@ -0,0 +1,336 @@
+/*
+ * kernels.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "tip_tracer.h"
+
+// find_isoline's tolerance for a value lying on the isoline
+#define ON_TOLERANCE (10e-6)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// the smallest float not below ON_TOLERANCE: for a float v, fabs(v) <
+// ON_TOLERANCE exactly when fabsf(v) < on_threshold, so the vector variants
+// can compare in single precision and still agree with the generic C
+static float on_threshold;
+
+static inline int crosses(unsigned char c, unsigned char right,
+        unsigned char above_right, unsigned char above) {
+// whether the isoline can cross a cell with these corner classifications
+    return (c & TIP_TRACER_ON) || (right != c) || (above_right != c) || (above != c);
+}
+
+
+/* Generic C, for any CPU */
+
+static void classify_row_generic(const float *row, float isoline, unsigned char *classes, int n) {
+    int i;
+    float value;
+
+    for (i = 0; i < n; ++i) {
+        value = row[i] - isoline;
+        classes[i] = ((value > 0.0) ? TIP_TRACER_ABOVE : 0)
+            | ((fabs(value) < ON_TOLERANCE) ? TIP_TRACER_ON : 0);
+    }
+}
+
+static int candidate_cells_generic(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int *cells) {
+    int i, n = 0;
+
+    for (i = first; i < end; ++i) {
+        if (crosses(a_0[i], a_0[i+1], a_1[i+1], a_1[i])
+                && crosses(b_0[i], b_0[i+1], b_1[i+1], b_1[i])) {
+            cells[n++] = i;
+        }
+    }
+    return n;
+}
+
+static int candidate_lanes_generic(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int step,
+        int *cells) {
+    int k, n = 0;
+
+    for (k = first; k < end; ++k) {
+        if (crosses(a_0[k], a_0[k+step], a_1[k+step], a_1[k])
+                && crosses(b_0[k], b_0[k+step], b_1[k+step], b_1[k])) {
+            cells[n++] = k;
+        }
+    }
+    return n;
+}
+
+static void convert_row_generic(const double *in, float *out, int n) {
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        out[i] = (float) in[i];
+    }
+}
+
+static const tip_kernels_t generic_kernels = {
+    "generic", classify_row_generic, candidate_cells_generic, candidate_lanes_generic,
+    convert_row_generic
+};
+
+
+#ifdef KERNELS_X86
+
+/* AVX2: 8 floats or 32 classifications at a time */
+
+__attribute__((target("avx2")))
+static void classify_row_avx2(const float *row, float isoline, unsigned char *classes, int n) {
+    const __m256 iso = _mm256_set1_ps(isoline);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 threshold = _mm256_set1_ps(on_threshold);
+    const __m256i above_bit = _mm256_set1_epi32(TIP_TRACER_ABOVE);
+    const __m256i on_bit = _mm256_set1_epi32(TIP_TRACER_ON);
+    // low byte of each 32 bit lane to the bottom of its 128 bit half
+    const __m256i gather = _mm256_setr_epi8(
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i halves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    __m256 value, above, on;
+    __m256i bits;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        value = _mm256_sub_ps(_mm256_loadu_ps(row + i), iso);
+        above = _mm256_cmp_ps(value, zero, _CMP_GT_OQ);
+        on = _mm256_cmp_ps(_mm256_andnot_ps(sign, value), threshold, _CMP_LT_OQ);
+        bits = _mm256_or_si256(
+                _mm256_and_si256(_mm256_castps_si256(above), above_bit),
+                _mm256_and_si256(_mm256_castps_si256(on), on_bit));
+        bits = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bits, gather), halves);
+        _mm_storel_epi64((__m128i *) (classes + i), _mm256_castsi256_si128(bits));
+    }
+    classify_row_generic(row + i, isoline, classes + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static __m256i crosses_avx2(const unsigned char *row_0, const unsigned char *row_1, int i,
+        int step) {
+// lanes set for the 32 cells from i the isoline may cross, each using
+// elements i and i+step
+    const __m256i on_bit = _mm256_set1_epi8(TIP_TRACER_ON);
+    __m256i c = _mm256_loadu_si256((const __m256i *) (row_0 + i));
+    __m256i same = _mm256_and_si256(
+            _mm256_cmpeq_epi8(c, _mm256_loadu_si256((const __m256i *) (row_0 + i + step))),
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(c, _mm256_loadu_si256((const __m256i *) (row_1 + i + step))),
+                _mm256_cmpeq_epi8(c, _mm256_loadu_si256((const __m256i *) (row_1 + i)))));
+    __m256i off = _mm256_cmpeq_epi8(_mm256_and_si256(c, on_bit), _mm256_setzero_si256());
+
+    // crosses unless all corners agree and none is on the isoline
+    return _mm256_andnot_si256(_mm256_and_si256(same, off), _mm256_set1_epi8(-1));
+}
+
+__attribute__((target("avx2")))
+static int candidate_cells_avx2(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int *cells) {
+    unsigned int mask;
+    int i, n = 0;
+
+    // column i+32 is read, so stop while it is still within end
+    for (i = first; i + 32 <= end; i += 32) {
+        mask = _mm256_movemask_epi8(_mm256_and_si256(
+                    crosses_avx2(a_0, a_1, i, 1), crosses_avx2(b_0, b_1, i, 1)));
+        while (mask) {
+            cells[n++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + candidate_cells_generic(a_0, a_1, b_0, b_1, i, end, cells + n);
+}
+
+__attribute__((target("avx2")))
+static int candidate_lanes_avx2(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int step,
+        int *cells) {
+    unsigned int mask;
+    int k, n = 0;
+
+    // element k+31+step is read, which is within the row while k+31 < end
+    for (k = first; k + 32 <= end; k += 32) {
+        mask = _mm256_movemask_epi8(_mm256_and_si256(
+                    crosses_avx2(a_0, a_1, k, step), crosses_avx2(b_0, b_1, k, step)));
+        while (mask) {
+            cells[n++] = k + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + candidate_lanes_generic(a_0, a_1, b_0, b_1, k, end, step, cells + n);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_avx2(const double *in, float *out, int n) {
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+        _mm_storeu_ps(out + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 4)));
+    }
+    convert_row_generic(in + i, out + i, n - i);
+}
+
+static const tip_kernels_t avx2_kernels = {
+    "avx2", classify_row_avx2, candidate_cells_avx2, candidate_lanes_avx2, convert_row_avx2
+};
+
+
+/* AVX-512: 16 floats or 64 classifications at a time */
+
+__attribute__((target("avx512f,avx512bw")))
+static void classify_row_avx512(const float *row, float isoline, unsigned char *classes, int n) {
+    const __m512 iso = _mm512_set1_ps(isoline);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 threshold = _mm512_set1_ps(on_threshold);
+    const __m512i above_bit = _mm512_set1_epi32(TIP_TRACER_ABOVE);
+    const __m512i on_bit = _mm512_set1_epi32(TIP_TRACER_ON);
+    __m512 value;
+    __m512i bits;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        value = _mm512_sub_ps(_mm512_loadu_ps(row + i), iso);
+        bits = _mm512_or_si512(
+                _mm512_maskz_mov_epi32(_mm512_cmp_ps_mask(value, zero, _CMP_GT_OQ), above_bit),
+                _mm512_maskz_mov_epi32(_mm512_cmp_ps_mask(_mm512_abs_ps(value), threshold, _CMP_LT_OQ), on_bit));
+        _mm_storeu_si128((__m128i *) (classes + i), _mm512_cvtepi32_epi8(bits));
+    }
+    classify_row_generic(row + i, isoline, classes + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static __mmask64 crosses_avx512(const unsigned char *row_0, const unsigned char *row_1, int i,
+        int step) {
+// bits set for the 64 cells from i the isoline may cross, each using
+// elements i and i+step
+    __m512i c = _mm512_loadu_si512(row_0 + i);
+    __mmask64 same = _mm512_cmpeq_epi8_mask(c, _mm512_loadu_si512(row_0 + i + step))
+        & _mm512_cmpeq_epi8_mask(c, _mm512_loadu_si512(row_1 + i + step))
+        & _mm512_cmpeq_epi8_mask(c, _mm512_loadu_si512(row_1 + i));
+    __mmask64 on = _mm512_test_epi8_mask(c, _mm512_set1_epi8(TIP_TRACER_ON));
+
+    return ~same | on;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int candidate_cells_avx512(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int *cells) {
+    unsigned long long mask;
+    int i, n = 0;
+
+    for (i = first; i + 64 <= end; i += 64) {
+        mask = crosses_avx512(a_0, a_1, i, 1) & crosses_avx512(b_0, b_1, i, 1);
+        while (mask) {
+            cells[n++] = i + __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + candidate_cells_generic(a_0, a_1, b_0, b_1, i, end, cells + n);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int candidate_lanes_avx512(const unsigned char *a_0, const unsigned char *a_1,
+        const unsigned char *b_0, const unsigned char *b_1, int first, int end, int step,
+        int *cells) {
+    unsigned long long mask;
+    int k, n = 0;
+
+    for (k = first; k + 64 <= end; k += 64) {
+        mask = crosses_avx512(a_0, a_1, k, step) & crosses_avx512(b_0, b_1, k, step);
+        while (mask) {
+            cells[n++] = k + __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + candidate_lanes_generic(a_0, a_1, b_0, b_1, k, end, step, cells + n);
+}
+
+__attribute__((target("avx512f")))
+static void convert_row_avx512(const double *in, float *out, int n) {
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(out + i, _mm512_cvtpd_ps(_mm512_loadu_pd(in + i)));
+        _mm256_storeu_ps(out + i + 8, _mm512_cvtpd_ps(_mm512_loadu_pd(in + i + 8)));
+    }
+    convert_row_generic(in + i, out + i, n - i);
+}
+
+static const tip_kernels_t avx512_kernels = {
+    "avx512", classify_row_avx512, candidate_cells_avx512, candidate_lanes_avx512,
+    convert_row_avx512
+};
+
+#endif // KERNELS_X86
+
+
+static const tip_kernels_t *selected = &generic_kernels;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void) {
+// picks the best variant the CPU supports, unless TIP_TRACE_ISA says otherwise
+    const tip_kernels_t *best = &generic_kernels, *requested = NULL;
+    const char *isa = getenv("TIP_TRACE_ISA");
+    int supported = 1;
+
+    on_threshold = (float) ON_TOLERANCE;
+    if ((double) on_threshold < ON_TOLERANCE) {
+        on_threshold = nextafterf(on_threshold, 1.0f);
+    }
+
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        best = &avx512_kernels;
+    } else if (__builtin_cpu_supports("avx2")) {
+        best = &avx2_kernels;
+    }
+#endif
+    selected = best;
+
+    if (!isa || !*isa) {
+        return;
+    }
+
+    if (0 == strcmp(isa, "generic")) {
+        requested = &generic_kernels;
+#ifdef KERNELS_X86
+    } else if (0 == strcmp(isa, "avx2")) {
+        requested = &avx2_kernels;
+        supported = (best != &generic_kernels);
+    } else if (0 == strcmp(isa, "avx512")) {
+        requested = &avx512_kernels;
+        supported = (best == &avx512_kernels);
+#endif
+    }
+
+    if (!requested) {
+        fprintf(stderr, "TIP_TRACE_ISA=%s isn't a known variant, using %s\n", isa, best->name);
+    } else if (!supported) {
+        fprintf(stderr, "TIP_TRACE_ISA=%s isn't supported by this CPU, using %s\n", isa, best->name);
+    } else {
+        selected = requested;
+    }
+}
+
+const tip_kernels_t * tip_kernels(void) {
+// returns the kernels for this CPU, choosing them on the first call
+    pthread_once(&select_once, select_kernels);
+    return selected;
+}
@@ -0,0 +1,48 @@
+/*
+ * kernels.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * The innermost loops of tip detection and frame conversion, built for
+ * several instruction sets.  One binary runs on every machine: the best
+ * variant the CPU supports is picked the first time tip_kernels() is called.
+ *
+ * The TIP_TRACE_ISA environment variable overrides the choice, for testing
+ * and for comparing variants: one of generic, avx2 or avx512.  A variant
+ * the CPU can't run is refused with a warning, and the best one used.
+ *
+ * Every variant gives bit for bit the same results as the generic C.
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+typedef struct tip_kernels {
+    const char *name;
+
+    void (*classify_row)(const float *row, float isoline, unsigned char *classes, int n);
+    // classifies n values against the isoline, as TIP_TRACER_ABOVE and/or
+    // TIP_TRACER_ON (see tip_tracer.h)
+
+    int (*candidate_cells)(const unsigned char *a_0, const unsigned char *a_1,
+            const unsigned char *b_0, const unsigned char *b_1,
+            int first, int end, int *cells);
+    // given the classifications of rows j (a_0, b_0) and j+1 (a_1, b_1) of
+    // two frames, stores in cells the index i of each cell first <= i < end
+    // that the isolines of both frames may cross, and returns how many there
+    // were.  Cell i uses columns i and i+1.
+
+    int (*candidate_lanes)(const unsigned char *a_0, const unsigned char *a_1,
+            const unsigned char *b_0, const unsigned char *b_1,
+            int first, int end, int step, int *cells);
+    // as candidate_cells, for rows of interleaved sheets (see tip_batch.h):
+    // cell k uses elements k and k+step
+
+    void (*convert_row)(const double *in, float *out, int n);
+    // converts n doubles to floats
+} tip_kernels_t;
+
+const tip_kernels_t * tip_kernels(void);
+// returns the kernels for this CPU, choosing them on the first call.
+// Thread safe.
+
+#endif // KERNELS_H
@@ -0,0 +1,154 @@
+/*
+ * merge_traces.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Joins the outputs of a run split into shards with core_trace --frames into
+ * one trace.  The shards may be given in any order; they are put in time
+ * order by their first record, and shards with no tips are skipped.  Records
+ * of overlapping shards that an earlier shard already covered are dropped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "helper.h"
+
+typedef struct shard {
+    const char *filename;
+    double first_time;
+    int order;
+} shard_t;
+
+static void print_help_text(char * progname);
+// help text output
+
+static int compare_shards(const void *a, const void *b) {
+// orders shards by their first time, then by position on the command line
+    const shard_t *s = a, *t = b;
+    if (s->first_time < t->first_time)
+        return -1;
+    if (s->first_time > t->first_time)
+        return 1;
+    return s->order - t->order;
+}
+
+int main (int argc, char ** argv) {
+    int c, n, nshards;
+    FILE *output, *input;
+    shard_t *shards;
+    char *line = NULL;
+    size_t line_size = 0;
+    double time, last_time = 0, shard_end;
+    int have_last = 0, shard_after;
+    long dropped;
+
+    output = stdout;
+
+    while (1)
+    {
+        static struct option long_options[] =
+        {
+            {"output",      required_argument, 0, 'o'},
+            {"help",        no_argument,       0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "o:h", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+            case 'o':
+                output = fopen(optarg, "w");
+                if (!output) {
+                    oops(optarg);
+                }
+                break;
+            case 'h':
+            case '?':
+                print_help_text(argv[0]);
+                break;
+            default:
+                abort ();
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "No shards given!\n");
+        print_help_text(argv[0]);
+    }
+
+    MALLOC(shards, (argc - optind)*sizeof(shard_t), "shard alloc failure");
+
+    // find the first time in each shard
+    nshards = 0;
+    for (n = optind; n < argc; ++n) {
+        input = fopen(argv[n], "r");
+        if (!input) {
+            oops(argv[n]);
+        }
+        if ((-1 != getline(&line, &line_size, input))
+                && (1 == sscanf(line, "%lf", &time))) {
+            shards[nshards].filename = argv[n];
+            shards[nshards].first_time = time;
+            shards[nshards].order = nshards;
+            ++nshards;
+        }
+        fclose(input);
+    }
+
+    qsort(shards, nshards, sizeof(shard_t), compare_shards);
+
+    // and copy them out in order.  Where shards overlap, the frames the
+    // earlier shards already covered are dropped, so each time is written
+    // once and in order.
+    for (n = 0; n < nshards; ++n) {
+        input = fopen(shards[n].filename, "r");
+        if (!input) {
+            oops(shards[n].filename);
+        }
+        shard_end = last_time;
+        shard_after = have_last;
+        dropped = 0;
+        while (-1 != getline(&line, &line_size, input)) {
+            if (1 == sscanf(line, "%lf", &time)) {
+                if (shard_after && (time <= shard_end)) {
+                    ++dropped;
+                    continue;
+                }
+                last_time = time;
+                have_last = 1;
+            }
+            fputs(line, output);
+        }
+        if (dropped) {
+            fprintf(stderr, "%s overlaps the previous shards; dropped %ld records up to time %f\n",
+                    shards[n].filename, dropped, shard_end);
+        }
+        fclose(input);
+    }
+
+    free(line);
+    free(shards);
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    return 0;
+} /* end of main() */
+
+void print_help_text(char * progname) {
+    fprintf(stderr, "Usage: %s [OPTIONS] SHARD [SHARD, ...]\n", progname);
+    fprintf(stderr, "Joins tip traces from core_trace --frames shards into a single trace...\n\n");
+    fprintf(stderr, "  -o FILE, --output FILE\n");
+    fprintf(stderr, "                 File to divert output to.  stdout otherwise.\n");
+    fprintf(stderr, "  -h, --help\n");
+    fprintf(stderr, "                 This help\n");
+    exit(EXIT_FAILURE);
+}
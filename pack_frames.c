@@ -0,0 +1,209 @@
+/*
+ * pack_frames.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Converts a list of per-frame files (binary float, binary double or text,
+ * optionally compressed) into a single frame archive.
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "tip_trace_binary.h"
+#include "frame_archive.h"
+#include "utils/string_list.h"
+#include "sheet_alloc.h"
+#include "helper.h"
+
+static void print_help_text(char * progname);
+// help text output
+
+int main (int argc, char ** argv) {
+    int c, file_set = 0;
+    int nx, ny, level, index;
+    float dt;
+    FILE *input;
+    char *output = NULL;
+    string_list_t *filenames;
+    file_type_t type, sample_type;
+    frame_archive_writer_t *writer;
+    float **sheet;
+    void *samples;
+    size_t size;
+    long length;
+
+    // set some defaults
+    nx = 375;
+    ny = 375;
+    dt = 1;
+    level = 1;
+    type = BINARY_FLOAT;
+    filenames = new_string_list();
+
+    while (1)
+    {
+        static struct option long_options[] =
+        {
+            {"x-dim",       required_argument, 0, 'x'},
+            {"y-dim",       required_argument, 0, 'y'},
+            {"timestep",    required_argument, 0, 't'},
+            {"file",        required_argument, 0, 'f'},
+            {"output",      required_argument, 0, 'o'},
+            {"type",        required_argument, 0, 'T'},
+            {"level",       required_argument, 0, 'l'},
+            {"help",        no_argument,       0, 'h'},
+            {0, 0, 0, 0}
+        };
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "x:y:t:f:o:T:l:h",
+                long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+            case 'x':
+                nx = atoi(optarg);
+                break;
+
+            case 'y':
+                ny = atoi(optarg);
+                break;
+
+            case 't':
+                dt = atof(optarg);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'l':
+                level = atoi(optarg);
+                break;
+
+            case 'T':
+                if (0==strcmp("float", optarg)) {
+                    type = BINARY_FLOAT;
+                    break;
+                }
+                if (0==strcmp("double", optarg)) {
+                    type = BINARY_DOUBLE;
+                    break;
+                }
+                if (0==strcmp("text", optarg)) {
+                    type = TEXT;
+                    break;
+                }
+                fprintf(stderr, "Unrecognised type.  Try float or double or text\n");
+                exit(EXIT_FAILURE);
+            case 'f':
+                if ((optarg[0] == '-') && (optarg[1] == 0)) {
+                    input = stdin;
+                    file_set = 1;
+                    break;
+                }
+                open(input, "r", optarg);
+                file_set = 1;
+                break;
+            case 'h':
+            case '?':
+                print_help_text(argv[0]);
+                break;
+
+            default:
+                abort ();
+        }
+    }
+
+    if (0 == file_set) {
+        while (optind < argc) {
+            string_list_push(filenames, argv[optind++]);
+        }
+    } else {
+        if (-1 == string_list_read(filenames, input)) {
+            oops("filename list");
+        }
+    }
+
+    if (!output) {
+        fprintf(stderr, "No output archive given!\n");
+        print_help_text(argv[0]);
+    }
+    if (string_list_length(filenames) < 1) {
+        fprintf(stderr, "No filenames found!\n");
+        print_help_text(argv[0]);
+    }
+
+    // text is parsed to floats; binary samples are stored at full precision
+    sample_type = (BINARY_DOUBLE == type) ? BINARY_DOUBLE : BINARY_FLOAT;
+    size = (size_t) nx * ny * ((BINARY_DOUBLE == type) ? sizeof(double) : sizeof(float));
+
+    writer = frame_archive_create(output, nx, ny, sample_type, dt, level);
+    if (!writer) {
+        exit(EXIT_FAILURE);
+    }
+
+    sheet = sheet_alloc_f(ny, nx, 0);
+    if (!sheet) {
+        oops("sheet alloc failure");
+    }
+    MALLOC(samples, size, "sample buffer alloc failure");
+
+    for (index = 0; index < string_list_length(filenames); ++index) {
+        const char *name = string_list_at(filenames, index);
+
+        if (TEXT == type) {
+            if (0 != read_file(TEXT, nx, ny, sheet, name)) {
+                exit(EXIT_FAILURE);
+            }
+            memcpy(samples, sheet[0], size);
+        } else {
+            // at full precision, in whatever compression read_file supports
+            length = read_file_raw(NULL, name, samples, size);
+            if ((length < 0) || ((size_t) length != size)) {
+                fprintf(stderr, "Problem reading %s (%ld/%zu bytes read)\n", name, length, size);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (0 != frame_archive_append(writer, samples)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (0 != frame_archive_finish(writer)) {
+        exit(EXIT_FAILURE);
+    }
+
+    free(samples);
+    sheet_free(sheet);
+    destroy_string_list(filenames);
+
+    return 0;
+} /* end of main() */
+
+void print_help_text(char * progname) {
+    fprintf(stderr, "Usage: %s [OPTIONS] -o ARCHIVE [FILE, FILE, ...]\n", progname);
+    fprintf(stderr, "Packs a list of frame files into a single seekable frame archive...\n\n");
+    fprintf(stderr, "  -x NX, --x-dim NX\n");
+    fprintf(stderr, "                 The x dimension of the sheet (defaults to 375)\n");
+    fprintf(stderr, "  -y NY, --y-dim NY\n");
+    fprintf(stderr, "                 The y dimension of the sheet (defaults to 375)\n");
+    fprintf(stderr, "  -t DT, --timestep DT\n");
+    fprintf(stderr, "                 The timestep between successive frames, stored in the archive (defaults to 1)\n");
+    fprintf(stderr, "  -o FILE, --output FILE\n");
+    fprintf(stderr, "                 The archive to create.\n");
+    fprintf(stderr, "  -f FILE, --file FILE\n");
+    fprintf(stderr, "                 File to read framelist from.  - for stdin.  argv otherwise\n");
+    fprintf(stderr, "  -T TYPE, --type TYPE\n");
+    fprintf(stderr, "                 Type of input files.  One of float (binary floats), double (binary doubles) or text (whitespace delimited text).  Defaults to float.\n");
+    fprintf(stderr, "  -l LEVEL, --level LEVEL\n");
+    fprintf(stderr, "                 zlib compression level for each frame, 0 to store uncompressed (defaults to 1)\n");
+    fprintf(stderr, "  -h, --help\n");
+    fprintf(stderr, "                 This help\n");
+    exit(EXIT_FAILURE);
+}
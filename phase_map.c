@@ -0,0 +1,467 @@
+/*
+ * phase_map.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "helper.h"
+#include "phase_map.h"
+#include "fft.h"
+#include "tip_trace.h"
+
+#define NUM_TIPS (20)
+
+// transposes are done in squares of this many pixels by frames
+#define TRANSPOSE_TILE (32)
+
+// the scratch file holds, for each block of pixels in turn, a tile for each
+// chunk of frames, every tile being pixel-major: tile (k, c) starts
+// k*block*frames + pixels(k)*c*chunk floats in
+typedef struct phase_layout {
+    int x;
+    int y;
+    long pixels;                // x*y
+    long frames;                // length of every pixel's series
+    long block;                 // pixels per block, bar the last
+    long nblocks;
+    long chunk;                 // frames per chunk, bar the last
+    long nchunks;
+    int fd;                     // the scratch file
+} phase_layout_t;
+
+typedef struct phase_job {
+    const phase_layout_t *layout;
+    int nthreads;
+    const fft_plan_t *plan;
+    const tip_mask_t *mask;
+    long c;                     // the chunk being transposed
+    long k;                     // the block being transformed
+    float *frames;              // chunk c, frame-major, or a block, pixel-major
+    float ***rows;              // rows of each frame of the chunk
+    float *tiles;               // chunk c's tiles, in block order
+    point_t *tips;              // NUM_TIPS for each frame of the chunk
+    int *ntips;
+} phase_job_t;
+
+typedef struct phase_worker {
+    pthread_t thread;
+    int id;
+    phase_job_t *job;
+    double *re;                 // hilbert_phase's work space
+    double *im;
+} phase_worker_t;
+
+static long block_pixels(const phase_layout_t *l, long k) {
+// the number of pixels in block k
+    return (k < l->nblocks - 1) ? l->block : l->pixels - k*l->block;
+}
+
+static long chunk_frames(const phase_layout_t *l, long c) {
+// the number of frames in chunk c
+    return (c < l->nchunks - 1) ? l->chunk : l->frames - c*l->chunk;
+}
+
+static off_t tile_offset(const phase_layout_t *l, long k, long c) {
+// where tile (k, c) starts in the scratch file, in bytes
+    return ((off_t) k*l->block*l->frames + (off_t) block_pixels(l, k)*c*l->chunk)
+        * (off_t) sizeof(float);
+}
+
+static long tiles_offset(const phase_layout_t *l, long k, long c) {
+// where tile (k, c) starts among chunk c's tiles, in floats
+    return k*l->block*chunk_frames(l, c);
+}
+
+static int transfer(int fd, void *buffer, size_t count, off_t offset, int writing) {
+// reads or writes all of count bytes at offset
+//
+// returns:
+//  0:  success
+//  <0: error
+    char *p = buffer;
+    ssize_t n;
+
+    while (count > 0) {
+        n = writing ? pwrite(fd, p, count, offset) : pread(fd, p, count, offset);
+        if (n < 0) {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == n) {
+            errno = EIO;
+            return -1;
+        }
+        p += n;
+        count -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void transpose(const float *from, long from_stride, float *to, long to_stride,
+        long rows, long cols) {
+// to[c*to_stride + r] = from[r*from_stride + c], a square at a time so both
+// sides stay in cache
+    long r0, c0, r, c, rend, cend;
+
+    for (r0 = 0; r0 < rows; r0 += TRANSPOSE_TILE) {
+        rend = (r0 + TRANSPOSE_TILE < rows) ? r0 + TRANSPOSE_TILE : rows;
+        for (c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE) {
+            cend = (c0 + TRANSPOSE_TILE < cols) ? c0 + TRANSPOSE_TILE : cols;
+            for (r = r0; r < rend; ++r) {
+                for (c = c0; c < cend; ++c) {
+                    to[c*to_stride + r] = from[r*from_stride + c];
+                }
+            }
+        }
+    }
+}
+
+static void * cut_tiles(void *arg) {
+// cuts the frame-major chunk into its tiles, a block at a time
+    phase_worker_t *w = arg;
+    phase_job_t *job = w->job;
+    const phase_layout_t *l = job->layout;
+    long k, nframes = chunk_frames(l, job->c);
+
+    for (k = w->id; k < l->nblocks; k += job->nthreads) {
+        transpose(job->frames + k*l->block, l->pixels,
+                job->tiles + tiles_offset(l, k, job->c), nframes,
+                nframes, block_pixels(l, k));
+    }
+    return NULL;
+}
+
+static void * join_tiles(void *arg) {
+// the reverse of cut_tiles
+    phase_worker_t *w = arg;
+    phase_job_t *job = w->job;
+    const phase_layout_t *l = job->layout;
+    long k, nframes = chunk_frames(l, job->c);
+
+    for (k = w->id; k < l->nblocks; k += job->nthreads) {
+        transpose(job->tiles + tiles_offset(l, k, job->c), nframes,
+                job->frames + k*l->block, l->pixels,
+                block_pixels(l, k), nframes);
+    }
+    return NULL;
+}
+
+static void * transform_block(void *arg) {
+// replaces every pixel series of the block with its phase
+    phase_worker_t *w = arg;
+    phase_job_t *job = w->job;
+    const phase_layout_t *l = job->layout;
+    long p, npixels = block_pixels(l, job->k);
+    float *series;
+
+    for (p = w->id; p < npixels; p += job->nthreads) {
+        series = job->frames + p*l->frames;
+        hilbert_phase(job->plan, series, l->frames, series, w->re, w->im);
+    }
+    return NULL;
+}
+
+static void * find_singularities(void *arg) {
+// searches each frame of the chunk for phase singularities
+    phase_worker_t *w = arg;
+    phase_job_t *job = w->job;
+    const phase_layout_t *l = job->layout;
+    long t, nframes = chunk_frames(l, job->c);
+
+    for (t = w->id; t < nframes; t += job->nthreads) {
+        job->ntips[t] = find_phase_singularities(l->x, l->y, job->rows[t], job->mask,
+                NUM_TIPS, job->tips + t*NUM_TIPS, NULL);
+    }
+    return NULL;
+}
+
+static void run_workers(phase_worker_t *workers, phase_job_t *job, void *(*work)(void *)) {
+// runs work on every worker, the first on this thread
+    int n;
+
+    for (n = 0; n < job->nthreads; ++n) {
+        workers[n].job = job;
+    }
+    for (n = 1; n < job->nthreads; ++n) {
+        if (0 != pthread_create(&workers[n].thread, NULL, work, &workers[n])) {
+            oops("phase worker");
+        }
+    }
+    work(&workers[0]);
+    for (n = 1; n < job->nthreads; ++n) {
+        pthread_join(workers[n].thread, NULL);
+    }
+}
+
+static int scratch_file(const char *directory) {
+// creates an anonymous scratch file in directory, $TMPDIR or /tmp
+    char *name;
+    int fd;
+
+    if (!directory)
+        directory = getenv("TMPDIR");
+    if (!directory || !directory[0])
+        directory = "/tmp";
+
+    MALLOC(name, strlen(directory) + 32, "scratch file");
+    sprintf(name, "%s/tiptrace-phase-XXXXXX", directory);
+    fd = mkstemp(name);
+    if (fd < 0) {
+        oops(name);
+    }
+    unlink(name);
+    free(name);
+    return fd;
+}
+
+static void plan_layout(phase_layout_t *l, long long memory, int nthreads, int length) {
+// sizes the chunks and blocks so that each pass fits in memory: a chunk and
+// its tiles for passes 1 and 3, a block, one of its tiles and each thread's
+// transform for pass 2
+    long long frame_bytes = (long long) l->pixels*sizeof(float);
+    long long transforms = (long long) nthreads*length*2*sizeof(double);
+    long long block;
+
+    l->chunk = memory/(2*frame_bytes);
+    if (l->chunk < 1)
+        l->chunk = 1;
+    if (l->chunk > l->frames)
+        l->chunk = l->frames;
+    l->nchunks = (l->frames + l->chunk - 1)/l->chunk;
+
+    block = (memory - transforms)/((long long) (l->frames + l->chunk)*sizeof(float));
+    if (block < 1)
+        block = 1;
+    if (block > l->pixels)
+        block = l->pixels;
+    l->block = block;
+    l->nblocks = (l->pixels + l->block - 1)/l->block;
+}
+
+static long long elapsed_ns(const struct timespec *since) {
+// nanoseconds since the given time
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - since->tv_sec)*1000000000LL + (ts.tv_nsec - since->tv_nsec);
+}
+
+static void transfer_tiles(phase_layout_t *l, long c, float *tiles, int writing) {
+// writes (or reads back) all of chunk c's tiles
+    long k;
+
+    for (k = 0; k < l->nblocks; ++k) {
+        if (0 != transfer(l->fd, tiles + tiles_offset(l, k, c),
+                    block_pixels(l, k)*chunk_frames(l, c)*sizeof(float),
+                    tile_offset(l, k, c), writing)) {
+            oops("phase scratch file");
+        }
+    }
+}
+
+static void transfer_block(phase_layout_t *l, long k, float *block, float *tile, int writing) {
+// writes (or reads) block k, pixel-major, through its tiles
+    long c, p, npixels = block_pixels(l, k), nframes;
+
+    for (c = 0; c < l->nchunks; ++c) {
+        nframes = chunk_frames(l, c);
+        if (!writing && (0 != transfer(l->fd, tile, npixels*nframes*sizeof(float),
+                        tile_offset(l, k, c), 0))) {
+            oops("phase scratch file");
+        }
+        for (p = 0; p < npixels; ++p) {
+            if (writing) {
+                memcpy(tile + p*nframes, block + p*l->frames + c*l->chunk,
+                        nframes*sizeof(float));
+            } else {
+                memcpy(block + p*l->frames + c*l->chunk, tile + p*nframes,
+                        nframes*sizeof(float));
+            }
+        }
+        if (writing && (0 != transfer(l->fd, tile, npixels*nframes*sizeof(float),
+                        tile_offset(l, k, c), 1))) {
+            oops("phase scratch file");
+        }
+    }
+}
+
+void process_phase(int x, int y, float dt, frame_list_t *list, file_type_t file_type,
+        FILE *output, const process_options_t *options) {
+// transposes the frames through the scratch file, transforms each pixel's
+// series to phase, and searches the phase of each frame for singularities
+    phase_layout_t layout;
+    phase_job_t job;
+    phase_worker_t *workers;
+    fft_plan_t *plan;
+    long first, end, c, k, t, index;
+    int n, nthreads, length, i, overflow;
+    float *tile, *held;
+    float x0 = 0.0, y0 = 0.0;
+
+    struct timespec frame_start;
+    unsigned long long bytes;
+    int read_error;
+
+    first = options->first_frame;
+    end = options->end_frame;
+    if ((end < 0) || (end > frame_list_length(list))) {
+        end = frame_list_length(list);
+    }
+    if (end <= first) {
+        return;
+    }
+
+    nthreads = (options->nthreads > 1) ? options->nthreads : 1;
+    memset(&layout, 0, sizeof(layout));
+    layout.x = x;
+    layout.y = y;
+    if (options->roi) {
+        layout.x = options->roi->x1 - options->roi->x0;
+        layout.y = options->roi->y1 - options->roi->y0;
+        x0 = options->roi->x0;
+        y0 = options->roi->y0;
+    }
+    layout.pixels = (long) layout.x*layout.y;
+    layout.frames = end - first;
+
+    length = fft_length(layout.frames);
+    plan = (length > 0) ? fft_plan_create(length) : NULL;
+    if (!plan) {
+        oops("phase transform");
+    }
+    plan_layout(&layout, options->phase_memory, nthreads, length);
+    layout.fd = scratch_file(options->scratch);
+
+    MALLOC(workers, nthreads*sizeof(phase_worker_t), "phase workers");
+    for (n = 0; n < nthreads; ++n) {
+        workers[n].id = n;
+        MALLOC(workers[n].re, length*sizeof(double), "phase workers");
+        MALLOC(workers[n].im, length*sizeof(double), "phase workers");
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.layout = &layout;
+    job.nthreads = nthreads;
+    job.plan = plan;
+    job.mask = options->mask;
+
+    // passes 1 and 3 hold a chunk, frame-major with rows for read_file, and
+    // its tiles
+    MALLOC(job.frames, layout.chunk*layout.pixels*sizeof(float), "phase chunk");
+    MALLOC(job.tiles, layout.chunk*layout.pixels*sizeof(float), "phase chunk");
+    MALLOC(job.rows, layout.chunk*sizeof(float **), "phase chunk");
+    for (t = 0; t < layout.chunk; ++t) {
+        MALLOC(job.rows[t], layout.y*sizeof(float *), "phase chunk");
+        for (i = 0; i < layout.y; ++i) {
+            job.rows[t][i] = job.frames + t*layout.pixels + (long) i*layout.x;
+        }
+    }
+
+    // pass 1: frames to tiles.  A frame that can't be read repeats the one
+    // before, rather than putting a step into every pixel's series.
+    held = calloc(layout.pixels, sizeof(float));
+    if (!held) {
+        oops("phase chunk");
+    }
+    for (c = 0; c < layout.nchunks; ++c) {
+        job.c = c;
+        for (t = 0; t < chunk_frames(&layout, c); ++t) {
+            clock_gettime(CLOCK_MONOTONIC, &frame_start);
+            bytes = read_file_bytes();
+            index = first + c*layout.chunk + t;
+            read_error = (0 != read_file_window(NULL, file_type, x, y, options->roi, job.rows[t],
+                        frame_list_at(list, index)));
+            if (read_error) {
+                fprintf(stderr, "Problem reading in %s\n", frame_list_at(list, index));
+                memcpy(job.rows[t][0], (t > 0) ? job.rows[t-1][0] : held,
+                        layout.pixels*sizeof(float));
+            }
+            telemetry_frame(options->telemetry, elapsed_ns(&frame_start),
+                    read_file_bytes() - bytes, read_error, 0);
+        }
+        run_workers(workers, &job, cut_tiles);
+        transfer_tiles(&layout, c, job.tiles, 1);
+
+        memcpy(held, job.rows[chunk_frames(&layout, c) - 1][0], layout.pixels*sizeof(float));
+    }
+
+    // pass 2: each block's series to phase
+    free(held);
+    free(job.tiles);
+    free(job.frames);
+    MALLOC(job.frames, layout.block*layout.frames*sizeof(float), "phase block");
+    MALLOC(tile, layout.block*layout.chunk*sizeof(float), "phase block");
+    for (k = 0; k < layout.nblocks; ++k) {
+        job.k = k;
+        transfer_block(&layout, k, job.frames, tile, 0);
+        run_workers(workers, &job, transform_block);
+        transfer_block(&layout, k, job.frames, tile, 1);
+    }
+    free(tile);
+    free(job.frames);
+
+    // pass 3: tiles back to frames, and their singularities
+    MALLOC(job.frames, layout.chunk*layout.pixels*sizeof(float), "phase chunk");
+    MALLOC(job.tiles, layout.chunk*layout.pixels*sizeof(float), "phase chunk");
+    MALLOC(job.tips, layout.chunk*NUM_TIPS*sizeof(point_t), "phase chunk");
+    MALLOC(job.ntips, layout.chunk*sizeof(int), "phase chunk");
+    for (t = 0; t < layout.chunk; ++t) {
+        for (i = 0; i < layout.y; ++i) {
+            job.rows[t][i] = job.frames + t*layout.pixels + (long) i*layout.x;
+        }
+    }
+    for (c = 0; c < layout.nchunks; ++c) {
+        job.c = c;
+        transfer_tiles(&layout, c, job.tiles, 0);
+        run_workers(workers, &job, join_tiles);
+        run_workers(workers, &job, find_singularities);
+
+        for (t = 0; t < chunk_frames(&layout, c); ++t) {
+            index = first + c*layout.chunk + t;
+            overflow = (job.ntips[t] < 0);
+            if (overflow) {
+                fprintf(stderr, "Too many tips in file %s (%d)\n",
+                        frame_list_at(list, index), job.ntips[t]);
+                continue;
+            }
+            // back into the whole sheet's coordinates
+            for (i = 0; i < job.ntips[t]; ++i) {
+                job.tips[t*NUM_TIPS + i].x += x0;
+                job.tips[t*NUM_TIPS + i].y += y0;
+            }
+            if (options->write_trace) {
+                for (i = 0; i < job.ntips[t]; ++i) {
+                    fprintf(output, "%f %f %f\n", frame_list_number(list, index)*dt,
+                            job.tips[t*NUM_TIPS + i].x, job.tips[t*NUM_TIPS + i].y);
+                }
+            }
+            if (options->stats) {
+                trajectory_stats_frame(options->stats, frame_list_number(list, index)*dt,
+                        job.tips + t*NUM_TIPS, job.ntips[t]);
+            }
+        }
+    }
+
+    close(layout.fd);
+    for (t = 0; t < layout.chunk; ++t) {
+        free(job.rows[t]);
+    }
+    free(job.rows);
+    free(job.frames);
+    free(job.tiles);
+    free(job.tips);
+    free(job.ntips);
+    for (n = 0; n < nthreads; ++n) {
+        free(workers[n].re);
+        free(workers[n].im);
+    }
+    free(workers);
+    fft_plan_destroy(plan);
+}
@@ -0,0 +1,40 @@
+/*
+ * phase_map.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Tip tracing by phase singularities, for single variable recordings where
+ * pairing each frame with the one before gives noisy tips.  Each pixel's
+ * phase is the argument of its analytic signal, from a Hilbert transform of
+ * its whole time series, and the tips of a frame are the points its phase
+ * winds around (find_phase_singularities).
+ *
+ * The transform needs each pixel's series in one piece, while the frames
+ * come one at a time, so the run is transposed through a scratch file in
+ * three passes, each within a memory budget:
+ *
+ *   1. chunks of frames are read and cut into tiles of a block of pixels by
+ *      the chunk's frames, written pixel-major;
+ *   2. each block of pixels is gathered from its tiles, every pixel's series
+ *      transformed to phase, and the tiles written back;
+ *   3. chunks of frames are gathered from the tiles again, and searched for
+ *      singularities.
+ *
+ * The scratch file (4 bytes per pixel per frame) lives in options->scratch,
+ * or $TMPDIR, or /tmp, and is deleted as soon as it is created.  Work within
+ * each pass is split between options->nthreads threads.
+ */
+
+#ifndef PHASE_MAP_H
+#define PHASE_MAP_H
+
+#include "tip_trace_binary.h"
+
+void process_phase(int x, int y, float dt, frame_list_t *list, file_type_t file_type,
+        FILE *output, const process_options_t *options);
+// as process_file_list, but with tips found as phase singularities.  Only
+// frames first_frame up to end_frame are transformed, so sharding changes the
+// result near the shard boundaries.  The output has the same format; the
+// trace and trajectory summaries are written, checkpoints and the other
+// per-frame outputs aren't.  Exits on failure.
+
+#endif // PHASE_MAP_H
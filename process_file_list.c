@@ -7,17 +7,301 @@
 #include "tip_trace_binary.h"
 #include "helper.h"
 
+#include <limits.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
 #include <zlib.h>
 
 #include "helper.h"
 #include "tip_trace.h"
-#include "utils/string_list.h"
+#include "tip_tracer.h"
+#include "tip_batch.h"
+#include "frame_bus.h"
+#include "frame_cache.h"
+#include "sheet_alloc.h"
+#include "utils/frame_list.h"
 
 #define NUM_TIPS (20)
 
-void process_file_list(int x, int y, float dt, float isoline, string_list_t *list,
-        file_type_t file_type, FILE *output) {
+void default_process_options(process_options_t *options) {
+// fills in options to process every frame, without checkpoints
+    options->first_frame = 0;
+    options->end_frame = -1;
+    options->checkpoint = NULL;
+    options->checkpoint_every = 1000;
+    options->telemetry = NULL;
+    options->stats = NULL;
+    options->write_trace = 1;
+    options->nthreads = 1;
+    options->contours = NULL;
+    options->activation = NULL;
+    options->activation_every = 0;
+    options->cache = NULL;
+    options->mask = NULL;
+    options->stride = 1;
+    options->refine_distance = 1.0;
+    options->phase_memory = 256LL << 20;
+    options->scratch = NULL;
+    options->roi = NULL;
+    options->serve_memory = 1024LL << 20;
+    options->serve_workers = 4;
+    options->quantise = 0;
+}
+
+static long long elapsed_ns(const struct timespec *since) {
+// nanoseconds since the given time
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - since->tv_sec)*1000000000LL + (ts.tv_nsec - since->tv_nsec);
+}
+
+static void write_contours(FILE *output, float time, const contours_t *c) {
+// writes the isoline fronts of a frame: a summary line, then each front's
+// summary and points, separated by blank lines so they plot as lines
+    const contour_front_t *front;
+    int n, p;
+
+    fprintf(output, "# frame %f %d %f\n", time, c->nfronts, c->length);
+    for (n = 0; n < c->nfronts; ++n) {
+        front = &c->fronts[n];
+        fprintf(output, "# front %d %d %f %s\n", n, front->npoints, front->length,
+                front->closed ? "closed" : "open");
+        for (p = front->first_point; p < front->first_point + front->npoints; ++p) {
+            fprintf(output, "%f %f\n", c->points[p].x, c->points[p].y);
+        }
+        fprintf(output, "\n");
+    }
+}
+
+static int report_tips(FILE *output, const process_options_t *options, float time,
+        const point_t *tips, int ntips, tip_tracer_t *tracer, const char *filename) {
+// writes out the tips of a frame, and everything else derived from them
+//
+// returns:
+//  0:  success
+//  1:  too many tips
+    int i;
+
+    if (ntips < 0) {
+        fprintf(stderr, "Too many tips in file %s (%d)\n", filename, ntips);
+        return 1;
+    }
+
+    // if we have tips, output them!
+    if (options->write_trace) {
+        for (i = 0; i < ntips; ++i) {
+            fprintf(output, "%f %f %f\n", time, tips[i].x, tips[i].y);
+        }
+    }
+    if (options->stats) {
+        trajectory_stats_frame(options->stats, time, tips, ntips);
+    }
+    if (options->contours) {
+        write_contours(options->contours, time, tip_tracer_get_contours(tracer));
+    }
+    return 0;
+}
+
+static void checkpoint(const process_options_t *options, long frame, FILE *output) {
+// flushes the output and records that frame is the last one written
+    fflush(output);
+    if (0 != write_checkpoint(options->checkpoint, frame, ftell(output))) {
+        fprintf(stderr, "Problem writing checkpoint %s\n", options->checkpoint);
+    }
+}
+
+typedef struct frame_progress {
+    struct timespec start;      // when the frame being traced was started
+    unsigned long long bytes;   // read_file_bytes() then
+    long since_checkpoint;      // frames finished since the last checkpoint
+} frame_progress_t;
+
+static void begin_frame(frame_progress_t *p) {
+// notes the start of a frame, for telemetry
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->bytes = read_file_bytes();
+}
+
+static void end_frame(frame_progress_t *p, const process_options_t *options,
+        int read_error, int overflow) {
+// reports a finished frame to telemetry, and counts it towards the next
+// checkpoint
+    telemetry_frame(options->telemetry, elapsed_ns(&p->start),
+            read_file_bytes() - p->bytes, read_error, overflow);
+    p->since_checkpoint++;
+}
+
+static void checkpoint_if_due(frame_progress_t *p, const process_options_t *options,
+        long frame, FILE *output) {
+// checkpoints at frame, every frame of which has been written, once
+// checkpoint_every frames have finished since the last one
+    if (options->checkpoint && (p->since_checkpoint >= options->checkpoint_every)) {
+        checkpoint(options, frame, output);
+        p->since_checkpoint = 0;
+    }
+}
+
+static int needs_refining(const point_t *before, int nbefore, const point_t *after,
+        int nafter, float distance) {
+// whether the tips of two samples differ by more than tip motion: a tip born
+// or lost, or one that has moved further than distance.  Tips are matched
+// greedily, each to the nearest tip of the later sample not yet taken.
+    unsigned char taken[NUM_TIPS];
+    int i, j, nearest;
+    float d2, best;
+
+    if ((nbefore < 0) || (nafter < 0) || (nbefore != nafter)) {
+        return 1;
+    }
+
+    memset(taken, 0, sizeof(taken));
+    for (i = 0; i < nbefore; ++i) {
+        nearest = -1;
+        best = distance*distance;
+        for (j = 0; j < nafter; ++j) {
+            if (taken[j])
+                continue;
+            d2 = (after[j].x - before[i].x)*(after[j].x - before[i].x)
+                + (after[j].y - before[i].y)*(after[j].y - before[i].y);
+            if (d2 <= best) {
+                best = d2;
+                nearest = j;
+            }
+        }
+        if (nearest < 0) {
+            return 1;
+        }
+        taken[nearest] = 1;
+    }
+    return 0;
+}
+
+static void copy_frame(int x, int y, float **to, float **from) {
+// copies frame from[y][x] row by row, as either may be padded
+    int j;
+
+    for (j = 0; j < y; ++j) {
+        memcpy(to[j], from[j], x*sizeof(float));
+    }
+}
+
+static int trace_frame(int x, int y, file_type_t file_type, const sheet_window_t *window,
+        frame_list_t *list, long index, tip_tracer_t *tracer, const point_t **tips) {
+// reads frame index into the tracer, paired with the last frame pushed
+//
+// returns:
+//  as tip_tracer_push_frame, or INT_MIN if the frame couldn't be read
+    const char *filename = frame_list_at(list, index);
+    float **E = tip_tracer_next_frame(tracer);
+
+    if (0 != read_file_window(NULL, file_type, x, y, window, E, filename)) {
+        fprintf(stderr, "Problem reading in %s\n", filename);
+        return INT_MIN;
+    }
+    tip_tracer_push_frame(tracer, E);
+    return tip_tracer_get_tips(tracer, tips);
+}
+
+static void process_adaptive(int x, int y, float dt, frame_list_t *list,
+        file_type_t file_type, FILE *output, const process_options_t *options,
+        tip_tracer_t *tracer, long first, long end) {
+// traces frames first to end - 1 at a stride of options->stride, pairing each
+// sample with the one before it, and going back over the frames in between
+// at full rate wherever the tips of consecutive samples disagree (a tip born
+// or lost, or moved more than options->refine_distance).  The first and last
+// frames are always sampled.
+    long stride = options->stride;
+    long sample, previous_sample = -1, index;
+
+    // the previous sample, to pair the first frame in between with when
+    // refining, and the sample itself, so it needn't be decoded again
+    float **anchor, **latest;
+
+    point_t sample_tips[NUM_TIPS];
+    int nsample_tips = 0, ntips, refine, overflow;
+    const point_t *tips;
+
+    frame_progress_t progress = {{0, 0}, 0, 0};
+
+    anchor = sheet_alloc_f(tracer->y, tracer->x, SHEET_PAD);
+    latest = sheet_alloc_f(tracer->y, tracer->x, SHEET_PAD);
+    if (!anchor || !latest) {
+        oops("adaptive sampling");
+    }
+
+    // starting part way through, the first frame is paired with the one before
+    if (first > 0) {
+        trace_frame(x, y, file_type, options->roi, list, first - 1, tracer, &tips);
+    }
+
+    for (sample = first; sample < end; ) {
+        begin_frame(&progress);
+
+        if (previous_sample >= 0) {
+            copy_frame(tracer->x, tracer->y, anchor, tip_tracer_frame(tracer, 0));
+        }
+
+        ntips = trace_frame(x, y, file_type, options->roi, list, sample, tracer, &tips);
+        end_frame(&progress, options, INT_MIN == ntips, ntips < 0 && INT_MIN != ntips);
+
+        if (INT_MIN != ntips) {
+            refine = (previous_sample >= 0) && (sample - previous_sample > 1)
+                && needs_refining(sample_tips, nsample_tips, tips, ntips,
+                        options->refine_distance);
+
+            if (refine) {
+                // go back to the previous sample, and trace every frame since
+                copy_frame(tracer->x, tracer->y, latest, tip_tracer_frame(tracer, 0));
+                tip_tracer_push_frame(tracer, anchor);
+
+                for (index = previous_sample + 1; index <= sample; ++index) {
+                    begin_frame(&progress);
+                    if (index < sample) {
+                        ntips = trace_frame(x, y, file_type, options->roi, list, index,
+                                tracer, &tips);
+                    } else {
+                        tip_tracer_push_frame(tracer, latest);
+                        ntips = tip_tracer_get_tips(tracer, &tips);
+                    }
+                    overflow = 0;
+                    if (INT_MIN != ntips) {
+                        overflow = report_tips(output, options,
+                                frame_list_number(list, index) * dt, tips, ntips, tracer,
+                                frame_list_at(list, index));
+                    }
+                    if (index < sample) {
+                        // the sample itself was counted when it was traced
+                        end_frame(&progress, options, INT_MIN == ntips, overflow);
+                    }
+                }
+            } else {
+                report_tips(output, options, frame_list_number(list, sample) * dt, tips, ntips,
+                        tracer, frame_list_at(list, sample));
+            }
+
+            nsample_tips = ntips;
+            if (ntips > 0) {
+                memcpy(sample_tips, tips, ((ntips < NUM_TIPS) ? ntips : NUM_TIPS)*sizeof(point_t));
+            }
+            previous_sample = sample;
+        }
+
+        checkpoint_if_due(&progress, options, sample, output);
+
+        if ((sample < end - 1) && (sample + stride >= end)) {
+            sample = end - 1;
+        } else {
+            sample += stride;
+        }
+    }
+
+    sheet_free(anchor);
+    sheet_free(latest);
+}
+
+void process_file_list(int x, int y, float dt, float isoline, frame_list_t *list,
+        file_type_t file_type, FILE *output, const process_options_t *options) {
 // given the dimensions of the tissue and a list of filenames, process each one
 // in turn, printing the tip trace to the give output file.
 //
@@ -29,65 +313,400 @@ void process_file_list(int x, int y, float dt, float isoline, string_list_t *lis
 //  list:       list of filenames to process
 //  file_type:  Type of files in the list
 //  output:     file pointer to output too.
+//  options:    frame range and checkpointing, NULL for the defaults
 
-    int i, j, ntips;
+    int ntips;
 
     float time;
 
     // the current file we're looking at.
-    int index;
+    long index;
+    const char *filename;
+
+    // the frames we're responsible for
+    process_options_t defaults;
+    long first, end;
+
+    // progress reporting
+    frame_progress_t progress = {{0, 0}, 0, 0};
+    int read_error, overflow;
 
-    // arrays to hold the sheets to be set
+    // the tracer holds the current and previous sheets
+    tip_tracer_t *tracer;
     float ** E;
-    float ** GH;
+    const point_t *tips;
 
-    point_t tips[NUM_TIPS];
+    // the frame before, for activation maps
+    int have_previous = 0;
+    double previous_time = 0.0;
 
+    // cached results.  latest is the index of the last frame pushed into
+    // the tracer, and need_previous is set when that isn't the one before
+    // the next frame to be read.
+    point_t cached_tips[NUM_TIPS];
+    char *previous;
+    int use_cache, cacheable, need_previous;
+    long latest = -1;
 
-    // allocate our arrays
-    F_ARRAY_2D(E, y, x);
-    F_ARRAY_2D(GH, y, x);
+    if (!options) {
+        default_process_options(&defaults);
+        options = &defaults;
+    }
+    first = options->first_frame;
+    end = options->end_frame;
+    if ((end < 0) || (end > frame_list_length(list))) {
+        end = frame_list_length(list);
+    }
 
+    // only the window is traced, tips being placed back in the whole sheet
+    if (options->roi) {
+        tracer = tip_tracer_create(options->roi->x1 - options->roi->x0,
+                options->roi->y1 - options->roi->y0);
+        if (tracer) {
+            tip_tracer_set_origin(tracer, options->roi->x0, options->roi->y0);
+        }
+    } else {
+        tracer = tip_tracer_create(x, y);
+    }
+    if (!tracer || (0 != tip_tracer_configure(tracer, isoline, isoline, NUM_TIPS, options->nthreads))) {
+        oops("tip tracer");
+    }
+    if (options->contours) {
+        tip_tracer_set_contours(tracer, 1);
+    }
+    if (0 != tip_tracer_set_mask(tracer, options->mask)) {
+        fprintf(stderr, "The mask is for a different size of sheet\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // zero the arrays involved
-    for (j = 0; j < y; ++j) {
-        for (i = 0; i < x; ++i) {
-            E[j][i] = 0.0;
+    if (options->stride > 1) {
+        process_adaptive(x, y, dt, list, file_type, output, options, tracer, first, end);
+        if (options->checkpoint && end > first) {
+            checkpoint(options, end - 1, output);
         }
+        tip_tracer_destroy(tracer);
+        return;
     }
 
+    // frames found in the cache aren't decoded at all, so it's only used
+    // when nothing else needs the frames themselves
+    use_cache = options->cache && !options->contours && !options->activation;
+
+    // starting part way through, frame first is paired with the one before,
+    // which is read when first needed
+    need_previous = (first > 0);
+
     // loop over all the files
-    for (index = 0; index < string_list_length(list); ++index) {
+    for (index = first; index < end; ++index) {
+        begin_frame(&progress);
+        read_error = overflow = 0;
+        ntips = 0;
 
-        // copy E into GH
-        for (j = 0; j < y; ++j) {
-            for (i = 0; i < x; ++i) {
-                GH[j][i] = E[j][i];
+        cacheable = 0;
+        if (use_cache) {
+            // pattern lists reuse their name buffer, so keep a copy
+            previous = (index > 0) ? strdup(frame_list_at(list, index - 1)) : NULL;
+            if ((0 == index) || previous) {
+                cacheable = (0 == frame_cache_select(options->cache,
+                            frame_list_at(list, index), previous));
             }
+            free(previous);
         }
 
-        // read in file.
-        if (0 == read_file(file_type, x, y, E, string_list_at(list, index))) {
-            // calculate tip traces
-            ntips = find_tips(x, y, E, isoline, GH, isoline, NUM_TIPS, tips);
-            time = index * dt;
-            if (ntips > -1) {
-                // if we have tips, output them!
-                for (i = 0; i < ntips; ++i) {
-                    fprintf(output, "%f %f %f\n", time, tips[i].x, tips[i].y);
+        if (use_cache && cacheable
+                && (0 == frame_cache_lookup(options->cache, cached_tips, NUM_TIPS, &ntips))) {
+            tips = cached_tips;
+            // the tracer no longer holds the frame before the next one
+            need_previous = 1;
+        } else {
+            if (need_previous) {
+                filename = frame_list_at(list, index - 1);
+                E = tip_tracer_next_frame(tracer);
+                if (0 == read_file_window(NULL, file_type, x, y, options->roi, E, filename)) {
+                    tip_tracer_push_frame(tracer, E);
+                    latest = index - 1;
+                    have_previous = 1;
+                    previous_time = frame_list_number(list, index - 1) * (double) dt;
+                } else {
+                    fprintf(stderr, "Problem reading in %s\n", filename);
                 }
+                need_previous = 0;
+            }
+
+            // read in file, straight into the tracer's next sheet.  If this
+            // fails, the next frame is paired with the last one read.
+            filename = frame_list_at(list, index);
+            E = tip_tracer_next_frame(tracer);
+            if (0 == read_file_window(NULL, file_type, x, y, options->roi, E, filename)) {
+                // calculate tip traces
+                tip_tracer_push_frame(tracer, E);
+                ntips = tip_tracer_get_tips(tracer, &tips);
+
+                // results are only cached for frames properly paired
+                if (cacheable && (latest == index - 1)
+                        && (0 != frame_cache_store(options->cache, tips, ntips, NUM_TIPS))) {
+                    fprintf(stderr, "Problem caching %s\n", filename);
+                }
+                latest = index;
             } else {
-                fprintf(stderr, "Too many tips in file %s (%d)\n", string_list_at(list, index), ntips);
+                fprintf(stderr, "Problem reading in %s\n", filename);
+                read_error = 1;
             }
-        } else {
-            fprintf(stderr, "Problem reading in %s\n"
-                    , string_list_at(list, index));
+        }
 
+        if (!read_error) {
+            time = frame_list_number(list, index) * dt;
+            overflow = report_tips(output, options, time, tips, ntips, tracer,
+                    frame_list_at(list, index));
+            if (options->activation) {
+                if (have_previous) {
+                    activation_map_frame(options->activation, tip_tracer_frame(tracer, 1),
+                            previous_time, E, frame_list_number(list, index) * (double) dt);
+                }
+                have_previous = 1;
+                previous_time = frame_list_number(list, index) * (double) dt;
+            }
+        }
+
+        end_frame(&progress, options, read_error, overflow);
+        checkpoint_if_due(&progress, options, index, output);
+        if (options->activation && (options->activation_every > 0)
+                && (0 == (index + 1 - first) % options->activation_every)) {
+            if (0 != write_activation_map(options->activation)) {
+                fprintf(stderr, "Problem writing activation map %s\n", options->activation->filename);
+            }
         }
+    }
 
+    if (options->activation && (0 != write_activation_map(options->activation))) {
+        fprintf(stderr, "Problem writing activation map %s\n", options->activation->filename);
     }
 
+    if (options->checkpoint && end > first) {
+        checkpoint(options, end - 1, output);
+    }
+
+    tip_tracer_destroy(tracer);
+
     return;
 }
 
 
+
+void publish_file_list(int x, int y, frame_list_t *list, file_type_t file_type,
+        struct frame_bus *bus, const process_options_t *options) {
+// reads each frame in turn straight into the bus's next slot, and publishes
+// it.  Frames that can't be read aren't published, so consumers pair the
+// next frame with the last one that was.
+    process_options_t defaults;
+    long index, first, end;
+    const char *filename;
+    float **E;
+
+    frame_progress_t progress = {{0, 0}, 0, 0};
+    int read_error;
+
+    if (!options) {
+        default_process_options(&defaults);
+        options = &defaults;
+    }
+    first = options->first_frame;
+    end = options->end_frame;
+    if ((end < 0) || (end > frame_list_length(list))) {
+        end = frame_list_length(list);
+    }
+
+    for (index = first; index < end; ++index) {
+        begin_frame(&progress);
+        read_error = 0;
+
+        filename = frame_list_at(list, index);
+        E = frame_bus_next_slot(bus);
+        if (0 == read_file(file_type, x, y, E, filename)) {
+            frame_bus_publish(bus, frame_list_number(list, index));
+        } else {
+            fprintf(stderr, "Problem reading in %s\n", filename);
+            read_error = 1;
+        }
+
+        end_frame(&progress, options, read_error, 0);
+    }
+}
+
+long process_frame_bus(float dt, float isoline, struct frame_bus *bus, FILE *output,
+        const process_options_t *options) {
+// traces the frames published on a bus, as process_file_list does a list.
+// Each frame is copied into the tracer and released before its tips are
+// reported, so the producer is only held up for the search itself.
+    process_options_t defaults;
+    frame_bus_frame_t frame;
+    tip_tracer_t *tracer;
+    const point_t *tips;
+    char name[64];
+    int x, y, ntips, status, overflow;
+    long frames = 0;
+
+    struct timespec frame_start;
+    int have_previous = 0;
+    double previous_time = 0.0;
+
+    if (!options) {
+        default_process_options(&defaults);
+        options = &defaults;
+    }
+    frame_bus_dimensions(bus, &x, &y);
+
+    tracer = tip_tracer_create(x, y);
+    if (!tracer || (0 != tip_tracer_configure(tracer, isoline, isoline, NUM_TIPS, options->nthreads))) {
+        oops("tip tracer");
+    }
+    if (options->contours) {
+        tip_tracer_set_contours(tracer, 1);
+    }
+    if (0 != tip_tracer_set_mask(tracer, options->mask)) {
+        fprintf(stderr, "The mask is for a different size of sheet\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (0 == (status = frame_bus_acquire(bus, &frame))) {
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+
+        ntips = tip_tracer_push_frame(tracer, frame.sheet);
+        frame_bus_release(bus, &frame);
+        frames++;
+        tip_tracer_get_tips(tracer, &tips);
+
+        snprintf(name, sizeof(name), "frame %ld", frame.index);
+        overflow = report_tips(output, options, frame.index * dt, tips, ntips, tracer, name);
+        if (options->activation) {
+            if (have_previous) {
+                activation_map_frame(options->activation, tip_tracer_frame(tracer, 1),
+                        previous_time, tip_tracer_frame(tracer, 0), frame.index * (double) dt);
+            }
+            have_previous = 1;
+            previous_time = frame.index * (double) dt;
+        }
+
+        telemetry_frame(options->telemetry, elapsed_ns(&frame_start), 0, 0, overflow);
+
+        if (options->activation && (options->activation_every > 0)
+                && (0 == (frame.sequence + 1) % options->activation_every)) {
+            if (0 != write_activation_map(options->activation)) {
+                fprintf(stderr, "Problem writing activation map %s\n", options->activation->filename);
+            }
+        }
+    }
+    if (status < 0) {
+        fprintf(stderr, "Problem reading from the frame bus\n");
+    }
+
+    if (options->activation && (0 != write_activation_map(options->activation))) {
+        fprintf(stderr, "Problem writing activation map %s\n", options->activation->filename);
+    }
+
+    tip_tracer_destroy(tracer);
+    return (status < 0) ? status : frames;
+}
+
+static int read_members(int x, int y, frame_list_t **members, int nmembers, long index,
+        file_type_t file_type, tip_batch_t *batch, float **sheet, unsigned char *failed) {
+// reads frame index of every member into the batch's next frame.  A member
+// whose frame can't be read repeats its last one, and is marked failed.
+//
+// returns:
+//  the number of members read
+    float *latest = batch->frames[batch->current];
+    float *E = tip_batch_next_frame(batch);
+    const char *filename;
+    size_t v, n = (size_t) x*y;
+    int m, read = 0;
+
+    for (m = 0; m < nmembers; ++m) {
+        filename = frame_list_at(members[m], index);
+        failed[m] = (0 != read_file(file_type, x, y, sheet, filename));
+        if (failed[m]) {
+            fprintf(stderr, "Problem reading in %s\n", filename);
+            for (v = 0; v < n; ++v) {
+                E[v*nmembers + m] = latest[v*nmembers + m];
+            }
+        } else {
+            tip_batch_set_member(batch, E, m, sheet);
+            read++;
+        }
+    }
+    return read;
+}
+
+void process_ensemble(int x, int y, float dt, float isoline, frame_list_t **members,
+        const long *member_ids, int nmembers, file_type_t file_type, FILE *output,
+        const process_options_t *options) {
+// traces the same frames of every member of an ensemble together, through a
+// tip_batch_t, writing each tip tagged with its member
+    process_options_t defaults;
+    tip_batch_t *batch;
+    unsigned char *failed;
+    const point_t *tips;
+    float **sheet;
+    long index, first, end;
+    int m, i, ntips, read, overflow;
+
+    frame_progress_t progress = {{0, 0}, 0, 0};
+
+    if (!options) {
+        default_process_options(&defaults);
+        options = &defaults;
+    }
+    first = options->first_frame;
+    end = options->end_frame;
+    if ((end < 0) || (end > frame_list_length(members[0]))) {
+        end = frame_list_length(members[0]);
+    }
+
+    batch = tip_batch_create(x, y, nmembers, NUM_TIPS);
+    if (!batch) {
+        oops("tip batch");
+    }
+    tip_batch_configure(batch, isoline, isoline);
+    sheet = sheet_alloc_f(y, x, 0);
+    MALLOC(failed, nmembers, "ensemble");
+    if (!sheet) {
+        oops("ensemble");
+    }
+
+    // as with a shard, frame first is paired with the frame before it
+    if (first > 0) {
+        read_members(x, y, members, nmembers, first - 1, file_type, batch, sheet, failed);
+        tip_batch_push_frame(batch, tip_batch_next_frame(batch));
+    }
+
+    for (index = first; index < end; ++index) {
+        begin_frame(&progress);
+
+        read = read_members(x, y, members, nmembers, index, file_type, batch, sheet, failed);
+        tip_batch_push_frame(batch, tip_batch_next_frame(batch));
+
+        overflow = 0;
+        for (m = 0; m < nmembers; ++m) {
+            if (failed[m])
+                continue;
+            ntips = tip_batch_get_tips(batch, m, &tips);
+            if (ntips < 0) {
+                fprintf(stderr, "Too many tips in %s (%d)\n", frame_list_at(members[m], index), ntips);
+                overflow = 1;
+                continue;
+            }
+            if (options->write_trace) {
+                for (i = 0; i < ntips; ++i) {
+                    fprintf(output, "%f %ld %f %f\n", frame_list_number(members[0], index) * dt,
+                            member_ids[m], tips[i].x, tips[i].y);
+                }
+            }
+        }
+
+        end_frame(&progress, options, read < nmembers, overflow);
+    }
+
+    free(failed);
+    sheet_free(sheet);
+    tip_batch_destroy(batch);
+}
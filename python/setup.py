@@ -0,0 +1,37 @@
+# setup.py
+# Jonathan D. Stott <jonathan.stott@gmail.com>
+#
+# Builds the tiptrace Python module from the library and reader sources:
+#
+#   python3 setup.py build_ext --inplace
+#
+# or "make python" from the top directory.
+
+import os
+from setuptools import setup, Extension
+
+top = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+sources = [
+    # the library
+    "find_tips.c", "find_isoline.c", "calculate_tip_coordinates.c", "tip_tracer.c",
+    "sheet_alloc.c", "kernels.c", "contours.c", "fixed_kernels.c", "tip_mask.c",
+    # the readers
+    "read_file.c", "decompress.c", "frame_archive.c", "frame_file.c",
+]
+
+setup(
+    name="tiptrace",
+    version="1.0",
+    description="Spiral wave tip tracing",
+    ext_modules=[
+        Extension(
+            "tiptrace",
+            sources=["tiptrace.c"] + [os.path.relpath(os.path.join(top, s)) for s in sources],
+            include_dirs=[top],
+            libraries=["z", "m"],
+            extra_compile_args=["-pthread", "-O2"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)
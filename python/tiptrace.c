@@ -0,0 +1,537 @@
+/*
+ * tiptrace.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Python bindings for the tip trace library, so analysis in Python needn't
+ * run core_trace and parse its output.
+ *
+ *   tips = tiptrace.find_tips(sheet_1, sheet_2, isoline_1=-30, isoline_2=None)
+ *
+ * takes any two C-contiguous 2D float32 or float64 buffers (NumPy arrays,
+ * memoryviews...) of the same shape.  float32 sheets are searched in place,
+ * float64 ones are converted to float32 first, as core_trace does.
+ *
+ *   for time, tips in tiptrace.trace_files(filenames, x=None, y=None,
+ *           isoline=-30, type="float", dt=None, threads=1, roi=None,
+ *           max_tips=1024):
+ *
+ * reads and traces each file in turn, as core_trace does, the first frame
+ * paired with an all zero frame.  type is one of float, double, text,
+ * archive, npy or igb.  Archives, .npy and IGB files give the sheet size,
+ * and the timestep, in their headers, so x, y and dt may be left out for
+ * them; otherwise x and y are needed and dt defaults to 1.  roi,
+ * (x0, x1, y0, y1), limits reading and tracing to a window, tips still being
+ * in whole sheet coordinates.  A file that can't be read gives a
+ * RuntimeWarning and is skipped.  An iterator is used by one thread at a
+ * time.
+ *
+ * Tips are returned as (n, 2) float32 NumPy arrays of x, y, or lists of
+ * (x, y) tuples if NumPy can't be imported.  The GIL is released while
+ * frames are read and searched, so searches on several Python threads run
+ * at once, and each trace_files iterator reads with its own buffers, so
+ * iterators on several threads decode at once too.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "tip_trace.h"
+#include "tip_trace_binary.h"
+#include "tip_tracer.h"
+#include "kernels.h"
+#include "sheet_alloc.h"
+#include "frame_archive.h"
+#include "frame_file.h"
+
+static PyObject * tips_to_python(const point_t *tips, int ntips) {
+// the tips as an (ntips, 2) float32 NumPy array, viewing a copy of them, or
+// a list of (x, y) tuples without NumPy
+    static PyObject *numpy = NULL;
+    PyObject *buffer, *flat, *result;
+    int n;
+
+    if (!numpy) {
+        numpy = PyImport_ImportModule("numpy");
+        if (!numpy) {
+            PyErr_Clear();
+            numpy = Py_None;
+            Py_INCREF(numpy);
+        }
+    }
+
+    if (numpy == Py_None) {
+        result = PyList_New(ntips);
+        for (n = 0; result && (n < ntips); ++n) {
+            PyList_SET_ITEM(result, n, Py_BuildValue("(dd)", tips[n].x, tips[n].y));
+        }
+        return result;
+    }
+
+    buffer = PyByteArray_FromStringAndSize((const char *) tips, ntips*sizeof(point_t));
+    if (!buffer) {
+        return NULL;
+    }
+    flat = PyObject_CallMethod(numpy, "frombuffer", "Os", buffer, "float32");
+    Py_DECREF(buffer);
+    if (!flat) {
+        return NULL;
+    }
+    result = PyObject_CallMethod(flat, "reshape", "(ii)", ntips, 2);
+    Py_DECREF(flat);
+    return result;
+}
+
+static int get_sheet(PyObject *object, Py_buffer *view, const char *name) {
+// takes a view of a C-contiguous 2D float32 or float64 buffer
+//
+// returns:
+//  0:  success
+//  <0: error, with an exception set
+    const char *format;
+
+    if (0 != PyObject_GetBuffer(object, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) {
+        return -1;
+    }
+
+    format = view->format ? view->format : "B";
+    if (('@' == format[0]) || ('=' == format[0]) || ('<' == format[0])) {
+        // native or little endian; everything we build for is the latter
+        format++;
+    }
+    if ((2 != view->ndim) || (view->shape[0] < 2) || (view->shape[1] < 2)) {
+        PyErr_Format(PyExc_ValueError, "%s must be a 2D array, at least 2 by 2", name);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    if (!((0 == strcmp(format, "f")) && (sizeof(float) == view->itemsize))
+            && !((0 == strcmp(format, "d")) && (sizeof(double) == view->itemsize))) {
+        PyErr_Format(PyExc_TypeError, "%s must be float32 or float64, not '%s'", name,
+                view->format ? view->format : "B");
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+static float ** sheet_rows(Py_buffer *view) {
+// row pointers into a float32 view, or a converted copy of a float64 one,
+// to be freed with free_rows.  Safe without the GIL.
+    int x = view->shape[1], y = view->shape[0], j;
+    float **rows;
+
+    if (sizeof(float) == view->itemsize) {
+        rows = malloc(y*sizeof(float *));
+        if (rows) {
+            for (j = 0; j < y; ++j) {
+                rows[j] = (float *) view->buf + (size_t) j*x;
+            }
+        }
+        return rows;
+    }
+
+    rows = sheet_alloc_f(y, x, 0);
+    if (rows) {
+        for (j = 0; j < y; ++j) {
+            tip_kernels()->convert_row((double *) view->buf + (size_t) j*x, rows[j], x);
+        }
+    }
+    return rows;
+}
+
+static void free_rows(Py_buffer *view, float **rows) {
+// frees the rows from sheet_rows
+    if (sizeof(float) == view->itemsize) {
+        free(rows);
+    } else {
+        sheet_free(rows);
+    }
+}
+
+static PyObject * tiptrace_find_tips(PyObject *self, PyObject *args, PyObject *kwargs) {
+// find_tips over two buffers, without the GIL
+    static char *keywords[] = { "sheet_1", "sheet_2", "isoline_1", "isoline_2", NULL };
+    PyObject *object_1, *object_2, *isoline_2_object = Py_None, *result = NULL;
+    Py_buffer view_1, view_2;
+    float isoline_1 = -30.0, isoline_2;
+    float **rows_1 = NULL, **rows_2 = NULL;
+    point_t *tips = NULL;
+    int x, y, ntips, max_tips = 20;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|fO", keywords, &object_1, &object_2,
+                &isoline_1, &isoline_2_object)) {
+        return NULL;
+    }
+    isoline_2 = isoline_1;
+    if (isoline_2_object != Py_None) {
+        isoline_2 = PyFloat_AsDouble(isoline_2_object);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+
+    if (0 != get_sheet(object_1, &view_1, "sheet_1")) {
+        return NULL;
+    }
+    if (0 != get_sheet(object_2, &view_2, "sheet_2")) {
+        PyBuffer_Release(&view_1);
+        return NULL;
+    }
+    if ((view_1.shape[0] != view_2.shape[0]) || (view_1.shape[1] != view_2.shape[1])) {
+        PyErr_SetString(PyExc_ValueError, "sheet_1 and sheet_2 must be the same shape");
+        goto done;
+    }
+    x = view_1.shape[1];
+    y = view_1.shape[0];
+
+    Py_BEGIN_ALLOW_THREADS
+    rows_1 = sheet_rows(&view_1);
+    rows_2 = sheet_rows(&view_2);
+    ntips = -1;
+    while (rows_1 && rows_2 && (ntips < 0)) {
+        // find_tips reports how many there were when there isn't room
+        free(tips);
+        tips = malloc(max_tips*sizeof(point_t));
+        if (!tips)
+            break;
+        ntips = find_tips(x, y, rows_1, isoline_1, rows_2, isoline_2, max_tips, tips);
+        if (ntips < 0)
+            max_tips = -ntips;
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!rows_1 || !rows_2 || !tips) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    result = tips_to_python(tips, ntips);
+
+done:
+    if (rows_1)
+        free_rows(&view_1, rows_1);
+    if (rows_2)
+        free_rows(&view_2, rows_2);
+    free(tips);
+    PyBuffer_Release(&view_1);
+    PyBuffer_Release(&view_2);
+    return result;
+}
+
+
+typedef struct trace_iterator {
+    PyObject_HEAD
+    PyObject *filenames;        // a sequence
+    Py_ssize_t index;
+    int x;                      // of the whole sheet
+    int y;
+    sheet_window_t window;
+    int has_window;
+    file_type_t file_type;
+    double dt;
+    tip_tracer_t *tracer;
+    read_context_t *reader;
+    int busy;                   // in trace_iterator_next, without the GIL
+} trace_iterator_t;
+
+static void trace_iterator_dealloc(trace_iterator_t *it) {
+    Py_XDECREF(it->filenames);
+    tip_tracer_destroy(it->tracer);
+    destroy_read_context(it->reader);
+    Py_TYPE(it)->tp_free((PyObject *) it);
+}
+
+static PyObject * trace_next(trace_iterator_t *it) {
+// reads and traces the next file, returning (time, tips).  As in
+// core_trace, a file that can't be read is skipped, with a RuntimeWarning,
+// and the next one paired with the last file read.
+    PyObject *name, *path = NULL, *tips_object, *result;
+    const point_t *tips;
+    const char *filename;
+    Py_ssize_t index;
+    float **E;
+    int status, ntips = 0;
+
+    do {
+        if (it->index >= PySequence_Size(it->filenames)) {
+            return NULL;
+        }
+        // moved past first, so an error is never raised by the same file twice
+        index = it->index++;
+        name = PySequence_GetItem(it->filenames, index);
+        if (!name) {
+            return NULL;
+        }
+        status = PyUnicode_FSConverter(name, &path);
+        Py_DECREF(name);
+        if (!status) {
+            return NULL;
+        }
+        filename = PyBytes_AS_STRING(path);
+
+        Py_BEGIN_ALLOW_THREADS
+        E = tip_tracer_next_frame(it->tracer);
+        status = read_file_window(it->reader, it->file_type, it->x, it->y,
+                it->has_window ? &it->window : NULL, E, filename);
+        if (0 == status) {
+            tip_tracer_push_frame(it->tracer, E);
+            ntips = tip_tracer_get_tips(it->tracer, &tips);
+        }
+        Py_END_ALLOW_THREADS
+
+        if ((0 != status)
+                && (0 != PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "Problem reading in %s", filename))) {
+            // warnings are errors
+            Py_DECREF(path);
+            return NULL;
+        }
+        if ((0 == status) && (ntips < 0)) {
+            PyErr_Format(PyExc_RuntimeError, "Too many tips in file %s (%d)", filename, ntips);
+            Py_DECREF(path);
+            return NULL;
+        }
+        Py_DECREF(path);
+        path = NULL;
+    } while (0 != status);
+
+    tips_object = tips_to_python(tips, ntips);
+    if (!tips_object) {
+        return NULL;
+    }
+    result = Py_BuildValue("(dN)", index * it->dt, tips_object);
+    return result;
+}
+
+static PyObject * trace_iterator_next(trace_iterator_t *it) {
+// trace_next, refusing a second thread while the GIL is released, as
+// generators do
+    PyObject *result;
+
+    if (it->busy) {
+        PyErr_SetString(PyExc_ValueError, "iterator already executing");
+        return NULL;
+    }
+    it->busy = 1;
+    result = trace_next(it);
+    it->busy = 0;
+    return result;
+}
+
+static int take_header(PyObject *filenames, file_type_t file_type, int *x, int *y,
+        double *dt, int dt_set) {
+// takes the sheet size, and any timestep, from the header of the first file
+// of an archive, .npy or IGB list, as core_trace does, checking it against
+// any size given (x and y being -1 if not)
+//
+// returns:
+//  0:  success
+//  <0: error, with an exception set
+    PyObject *name, *path;
+    frame_archive_t *archive;
+    frame_file_t header;
+    const char *filename;
+    char *archive_path;
+    long frame;
+    int status;
+
+    if (PySequence_Size(filenames) < 1) {
+        PyErr_SetString(PyExc_ValueError, "x and y must be given when there are no files");
+        return -1;
+    }
+    name = PySequence_GetItem(filenames, 0);
+    if (!name) {
+        return -1;
+    }
+    status = PyUnicode_FSConverter(name, &path);
+    Py_DECREF(name);
+    if (!status) {
+        return -1;
+    }
+    filename = PyBytes_AS_STRING(path);
+
+    if (ARCHIVE == file_type) {
+        archive_path = strndup(filename, frame_file_path(filename, &frame));
+        archive = archive_path ? frame_archive_open(archive_path) : NULL;
+        free(archive_path);
+        if (!archive) {
+            PyErr_Format(PyExc_ValueError, "%s can't be opened as an archive", filename);
+            Py_DECREF(path);
+            return -1;
+        }
+        header.nx = archive->nx;
+        header.ny = archive->ny;
+        header.dt = archive->dt;
+        frame_archive_close(archive);
+    } else if (1 != frame_file_probe(filename, &header)) {
+        PyErr_Format(PyExc_ValueError, "%s can't be opened, or has no .npy or IGB header",
+                filename);
+        Py_DECREF(path);
+        return -1;
+    }
+
+    if (((*x >= 0) && (*x != header.nx)) || ((*y >= 0) && (*y != header.ny))) {
+        PyErr_Format(PyExc_ValueError, "%s holds %d by %d frames, not the %d by %d given",
+                filename, header.nx, header.ny, *x, *y);
+        Py_DECREF(path);
+        return -1;
+    }
+    Py_DECREF(path);
+    *x = header.nx;
+    *y = header.ny;
+    if (!dt_set && (header.dt > 0.0)) {
+        *dt = header.dt;
+    }
+    return 0;
+}
+
+static PyTypeObject trace_iterator_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "tiptrace.TraceIterator",
+    .tp_basicsize = sizeof(trace_iterator_t),
+    .tp_dealloc = (destructor) trace_iterator_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Iterator over the (time, tips) of a list of frame files",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) trace_iterator_next,
+};
+
+static PyObject * tiptrace_trace_files(PyObject *self, PyObject *args, PyObject *kwargs) {
+// creates an iterator tracing a list of files
+    static char *keywords[] = { "filenames", "x", "y", "isoline", "type", "dt", "threads",
+        "roi", "max_tips", NULL };
+    PyObject *filenames, *x_object = Py_None, *y_object = Py_None, *dt_object = Py_None;
+    PyObject *roi = Py_None;
+    const char *type = "float";
+    float isoline = -30.0;
+    double dt = 1.0;
+    int x = -1, y = -1, threads = 1, max_tips = 1024, width, height;
+    trace_iterator_t *it;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOfsOiOi", keywords, &filenames,
+                &x_object, &y_object, &isoline, &type, &dt_object, &threads, &roi, &max_tips)) {
+        return NULL;
+    }
+    if ((x_object != Py_None) && (-1 == (x = PyLong_AsLong(x_object))) && PyErr_Occurred()) {
+        return NULL;
+    }
+    if ((y_object != Py_None) && (-1 == (y = PyLong_AsLong(y_object))) && PyErr_Occurred()) {
+        return NULL;
+    }
+    if ((dt_object != Py_None) && (-1.0 == (dt = PyFloat_AsDouble(dt_object)))
+            && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (!PySequence_Check(filenames)) {
+        PyErr_SetString(PyExc_TypeError, "filenames must be a sequence");
+        return NULL;
+    }
+
+    it = PyObject_New(trace_iterator_t, &trace_iterator_type);
+    if (!it) {
+        return NULL;
+    }
+    Py_INCREF(filenames);
+    it->filenames = filenames;
+    it->index = 0;
+    it->has_window = 0;
+    it->tracer = NULL;
+    it->busy = 0;
+    it->reader = new_read_context();
+    if (!it->reader) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    if (0 == strcmp("float", type)) {
+        it->file_type = BINARY_FLOAT;
+    } else if (0 == strcmp("double", type)) {
+        it->file_type = BINARY_DOUBLE;
+    } else if (0 == strcmp("text", type)) {
+        it->file_type = TEXT;
+    } else if (0 == strcmp("archive", type)) {
+        it->file_type = ARCHIVE;
+    } else if ((0 == strcmp("npy", type)) || (0 == strcmp("igb", type))) {
+        it->file_type = FRAME_FILE;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unrecognised type '%s'.  Try float or double or text or archive or npy or igb", type);
+        goto fail;
+    }
+
+    if ((ARCHIVE == it->file_type) || (FRAME_FILE == it->file_type)) {
+        // the files say how big their sheets are
+        if (0 != take_header(filenames, it->file_type, &x, &y, &dt, dt_object != Py_None)) {
+            goto fail;
+        }
+    } else if ((x < 0) || (y < 0)) {
+        PyErr_Format(PyExc_TypeError, "x and y are needed for type '%s'", type);
+        goto fail;
+    }
+    it->x = x;
+    it->y = y;
+    it->dt = dt;
+
+    width = x;
+    height = y;
+    if (roi != Py_None) {
+        if (!PyArg_ParseTuple(roi, "iiii;roi must be (x0, x1, y0, y1)", &it->window.x0,
+                    &it->window.x1, &it->window.y0, &it->window.y1)) {
+            goto fail;
+        }
+        width = it->window.x1 - it->window.x0;
+        height = it->window.y1 - it->window.y0;
+        if ((it->window.x0 < 0) || (it->window.x1 > x) || (width < 3)
+                || (it->window.y0 < 0) || (it->window.y1 > y) || (height < 3)) {
+            PyErr_Format(PyExc_ValueError,
+                    "roi must be at least 3 by 3, and within the %d by %d sheet", x, y);
+            goto fail;
+        }
+        it->has_window = 1;
+    }
+
+    it->tracer = tip_tracer_create(width, height);
+    if (!it->tracer || (0 != tip_tracer_configure(it->tracer, isoline, isoline, max_tips,
+                    (threads > 1) ? threads : 1))) {
+        PyErr_SetString(PyExc_ValueError, "Couldn't create a tracer for these sheets");
+        goto fail;
+    }
+    if (it->has_window) {
+        tip_tracer_set_origin(it->tracer, it->window.x0, it->window.y0);
+    }
+
+    return (PyObject *) it;
+
+fail:
+    Py_DECREF(it);
+    return NULL;
+}
+
+static PyMethodDef tiptrace_methods[] = {
+    { "find_tips", (PyCFunction) tiptrace_find_tips, METH_VARARGS | METH_KEYWORDS,
+        "find_tips(sheet_1, sheet_2, isoline_1=-30, isoline_2=None)\n\n"
+        "Tips between two 2D float32/float64 sheets, as an (n, 2) array of x, y." },
+    { "trace_files", (PyCFunction) tiptrace_trace_files, METH_VARARGS | METH_KEYWORDS,
+        "trace_files(filenames, x=None, y=None, isoline=-30, type='float', dt=None, threads=1, roi=None, max_tips=1024)\n\n"
+        "Iterator over (time, tips) for each frame file, traced as core_trace does.\n"
+        "x, y and dt default to an archive's, .npy or IGB file's header." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef tiptrace_module = {
+    PyModuleDef_HEAD_INIT,
+    "tiptrace",
+    "Spiral wave tip tracing",
+    -1,
+    tiptrace_methods
+};
+
+PyMODINIT_FUNC PyInit_tiptrace(void) {
+    PyObject *module;
+
+    if (PyType_Ready(&trace_iterator_type) < 0) {
+        return NULL;
+    }
+    module = PyModule_Create(&tiptrace_module);
+    if (!module) {
+        return NULL;
+    }
+    PyModule_AddStringConstant(module, "kernels", tip_kernels()->name);
+    return module;
+}
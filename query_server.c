@@ -0,0 +1,667 @@
+/*
+ * query_server.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "query_server.h"
+#include "helper.h"
+#include "tip_tracer.h"
+#include "sheet_alloc.h"
+#include "utils/frame_list.h"
+
+#define NUM_TIPS (20)
+
+// connections waiting for a worker
+#define QUEUE_SIZE (64)
+
+// levels of a quantised value
+#define QUANTISED_LEVELS (65535.0f)
+
+typedef struct stored_frame {
+    void *data;                 // the window, row by row, floats or quantised
+    float offset;               // value = offset + scale*q, when quantised
+    float scale;
+    int pins;                   // workers copying from data
+    int loading;
+    long newer;                 // neighbours in the recently used list, or -1
+    long older;
+} stored_frame_t;
+
+typedef struct query_server {
+    int x;                      // the whole sheet
+    int y;
+    sheet_window_t window;      // the part of it kept
+    int wx;
+    int wy;
+    float dt;
+    file_type_t file_type;
+    frame_list_t *list;
+    long nframes;
+
+    int quantise;
+    size_t frame_bytes;         // kept for each frame
+    long long budget;
+    long long resident;
+
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;      // a frame finished loading
+    stored_frame_t *frames;
+    long newest;                // ends of the recently used list, or -1
+    long oldest;
+    long hits;
+    long misses;
+    long evictions;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queued;
+    int queue[QUEUE_SIZE];
+    int queue_start;
+    int queue_length;
+    int stop;
+    int *connections;           // being served, one per worker, or -1
+    int nconnections;
+} query_server_t;
+
+typedef struct decoder {
+    float **scratch;            // a window sized sheet to decode into
+    read_context_t *reader;
+} decoder_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signal) {
+// asks the accept loop to stop
+    (void) signal;
+    interrupted = 1;
+}
+
+static void unlink_frame(query_server_t *s, long n) {
+// takes frame n out of the recently used list.  Called with the lock held.
+    stored_frame_t *f = &s->frames[n];
+
+    if (f->newer >= 0) {
+        s->frames[f->newer].older = f->older;
+    } else {
+        s->newest = f->older;
+    }
+    if (f->older >= 0) {
+        s->frames[f->older].newer = f->newer;
+    } else {
+        s->oldest = f->newer;
+    }
+    f->newer = f->older = -1;
+}
+
+static void touch_frame(query_server_t *s, long n) {
+// moves (or adds) frame n to the front of the recently used list.  Called
+// with the lock held.
+    stored_frame_t *f = &s->frames[n];
+
+    if ((s->newest == n) || (f->newer >= 0) || (f->older >= 0)) {
+        unlink_frame(s, n);
+    }
+    f->older = s->newest;
+    f->newer = -1;
+    if (s->newest >= 0) {
+        s->frames[s->newest].newer = n;
+    }
+    s->newest = n;
+    if (s->oldest < 0) {
+        s->oldest = n;
+    }
+}
+
+static void evict(query_server_t *s) {
+// drops the least recently used frames not being copied from, until the
+// frames kept fit the budget.  Called with the lock held.
+    long n = s->oldest, newer;
+
+    while ((s->resident > s->budget) && (n >= 0)) {
+        newer = s->frames[n].newer;
+        if (0 == s->frames[n].pins) {
+            unlink_frame(s, n);
+            free(s->frames[n].data);
+            s->frames[n].data = NULL;
+            s->resident -= s->frame_bytes;
+            s->evictions++;
+        }
+        n = newer;
+    }
+}
+
+static void * store_frame(query_server_t *s, float **sheet, float *offset, float *scale) {
+// packs a decoded window for keeping, quantising it if asked to
+//
+// returns:
+//  the packed frame, or NULL on failure
+    float *values;
+    uint16_t *levels;
+    float lo, hi, v;
+    int i, j;
+
+    if (!s->quantise) {
+        values = malloc(s->frame_bytes);
+        if (values) {
+            for (j = 0; j < s->wy; ++j) {
+                memcpy(values + (size_t) j*s->wx, sheet[j], s->wx*sizeof(float));
+            }
+        }
+        return values;
+    }
+
+    // scaled between the frame's own extremes, so each frame keeps its
+    // full 16 bits of resolution
+    lo = INFINITY;
+    hi = -INFINITY;
+    for (j = 0; j < s->wy; ++j) {
+        for (i = 0; i < s->wx; ++i) {
+            v = sheet[j][i];
+            if (v < lo)
+                lo = v;
+            if (v > hi)
+                hi = v;
+        }
+    }
+    *offset = lo;
+    *scale = (hi > lo) ? (hi - lo)/QUANTISED_LEVELS : 0.0f;
+
+    levels = malloc(s->frame_bytes);
+    if (levels) {
+        for (j = 0; j < s->wy; ++j) {
+            for (i = 0; i < s->wx; ++i) {
+                levels[(size_t) j*s->wx + i] = (*scale > 0.0f)
+                    ? (uint16_t) lrintf((sheet[j][i] - lo)/(*scale)) : 0;
+            }
+        }
+    }
+    return levels;
+}
+
+static int fetch_frame(query_server_t *s, long n, decoder_t *decoder) {
+// makes sure frame n is kept, decoding it with the decoder if it isn't, and
+// pins it until unpin_frame
+//
+// returns:
+//  0:  success
+//  <0: the frame couldn't be read
+    stored_frame_t *f = &s->frames[n];
+    char *filename;
+    float offset = 0.0f, scale = 0.0f;
+    void *data = NULL;
+    int status;
+
+    pthread_mutex_lock(&s->lock);
+    while (f->loading) {
+        pthread_cond_wait(&s->loaded, &s->lock);
+    }
+    if (f->data) {
+        s->hits++;
+        f->pins++;
+        touch_frame(s, n);
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    s->misses++;
+    f->loading = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    // each worker reads with its own context, so frames are decoded at once
+    filename = frame_list_name(s->list, n);
+    status = filename ? read_file_window(decoder->reader, s->file_type, s->x, s->y,
+            &s->window, decoder->scratch, filename) : -1;
+    if (0 != status) {
+        fprintf(stderr, "Problem reading in %s\n", filename ? filename : "a frame");
+    }
+    free(filename);
+    if (0 == status) {
+        data = store_frame(s, decoder->scratch, &offset, &scale);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    f->loading = 0;
+    pthread_cond_broadcast(&s->loaded);
+    if (!data) {
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    f->data = data;
+    f->offset = offset;
+    f->scale = scale;
+    f->pins++;
+    s->resident += s->frame_bytes;
+    touch_frame(s, n);
+    evict(s);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static void unpin_frame(query_server_t *s, long n) {
+// lets frame n be dropped again
+    pthread_mutex_lock(&s->lock);
+    s->frames[n].pins--;
+    evict(s);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void copy_region(const query_server_t *s, long n, const sheet_window_t *region,
+        float **to) {
+// copies (and unpacks) a region of pinned frame n into to[y][x]
+    const stored_frame_t *f = &s->frames[n];
+    const float *values;
+    const uint16_t *levels;
+    size_t row;
+    int i, j;
+
+    for (j = region->y0; j < region->y1; ++j) {
+        row = (size_t) (j - s->window.y0)*s->wx + (region->x0 - s->window.x0);
+        if (s->quantise) {
+            levels = (const uint16_t *) f->data + row;
+            for (i = 0; i < region->x1 - region->x0; ++i) {
+                to[j - region->y0][i] = f->offset + f->scale*levels[i];
+            }
+        } else {
+            values = (const float *) f->data + row;
+            memcpy(to[j - region->y0], values, (region->x1 - region->x0)*sizeof(float));
+        }
+    }
+}
+
+static int push_frame(query_server_t *s, long n, const sheet_window_t *region,
+        tip_tracer_t *tracer, decoder_t *decoder) {
+// pushes a region of frame n into the tracer
+//
+// returns:
+//  as tip_tracer_push_frame, or INT_MIN if the frame couldn't be read
+    float **E;
+
+    if (0 != fetch_frame(s, n, decoder)) {
+        return INT_MIN;
+    }
+    E = tip_tracer_next_frame(tracer);
+    copy_region(s, n, region, E);
+    unpin_frame(s, n);
+    return tip_tracer_push_frame(tracer, E);
+}
+
+static void answer_tips(query_server_t *s, const char *request, FILE *out, decoder_t *decoder) {
+// answers "tips FIRST END LEVEL [X0:X1,Y0:Y1]"
+    sheet_window_t region = s->window;
+    long first, end, n, frames = 0;
+    const point_t *tips;
+    tip_tracer_t *tracer;
+    float level;
+    char trailing;
+    int consumed = 0, ntips, i;
+
+    if (3 != sscanf(request, "tips %ld %ld %f %n", &first, &end, &level, &consumed)
+            || (0 == consumed)) {
+        fprintf(out, "error tips takes FIRST END LEVEL [X0:X1,Y0:Y1]\n");
+        return;
+    }
+    request += consumed;
+    if (*request && (4 != sscanf(request, "%d:%d,%d:%d %c", &region.x0, &region.x1,
+                    &region.y0, &region.y1, &trailing))) {
+        fprintf(out, "error regions are X0:X1,Y0:Y1\n");
+        return;
+    }
+    if ((region.x0 < s->window.x0) || (region.x1 > s->window.x1) || (region.x1 - region.x0 < 3)
+            || (region.y0 < s->window.y0) || (region.y1 > s->window.y1) || (region.y1 - region.y0 < 3)) {
+        fprintf(out, "error the region must be at least 3 by 3, and within %d:%d,%d:%d\n",
+                s->window.x0, s->window.x1, s->window.y0, s->window.y1);
+        return;
+    }
+    if ((first < 0) || (end > s->nframes) || (first >= end)) {
+        fprintf(out, "error frames must be within 0:%ld\n", s->nframes);
+        return;
+    }
+
+    tracer = tip_tracer_create(region.x1 - region.x0, region.y1 - region.y0);
+    if (!tracer || (0 != tip_tracer_configure(tracer, level, level, NUM_TIPS, 1))) {
+        tip_tracer_destroy(tracer);
+        fprintf(out, "error out of memory\n");
+        return;
+    }
+    tip_tracer_set_origin(tracer, region.x0, region.y0);
+
+    // as a shard would, pair the first frame with the one before it
+    if (first > 0) {
+        push_frame(s, first - 1, &region, tracer, decoder);
+    }
+    for (n = first; n < end; ++n) {
+        ntips = push_frame(s, n, &region, tracer, decoder);
+        if (INT_MIN == ntips) {
+            continue;
+        }
+        frames++;
+        if (ntips < 0) {
+            fprintf(stderr, "Too many tips in frame %ld (%d)\n", n, ntips);
+            continue;
+        }
+        tip_tracer_get_tips(tracer, &tips);
+        for (i = 0; i < ntips; ++i) {
+            fprintf(out, "%f %f %f\n", frame_list_number(s->list, n) * s->dt, tips[i].x,
+                    tips[i].y);
+        }
+    }
+    tip_tracer_destroy(tracer);
+    fprintf(out, "ok %ld\n", frames);
+}
+
+static void answer_info(query_server_t *s, FILE *out) {
+// answers "info"
+    long resident;
+
+    pthread_mutex_lock(&s->lock);
+    resident = s->resident/s->frame_bytes;
+    fprintf(out, "frames %ld\n", s->nframes);
+    fprintf(out, "sheet %d %d\n", s->x, s->y);
+    fprintf(out, "window %d:%d,%d:%d\n", s->window.x0, s->window.x1, s->window.y0, s->window.y1);
+    fprintf(out, "timestep %f\n", s->dt);
+    fprintf(out, "quantised %d\n", s->quantise);
+    fprintf(out, "frames_kept %ld\n", resident);
+    fprintf(out, "bytes_kept %lld\n", s->resident);
+    fprintf(out, "memory_budget %lld\n", s->budget);
+    fprintf(out, "hits %ld\n", s->hits);
+    fprintf(out, "misses %ld\n", s->misses);
+    fprintf(out, "evictions %ld\n", s->evictions);
+    pthread_mutex_unlock(&s->lock);
+    fprintf(out, "ok\n");
+}
+
+static void serve_connection(query_server_t *s, int fd, int *slot, decoder_t *decoder) {
+// answers each request on a connection, until the client closes it or the
+// server shuts it down.  slot holds fd until it's closed.
+    FILE *in, *out;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    int out_fd;
+
+    out_fd = dup(fd);
+    in = fdopen(fd, "r");
+    out = (out_fd >= 0) ? fdopen(out_fd, "w") : NULL;
+    if (!in || !out) {
+        if (in) {
+            fclose(in);
+        } else {
+            close(fd);
+        }
+        if (out) {
+            fclose(out);
+        } else if (out_fd >= 0) {
+            close(out_fd);
+        }
+        return;
+    }
+
+    while ((length = getline(&line, &size, in)) > 0) {
+        while ((length > 0) && (('\n' == line[length - 1]) || ('\r' == line[length - 1]))) {
+            line[--length] = 0;
+        }
+        if (0 == strncmp(line, "tips ", 5)) {
+            answer_tips(s, line, out, decoder);
+        } else if (0 == strcmp(line, "info")) {
+            answer_info(s, out);
+        } else if (length > 0) {
+            fprintf(out, "error unknown request\n");
+        }
+        if (0 != fflush(out)) {
+            break;
+        }
+    }
+
+    // so that shutting down can't reach a descriptor since reused
+    pthread_mutex_lock(&s->queue_lock);
+    *slot = -1;
+    pthread_mutex_unlock(&s->queue_lock);
+
+    free(line);
+    fclose(in);
+    fclose(out);
+}
+
+static int new_decoder(const query_server_t *s, decoder_t *decoder) {
+// allocates a decoder's scratch sheet and read context
+    decoder->scratch = sheet_alloc_f(s->wy, s->wx, 0);
+    decoder->reader = new_read_context();
+    if (!decoder->scratch || !decoder->reader) {
+        sheet_free(decoder->scratch);
+        destroy_read_context(decoder->reader);
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_decoder(decoder_t *decoder) {
+// frees what new_decoder allocated
+    sheet_free(decoder->scratch);
+    destroy_read_context(decoder->reader);
+}
+
+static void * worker(void *arg) {
+// takes connections off the queue and serves them
+    query_server_t *s = arg;
+    decoder_t decoder;
+    int fd, *slot;
+
+    if (0 != new_decoder(s, &decoder)) {
+        perror("query worker");
+        return NULL;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&s->queue_lock);
+        while ((0 == s->queue_length) && !s->stop) {
+            pthread_cond_wait(&s->queued, &s->queue_lock);
+        }
+        if (0 == s->queue_length) {
+            pthread_mutex_unlock(&s->queue_lock);
+            break;
+        }
+        fd = s->queue[s->queue_start];
+        s->queue_start = (s->queue_start + 1) % QUEUE_SIZE;
+        s->queue_length--;
+        if (s->stop) {
+            // not yet answered, and the server is going
+            pthread_mutex_unlock(&s->queue_lock);
+            close(fd);
+            continue;
+        }
+        // each worker serves one connection, so a slot is always free
+        for (slot = s->connections; *slot >= 0; ++slot)
+            ;
+        *slot = fd;
+        pthread_mutex_unlock(&s->queue_lock);
+
+        serve_connection(s, fd, slot, &decoder);
+    }
+
+    destroy_decoder(&decoder);
+    return NULL;
+}
+
+static int listen_on(const char *path) {
+// listens on a Unix-domain socket at path, replacing any stale socket
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    if ((0 != bind(fd, (struct sockaddr *) &address, sizeof(address)))
+            || (0 != listen(fd, QUEUE_SIZE))) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void preload(query_server_t *s) {
+// decodes frames from the start of the run while they fit the budget
+    decoder_t decoder;
+    long n;
+
+    if (0 != new_decoder(s, &decoder)) {
+        return;
+    }
+    for (n = 0; (n < s->nframes) && (s->resident + (long long) s->frame_bytes <= s->budget); ++n) {
+        if (0 == fetch_frame(s, n, &decoder)) {
+            unpin_frame(s, n);
+        }
+    }
+    destroy_decoder(&decoder);
+}
+
+int serve_queries(const char *socket_path, int x, int y, float dt, frame_list_t *list,
+        file_type_t file_type, const process_options_t *options) {
+// loads the frames and answers requests until interrupted
+    query_server_t s;
+    pthread_t *workers;
+    struct sigaction action;
+    struct pollfd pfd;
+    int listen_fd, fd, nworkers, w;
+    long n;
+
+    memset(&s, 0, sizeof(s));
+    s.x = x;
+    s.y = y;
+    if (options->roi) {
+        s.window = *options->roi;
+    } else {
+        s.window.x0 = 0;
+        s.window.x1 = x;
+        s.window.y0 = 0;
+        s.window.y1 = y;
+    }
+    s.wx = s.window.x1 - s.window.x0;
+    s.wy = s.window.y1 - s.window.y0;
+    s.dt = dt;
+    s.file_type = file_type;
+    s.list = list;
+    s.nframes = frame_list_length(list);
+    s.quantise = options->quantise;
+    s.frame_bytes = (size_t) s.wx*s.wy*(s.quantise ? sizeof(uint16_t) : sizeof(float));
+    s.budget = options->serve_memory;
+    s.newest = s.oldest = -1;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.loaded, NULL);
+    pthread_mutex_init(&s.queue_lock, NULL);
+    pthread_cond_init(&s.queued, NULL);
+
+    s.frames = calloc(s.nframes, sizeof(stored_frame_t));
+    nworkers = (options->serve_workers > 0) ? options->serve_workers : 1;
+    workers = calloc(nworkers, sizeof(pthread_t));
+    s.connections = malloc(nworkers*sizeof(int));
+    s.nconnections = nworkers;
+    if (!s.frames || !workers || !s.connections) {
+        oops("query server");
+    }
+    for (n = 0; n < s.nframes; ++n) {
+        s.frames[n].newer = s.frames[n].older = -1;
+    }
+    for (w = 0; w < nworkers; ++w) {
+        s.connections[w] = -1;
+    }
+
+    listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) {
+        free(s.frames);
+        free(workers);
+        free(s.connections);
+        return -1;
+    }
+
+    preload(&s);
+    fprintf(stderr, "serving %ld frames on %s, %lld of them kept\n", s.nframes, socket_path,
+            s.resident/(long long) s.frame_bytes);
+
+    for (w = 0; w < nworkers; ++w) {
+        if (0 != pthread_create(&workers[w], NULL, worker, &s)) {
+            oops("query worker");
+        }
+    }
+
+    // a client going away mid-answer mustn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = interrupt;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    while (!interrupted) {
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        pthread_mutex_lock(&s.queue_lock);
+        if (s.queue_length < QUEUE_SIZE) {
+            s.queue[(s.queue_start + s.queue_length) % QUEUE_SIZE] = fd;
+            s.queue_length++;
+            pthread_cond_signal(&s.queued);
+            fd = -1;
+        }
+        pthread_mutex_unlock(&s.queue_lock);
+        if (fd >= 0) {
+            // every worker busy, and plenty waiting already
+            close(fd);
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    // connections waiting are dropped, and those being served shut down, so
+    // no idle client holds a worker in getline
+    pthread_mutex_lock(&s.queue_lock);
+    s.stop = 1;
+    for (w = 0; w < s.nconnections; ++w) {
+        if (s.connections[w] >= 0) {
+            shutdown(s.connections[w], SHUT_RDWR);
+        }
+    }
+    pthread_cond_broadcast(&s.queued);
+    pthread_mutex_unlock(&s.queue_lock);
+    for (w = 0; w < nworkers; ++w) {
+        pthread_join(workers[w], NULL);
+    }
+
+    for (n = 0; n < s.nframes; ++n) {
+        free(s.frames[n].data);
+    }
+    free(s.frames);
+    free(workers);
+    free(s.connections);
+    return 0;
+}
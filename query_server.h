@@ -0,0 +1,54 @@
+/*
+ * query_server.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * A resident daemon for interactive re-analysis: the frames of a run (or of
+ * a window of it, options->roi) are decoded once and kept in memory, and
+ * tips are traced from them on request, at any isoline and in any region,
+ * without decoding again.
+ *
+ * Frames are kept as floats or, with options->quantise, as 16 bits each,
+ * scaled between the frame's own minimum and maximum; either way within
+ * options->serve_memory bytes, the least recently used frames being dropped
+ * (and decoded again if asked for).  As many frames as fit are decoded at
+ * start up.
+ *
+ * Requests are lines of text on a Unix-domain socket, answered in order on
+ * the same connection, e.g.
+ *
+ *   $ socat - UNIX-CONNECT:/tmp/run7.sock
+ *   tips 100 200 -20 64:192,0:128
+ *   10.000000 83.262917 61.516739
+ *   ...
+ *   ok 100
+ *
+ *   tips FIRST END LEVEL [X0:X1,Y0:Y1]
+ *          the tips of frames FIRST up to END - 1 on isoline LEVEL, each
+ *          frame paired with the one before it as in a --frames shard, as
+ *          "time x y" lines, then "ok FRAMES".  The region defaults to
+ *          the whole of what is kept, and is in whole sheet coordinates.
+ *   info
+ *          key/value lines describing the frames kept, then "ok".
+ *
+ * A request that can't be answered gets a single "error ..." line.
+ * Connections are served by a pool of options->serve_workers threads, each
+ * tracing with a single thread.
+ */
+
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include "tip_trace_binary.h"
+
+int serve_queries(const char *socket_path, int x, int y, float dt, frame_list_t *list,
+        file_type_t file_type, const process_options_t *options);
+// loads the frames of list, x by y sheets of the given type, and answers
+// requests on socket_path until interrupted (SIGINT or SIGTERM).  Frame n
+// is at time n*dt.  On interruption, connections still open are closed,
+// idle or not.
+//
+// returns:
+//  0:  success, after being interrupted
+//  <0: the socket couldn't be opened
+
+#endif // QUERY_SERVER_H
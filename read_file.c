@@ -3,16 +3,100 @@
  * Jonathan D. Stott <jonathan.stott@gmail.com>
  *
  */
-#include <zlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "helper.h"
 
 #include "tip_trace_binary.h"
+#include "frame_archive.h"
+#include "frame_file.h"
+#include "decompress.h"
+#include "kernels.h"
+#include "sheet_alloc.h"
 
 #define BUFSIZE 1048576
 
-static int read_binary_float_sheet(int x, int y, float ** E, const char *filename);
-static int read_binary_double_sheet(int x, int y, float ** E, const char *filename);
-static int read_text_sheet(int x, int y, float ** E, const char *filename);
+struct read_context {
+    decompressor_t *decompressor;
+
+    // grown as needed and kept between calls, so that steady state reading
+    // of a file list does no allocation
+    unsigned char *input;       // whole compressed file
+    size_t input_size;
+    unsigned char *staging;     // decoded doubles or text
+    size_t staging_size;
+
+    // the archive last read from, and a whole frame to cut windows from
+    frame_archive_t *archive;
+    char *archive_path;
+    float **whole;
+    int whole_x;
+    int whole_y;
+
+    // the .npy or IGB file last read from
+    frame_file_t *file;
+    char *file_path;
+};
+
+// used by read_file, and by read_file_window without a context of its own
+static read_context_t *shared = NULL;
+
+// running total of decompressed bytes over every context, for progress
+// reporting
+static unsigned long long bytes_decoded = 0;
+
+static int read_binary_float_sheet(read_context_t *r, int x, int y, float ** E,
+        const char *filename);
+static int read_binary_double_sheet(read_context_t *r, int x, int y, float ** E,
+        const char *filename);
+static int read_binary_window(read_context_t *r, int x, int y, size_t size,
+        const sheet_window_t *window, float ** E, const char *filename);
+static int read_text_sheet(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char *filename);
+static int read_archive_frame(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char *reference);
+static int read_frame_file_frame(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char *reference);
+
+read_context_t * new_read_context(void) {
+// creates a context for reading, its buffers being allocated as needed
+    read_context_t *r;
+
+    r = calloc(1, sizeof(read_context_t));
+    if (!r) {
+        return NULL;
+    }
+    r->decompressor = new_decompressor();
+    if (!r->decompressor) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void destroy_read_context(read_context_t *r) {
+// frees a context, closing any archive or frame file it holds open
+    if (!r) {
+        return;
+    }
+    destroy_decompressor(r->decompressor);
+    free(r->input);
+    free(r->staging);
+    frame_archive_close(r->archive);
+    free(r->archive_path);
+    sheet_free(r->whole);
+    frame_file_close(r->file);
+    free(r->file_path);
+    free(r);
+}
+
+static void count_bytes(unsigned long long length) {
+// adds to the running total, which contexts on any thread share
+    __atomic_fetch_add(&bytes_decoded, length, __ATOMIC_RELAXED);
+}
 
 int read_file(file_type_t file_type, int x, int y, float **sheet, const char *filename) {
 // reads in the given file, assigning the values to sheet.
@@ -21,162 +105,611 @@ int read_file(file_type_t file_type, int x, int y, float **sheet, const char *fi
 // x:           x dimension of the sheet
 // y:           y dimension of the sheet
 // sheet[y][x]: 2D sheet of floats
-// filename:    filename to open
+// filename:    filename to open.  For ARCHIVE files this is PATH@FRAME, and
+//              for FRAME_FILE files PATH@FRAME or PATH for the first frame.
 //
 // returns:
 //  0:  success
 //  <0: error
+    return read_file_window(NULL, file_type, x, y, NULL, sheet, filename);
+}
+
+int read_file_window(read_context_t *r, file_type_t file_type, int x, int y,
+        const sheet_window_t *window, float **sheet, const char *filename) {
+// as read_file, but only the window of the frame, into sheet[y1-y0][x1-x0],
+// with the buffers of r
+    if (!r) {
+        if (!shared && !(shared = new_read_context())) {
+            return -1;
+        }
+        r = shared;
+    }
+
     switch(file_type) {
         case BINARY_FLOAT:
-              return read_binary_float_sheet(x, y, sheet, filename);
+              return window ? read_binary_window(r, x, y, sizeof(float), window, sheet, filename)
+                  : read_binary_float_sheet(r, x, y, sheet, filename);
         case BINARY_DOUBLE:
-              return read_binary_double_sheet(x, y, sheet, filename);
+              return window ? read_binary_window(r, x, y, sizeof(double), window, sheet, filename)
+                  : read_binary_double_sheet(r, x, y, sheet, filename);
         case TEXT:
-              return read_text_sheet(x, y, sheet, filename);
+              return read_text_sheet(r, x, y, window, sheet, filename);
+        case ARCHIVE:
+              return read_archive_frame(r, x, y, window, sheet, filename);
+        case FRAME_FILE:
+              return read_frame_file_frame(r, x, y, window, sheet, filename);
         default:
               fprintf(stderr, "Unknown sheet type\n");
               return -1;
     }
 }
 
+unsigned long long read_file_bytes(void) {
+// returns the number of bytes decompressed by read_file so far
+    return __atomic_load_n(&bytes_decoded, __ATOMIC_RELAXED);
+}
+
+static long read_whole(int fd, unsigned char *buffer, size_t count) {
+// reads up to count bytes from fd, retrying on short reads.
+    ssize_t rw;
+    size_t done = 0;
 
-static int read_binary_float_sheet(int x, int y, float ** E, const char * filename) {
-    gzFile sheet_file;
-    int rw;
+    while (done < count) {
+        rw = read(fd, buffer + done, count - done);
+        if (rw < 0) {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        if (0 == rw)
+            break;
+        done += rw;
+    }
+    return done;
+}
 
-    sheet_file = gzopen(filename, "r");
+static long load_file(read_context_t *r, const char *filename, unsigned char **out,
+        size_t *out_size, int grow) {
+// fills *out with the decompressed contents of filename, the compression
+// being chosen from the magic bytes.  Uncompressed files are read straight
+// into *out; compressed ones are read whole and decompressed in one call.
+// See decompress_buffer for the meaning of grow.
+//
+// returns:
+//  >=0:    bytes placed in *out
+//  <0:     error
+    unsigned char magic[COMPRESSION_MAGIC_LENGTH];
+    compression_t compression;
+    struct stat st;
+    long rw, length;
+    int fd;
+
+    // parenthesised to avoid helper.h's open() macro
+    fd = (open)(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+    if (0 != fstat(fd, &st)) {
+        perror(filename);
+        close(fd);
+        return -1;
+    }
 
-    if (!sheet_file) {
+    rw = read_whole(fd, magic, COMPRESSION_MAGIC_LENGTH);
+    if (rw < 0) {
         perror(filename);
+        close(fd);
         return -1;
     }
+    compression = detect_compression(magic, rw);
+
+    if (COMPRESSION_NONE == compression) {
+        // straight into the destination, no intermediate copy
+        length = st.st_size;
+        if ((size_t) length > *out_size) {
+            if (grow) {
+                unsigned char *p = realloc(*out, length);
+                if (!p) {
+                    close(fd);
+                    return -1;
+                }
+                *out = p;
+                *out_size = length;
+            } else {
+                length = *out_size;
+            }
+        }
+        memcpy(*out, magic, (rw < length) ? rw : length);
+        if (rw < length) {
+            long more = read_whole(fd, *out + rw, length - rw);
+            if (more < 0) {
+                perror(filename);
+                close(fd);
+                return -1;
+            }
+            length = rw + more;
+        }
+        close(fd);
+        count_bytes(length);
+        return length;
+    }
 
-    rw = gzread(sheet_file, E[0], sizeof(float)*x*y);
-    if (rw != x*y*sizeof(float)) {
-        fprintf(stderr, "Problem reading %s\n", filename);
-        fprintf(stderr, "%d/%d floats read\n", rw, x*y);
-        gzclose(sheet_file);
+    // compressed: read the whole file, then decode it in one go
+    if ((size_t) st.st_size > r->input_size) {
+        unsigned char *p = realloc(r->input, st.st_size);
+        if (!p) {
+            close(fd);
+            return -1;
+        }
+        r->input = p;
+        r->input_size = st.st_size;
+    }
+    memcpy(r->input, magic, rw);
+    length = read_whole(fd, r->input + rw, st.st_size - rw);
+    close(fd);
+    if (length < 0) {
+        perror(filename);
         return -1;
     }
+    length += rw;
 
-    gzclose(sheet_file);
-    return 0;
+    length = decompress_buffer(r->decompressor, compression, r->input, length, out, out_size, grow);
+    if (length < 0) {
+        fprintf(stderr, "%s: corrupt %s data\n", filename, compression_name(compression));
+    } else {
+        count_bytes(length);
+    }
+    return length;
 }
 
-static int read_binary_double_sheet(int x, int y, float ** E, const char * filename) {
-    gzFile sheet_file;
-    int rw, j, i;
+static int reserve_staging(read_context_t *r, size_t size) {
+// makes sure the staging buffer holds at least size bytes
+    if (size > r->staging_size) {
+        unsigned char *p = realloc(r->staging, size);
+        if (!p) {
+            return -1;
+        }
+        r->staging = p;
+        r->staging_size = size;
+    }
+    return 0;
+}
 
-    double ** sheet;
+typedef struct window_copy {
+    const sheet_window_t *window;
+    size_t row_bytes;           // bytes in a row of the whole sheet
+    size_t size;                // bytes in a value
+    unsigned char *out;         // the window, its rows packed together
+    unsigned long long position; // bytes of the sheet seen so far
+    unsigned long long end;     // one past the last byte of the window
+} window_copy_t;
+
+static int copy_window(void *arg, const unsigned char *data, size_t length) {
+// a decompress_sink_t keeping the part of each row within the window, and
+// done once past the window's last row
+    window_copy_t *w = arg;
+    const sheet_window_t *window = w->window;
+    size_t width = (window->x1 - window->x0)*w->size;
+    unsigned long long start = w->position, stop = w->position + length;
+    unsigned long long first, last, from, to;
+    long j;
+
+    for (j = start/w->row_bytes; (j < window->y1) && (j*w->row_bytes < stop); ++j) {
+        if (j < window->y0)
+            continue;
+        first = j*w->row_bytes + window->x0*w->size;
+        last = first + width;
+        from = (first > start) ? first : start;
+        to = (last < stop) ? last : stop;
+        if (from < to) {
+            memcpy(w->out + (j - window->y0)*width + (from - first), data + (from - start),
+                    to - from);
+        }
+    }
 
-    sheet_file = gzopen(filename, "r");
+    w->position = stop;
+    return w->position >= w->end;
+}
 
-    if (!sheet_file) {
+static int load_window(read_context_t *r, const char *filename, int x, int y, size_t size,
+        const sheet_window_t *window, unsigned char *out) {
+// fills out with the window of the x by y sheet of size byte values in
+// filename, the window's rows packed together.  Uncompressed files are read
+// a row of the window at a time; compressed ones are decoded up to the end
+// of the window, keeping only the window.
+//
+// returns:
+//  0:  success
+//  <0: error
+    unsigned char magic[COMPRESSION_MAGIC_LENGTH];
+    compression_t compression;
+    window_copy_t copy;
+    size_t width = (window->x1 - window->x0)*size;
+    struct stat st;
+    long rw, length;
+    int fd, j;
+
+    fd = (open)(filename, O_RDONLY);
+    if (fd < 0) {
         perror(filename);
         return -1;
     }
+    if (0 != fstat(fd, &st)) {
+        perror(filename);
+        close(fd);
+        return -1;
+    }
 
-    D_ARRAY_2D(sheet, y, x);
+    rw = read_whole(fd, magic, COMPRESSION_MAGIC_LENGTH);
+    if (rw < 0) {
+        perror(filename);
+        close(fd);
+        return -1;
+    }
+    compression = detect_compression(magic, rw);
 
+    if (COMPRESSION_NONE == compression) {
+        if (st.st_size != (off_t) size*x*y) {
+            fprintf(stderr, "Problem reading %s\n", filename);
+            fprintf(stderr, "%ld/%d values in the file\n", (long) (st.st_size/size), x*y);
+            close(fd);
+            return -1;
+        }
+        for (j = window->y0; j < window->y1; ++j) {
+            rw = pread(fd, out + (size_t) (j - window->y0)*width, width,
+                    ((off_t) j*x + window->x0)*size);
+            if (rw != (long) width) {
+                if (rw < 0) {
+                    perror(filename);
+                } else {
+                    fprintf(stderr, "Problem reading %s\n", filename);
+                }
+                close(fd);
+                return -1;
+            }
+        }
+        close(fd);
+        count_bytes((unsigned long long) width*(window->y1 - window->y0));
+        return 0;
+    }
 
-    rw = gzread(sheet_file, sheet[0], sizeof(double)*x*y);
-    if (rw != x*y*sizeof(double)) {
+    // compressed: read the whole file, then decode only as far as needed
+    if ((size_t) st.st_size > r->input_size) {
+        unsigned char *p = realloc(r->input, st.st_size);
+        if (!p) {
+            close(fd);
+            return -1;
+        }
+        r->input = p;
+        r->input_size = st.st_size;
+    }
+    memcpy(r->input, magic, rw);
+    length = read_whole(fd, r->input + rw, st.st_size - rw);
+    close(fd);
+    if (length < 0) {
+        perror(filename);
+        return -1;
+    }
+    length += rw;
+
+    copy.window = window;
+    copy.row_bytes = (size_t) x*size;
+    copy.size = size;
+    copy.out = out;
+    copy.position = 0;
+    copy.end = ((unsigned long long) (window->y1 - 1)*x + window->x1)*size;
+    length = decompress_stream(r->decompressor, compression, r->input, length, copy_window, &copy);
+    if (length < 0) {
+        fprintf(stderr, "%s: corrupt %s data\n", filename, compression_name(compression));
+        return -1;
+    }
+    count_bytes(length);
+    if (copy.position < copy.end) {
         fprintf(stderr, "Problem reading %s\n", filename);
-        fprintf(stderr, "%d/%d doubles read\n", rw, x*y);
-        free(sheet[0]);
-        free(sheet);
-        gzclose(sheet_file);
+        fprintf(stderr, "%ld/%d values read\n", (long) (copy.position/size), x*y);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_binary_window(read_context_t *r, int x, int y, size_t size,
+        const sheet_window_t *window, float ** E, const char * filename) {
+// reads the window of a sheet of floats (size 4) or doubles (size 8) into E
+    const tip_kernels_t *kernels = tip_kernels();
+    int j, width = window->x1 - window->x0;
+
+    if (0 != reserve_staging(r, size*width*(window->y1 - window->y0))) {
+        return -1;
+    }
+    if (0 != load_window(r, filename, x, y, size, window, r->staging)) {
         return -1;
     }
 
-    for (j = 0; j < y; ++j) {
-        for (i = 0; i < x; ++i) {
-            E[j][i] = (float) sheet[j][i];
+    for (j = 0; j < window->y1 - window->y0; ++j) {
+        if (sizeof(float) == size) {
+            memcpy(E[j], r->staging + (size_t) j*width*size, width*size);
+        } else {
+            kernels->convert_row((double *) r->staging + (size_t) j*width, E[j], width);
         }
     }
+    return 0;
+}
 
-    free(sheet[0]);
-    free(sheet);
+static int read_binary_float_sheet(read_context_t *r, int x, int y, float ** E,
+        const char * filename) {
+    unsigned char *target;
+    size_t size = sizeof(float)*x*y;
+    int contiguous = sheet_is_contiguous(E, y, x, sizeof(float));
+    long rw;
+    int j;
+
+    // decoded straight into the frame buffer, unless its rows are padded
+    if (contiguous) {
+        target = (unsigned char *) E[0];
+    } else {
+        if (0 != reserve_staging(r, size)) {
+            return -1;
+        }
+        target = r->staging;
+    }
+
+    rw = load_file(r, filename, &target, &size, 0);
+    if (rw < 0) {
+        return -1;
+    }
+    if (rw != x*y*sizeof(float)) {
+        fprintf(stderr, "Problem reading %s\n", filename);
+        fprintf(stderr, "%ld/%d floats read\n", rw/(long) sizeof(float), x*y);
+        return -1;
+    }
+
+    if (!contiguous) {
+        for (j = 0; j < y; ++j) {
+            memcpy(E[j], r->staging + (size_t) j*x*sizeof(float), x*sizeof(float));
+        }
+    }
 
-    gzclose(sheet_file);
     return 0;
 }
 
-static int read_text_sheet(int x, int y, float ** E, const char * filename) {
-    gzFile sheet_file;
-    char *buffer, *c, *pos, *prev_pos;
-    size_t i, j;
+static int read_binary_double_sheet(read_context_t *r, int x, int y, float ** E,
+        const char * filename) {
+    unsigned char *target;
+    size_t size = sizeof(double)*x*y;
+    const tip_kernels_t *kernels = tip_kernels();
+    double *sheet;
+    long rw;
+    int j;
 
-    sheet_file = gzopen(filename, "r");
+    if (0 != reserve_staging(r, size)) {
+        return -1;
+    }
+    target = r->staging;
 
-    if (!sheet_file) {
-        perror(filename);
+    rw = load_file(r, filename, &target, &size, 0);
+    if (rw < 0) {
+        return -1;
+    }
+    if (rw != x*y*sizeof(double)) {
+        fprintf(stderr, "Problem reading %s\n", filename);
+        fprintf(stderr, "%ld/%d doubles read\n", rw/(long) sizeof(double), x*y);
         return -1;
     }
 
-    // allocate a 1mb buffer
-    buffer = calloc(BUFSIZE, sizeof(char));
-    if (!buffer) {
-        gzclose(sheet_file);
+    sheet = (double *) r->staging;
+    for (j = 0; j < y; ++j) {
+        kernels->convert_row(sheet + (size_t) j*x, E[j], x);
+    }
+
+    return 0;
+}
+
+static char * skip_values(char *pos, int n) {
+// skips n whitespace separated values, without converting them
+    while (n-- > 0) {
+        pos += strspn(pos, " \t\r\v\f");
+        pos += strcspn(pos, " \t\r\v\f");
+    }
+    return pos;
+}
+
+static int read_text_sheet(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char * filename) {
+    char *buffer, *end, *line_end, *pos, *prev_pos;
+    size_t i, j;
+    long rw;
+    int x0 = 0, x1 = x, y0 = 0, y1 = y;
+
+    // only the lines and values within the window are converted
+    if (window) {
+        x0 = window->x0;
+        x1 = window->x1;
+        y0 = window->y0;
+        y1 = window->y1;
+    }
+
+    // decompress the whole file into the staging buffer, growing as needed
+    if (0 != reserve_staging(r, BUFSIZE)) {
+        return -1;
+    }
+    rw = load_file(r, filename, &r->staging, &r->staging_size, 1);
+    if (rw < 0) {
+        return -1;
+    }
+    // and terminate it, so strtod can't run off the end
+    if (0 != reserve_staging(r, rw + 1)) {
         return -1;
     }
+    r->staging[rw] = 0;
+
+    buffer = (char *) r->staging;
+    end = buffer + rw;
 
     // zero our counters
     i = j = 0;
 
-    while (j < y) {
-        // read in a line
-        c = gzgets(sheet_file, buffer, BUFSIZE);
-
-        // check we were successful.
-        if (Z_NULL == c) {
-            fprintf(stderr, "Error reading from '%s' on line %lu\n", filename, j);
-            free(buffer);
-            gzclose(sheet_file);
-            return -1;
+    while (j < y1) {
+        // find the end of the line
+        if (buffer >= end) {
+            break;
+        }
+        line_end = memchr(buffer, '\n', end - buffer);
+        if (line_end) {
+            *line_end = 0;
+        } else {
+            line_end = end;
+        }
+        if (j < y0) {
+            ++j;
+            buffer = line_end + 1;
+            continue;
         }
 
-        pos = buffer;
+        pos = skip_values(buffer, x0);
         prev_pos = 0;
-        i = 0;
-        while ((i < x) && (prev_pos != pos)) {
+        i = x0;
+        while ((i < x1) && (prev_pos != pos)) {
             // assign the previous position to prev_pos
             // this will be used to tell when we have the last float in the
             // line.
             prev_pos = pos;
 
             // read the float from the buffer line
-            E[j][i] = (float) strtod(pos, &pos);
+            E[j - y0][i - x0] = (float) strtod(pos, &pos);
 
             ++i;
         }
 
         // check we read in all we should.
-        if (i != x) {
-            fprintf(stderr, "Error reading from '%s' on line %lu.  %lu/%d floats read\n", filename, j, i, x);
-            free(buffer);
-            gzclose(sheet_file);
+        if (i != x1) {
+            fprintf(stderr, "Error reading from '%s' on line %lu.  %lu/%d floats read\n", filename, j, i, x1);
             return -1;
         }
 
         ++j;
-
-        // if we've reached the end of the file, break.
-        if (gzeof(sheet_file))
-            break;
+        buffer = line_end + 1;
     }
 
     // check we read in all we should.
-    if (j != y) {
-        fprintf(stderr, "Error reading from '%s'. %lu/%d lines read\n", filename, j, y);
-        free(buffer);
-        gzclose(sheet_file);
+    if (j != y1) {
+        fprintf(stderr, "Error reading from '%s'. %lu/%d lines read\n", filename, j, y1);
         return -1;
     }
 
-    // cleanup, and return.
-    free(buffer);
-    gzclose(sheet_file);
+    return 0;
+}
 
+static int read_archive_frame(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char * reference) {
+// reads frame N of an archive, given a reference of the form PATH@N.  The
+// most recently used archive is kept open in the context, so walking through
+// the frames of one archive only opens it once.  Frames are compressed
+// whole, so a window is cut from the whole frame.
+    int j;
+    const char *at;
+    char *end;
+    long frame;
+
+    at = strrchr(reference, '@');
+    if (!at) {
+        fprintf(stderr, "'%s' is not of the form ARCHIVE@FRAME\n", reference);
+        return -1;
+    }
+    frame = strtol(at + 1, &end, 10);
+    if ((end == at + 1) || (*end != 0)) {
+        fprintf(stderr, "'%s' is not of the form ARCHIVE@FRAME\n", reference);
+        return -1;
+    }
+
+    if (!r->archive_path || (strlen(r->archive_path) != (size_t)(at - reference))
+            || (0 != strncmp(r->archive_path, reference, at - reference))) {
+        frame_archive_close(r->archive);
+        free(r->archive_path);
+        r->archive_path = strndup(reference, at - reference);
+        if (!r->archive_path) {
+            r->archive = NULL;
+            return -1;
+        }
+        r->archive = frame_archive_open(r->archive_path);
+    }
+
+    if (!r->archive) {
+        return -1;
+    }
+
+    if (window) {
+        if (!r->whole || (r->whole_x != x) || (r->whole_y != y)) {
+            sheet_free(r->whole);
+            r->whole = sheet_alloc_f(y, x, 0);
+            if (!r->whole) {
+                return -1;
+            }
+            r->whole_x = x;
+            r->whole_y = y;
+        }
+        if (0 != frame_archive_read(r->archive, frame, x, y, r->whole)) {
+            return -1;
+        }
+        for (j = window->y0; j < window->y1; ++j) {
+            memcpy(E[j - window->y0], r->whole[j] + window->x0,
+                    (window->x1 - window->x0)*sizeof(float));
+        }
+    } else if (0 != frame_archive_read(r->archive, frame, x, y, E)) {
+        return -1;
+    }
+    count_bytes((unsigned long long) x * y
+        * ((BINARY_DOUBLE == r->archive->sample_type) ? sizeof(double) : sizeof(float)));
+    return 0;
+}
+
+long read_file_raw(read_context_t *r, const char *filename, void *buffer, size_t size) {
+// reads a file's bytes, decompressed, into a fixed buffer
+    unsigned char *out = buffer;
+
+    if (!r) {
+        if (!shared && !(shared = new_read_context())) {
+            return -1;
+        }
+        r = shared;
+    }
+    return load_file(r, filename, &out, &size, 0);
+}
+
+static int read_frame_file_frame(read_context_t *r, int x, int y, const sheet_window_t *window,
+        float ** E, const char * reference) {
+// reads a frame of an .npy or IGB file, given a reference PATH@N, or PATH
+// for its first frame.  As with archives, the most recently used file is
+// kept open (and mapped), so a run held in one file is opened once and each
+// frame copied straight out of the mapping.
+    size_t length;
+    long frame;
+
+    length = frame_file_path(reference, &frame);
+    if (!r->file_path || (strlen(r->file_path) != length)
+            || (0 != strncmp(r->file_path, reference, length))) {
+        frame_file_close(r->file);
+        free(r->file_path);
+        r->file_path = strndup(reference, length);
+        if (!r->file_path) {
+            r->file = NULL;
+            return -1;
+        }
+        r->file = frame_file_open(r->file_path);
+    }
+
+    if (!r->file) {
+        return -1;
+    }
+    if (0 != frame_file_read(r->file, frame, x, y, window, E)) {
+        fprintf(stderr, "Problem reading %s\n", reference);
+        return -1;
+    }
+    if (window) {
+        count_bytes((unsigned long long) (window->x1 - window->x0)
+            * (window->y1 - window->y0) * r->file->sample_size);
+    } else {
+        count_bytes((unsigned long long) x * y * r->file->sample_size);
+    }
     return 0;
 }
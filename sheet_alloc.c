@@ -0,0 +1,85 @@
+/*
+ * sheet_alloc.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sheet_alloc.h"
+
+// sheets at least this big are worth backing with huge pages
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+static size_t round_up(size_t size, size_t multiple) {
+// rounds size up to a multiple of multiple
+    return ((size + multiple - 1)/multiple)*multiple;
+}
+
+void ** sheet_alloc(int rows, int cols, size_t element_size, int flags) {
+// allocates a rows by cols sheet of elements of the given size.
+    size_t row_bytes, table_bytes, total, alignment = SHEET_ALIGNMENT;
+    char *data;
+    void **sheet;
+    int j;
+
+    if (rows < 1 || cols < 1) {
+        return NULL;
+    }
+
+    row_bytes = (size_t) cols * element_size;
+    if (flags & SHEET_PAD) {
+        // rows a multiple of a page long would all fall in the same cache
+        // sets; any other row is left as it is, keeping the sheet contiguous
+        row_bytes = SHEET_PADDED_ROW_BYTES(cols, element_size);
+    }
+
+    // the row table comes first, so the sheet can be freed through it
+    table_bytes = round_up(rows*sizeof(void *), SHEET_ALIGNMENT);
+    total = table_bytes + rows*row_bytes;
+
+    if ((flags & SHEET_HUGE) && (total >= HUGE_PAGE_SIZE)) {
+        alignment = HUGE_PAGE_SIZE;
+        total = round_up(total, HUGE_PAGE_SIZE);
+    }
+
+    if (0 != posix_memalign((void **) &sheet, alignment, total)) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE) {
+        // only advice; carry on with normal pages if it's refused
+        madvise(sheet, total, MADV_HUGEPAGE);
+    }
+#endif
+
+    data = (char *) sheet + table_bytes;
+    for (j = 0; j < rows; ++j) {
+        sheet[j] = data + j*row_bytes;
+    }
+
+    return sheet;
+}
+
+void sheet_free(void *sheet) {
+// frees a sheet from sheet_alloc.  NULL is ignored.
+    free(sheet);
+}
+
+size_t sheet_stride(void *sheet, int rows, int cols, size_t element_size) {
+// returns the number of elements from the start of one row to the next.
+    char **s = sheet;
+
+    if (rows < 2) {
+        return cols;
+    }
+    return (s[1] - s[0])/element_size;
+}
+
+int sheet_is_contiguous(void *sheet, int rows, int cols, size_t element_size) {
+// returns 1 if the rows of the sheet follow each other with no padding
+    return sheet_stride(sheet, rows, cols, element_size) == (size_t) cols;
+}
@@ -0,0 +1,67 @@
+/*
+ * sheet_alloc.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Allocation of 2D sheets, accessible through sheet[j][i] notation like the
+ * F_ARRAY_2D family of macros in helper.h, but
+ *
+ *  - the sheet starts on a 64 byte (cache line) boundary, and so does every
+ *    row whose length is a whole number of cache lines;
+ *  - rows can be padded, so that sheets whose rows are a multiple of a page
+ *    long don't map every row to the same cache sets.  Other rows are left
+ *    unpadded, so that the sheet stays contiguous and whole frames can be
+ *    decoded straight into it;
+ *  - large sheets can be backed by transparent huge pages;
+ *  - the row pointer table and the data are a single allocation, released
+ *    with sheet_free.
+ *
+ * Padded sheets are not contiguous: use sheet_stride, not x, to step from
+ * one row to the next through sheet[0], or sheet_is_contiguous to check.
+ *
+ * Memory is not touched on allocation.  On NUMA machines it should first be
+ * written by the threads that will use it, band by band, as tip_tracer_t's
+ * band threads do for their own rows.
+ */
+
+#ifndef SHEET_ALLOC_H
+#define SHEET_ALLOC_H
+
+#include <stddef.h>
+
+#define SHEET_ALIGNMENT (64)
+
+// bytes in each row of a SHEET_PAD sheet: a cache line more than the row
+// when the row is a multiple of a page, which would alias, and otherwise the
+// row alone.  A constant expression, given constant arguments.
+#define SHEET_PADDED_ROW_BYTES(cols, element_size) \
+    ((size_t) (cols)*(element_size) \
+     + ((0 == ((size_t) (cols)*(element_size)) % 4096) ? SHEET_ALIGNMENT : 0))
+
+// allocation flags
+#define SHEET_PAD   (1)     // pad rows that would alias in the cache
+#define SHEET_HUGE  (2)     // use transparent huge pages for large sheets
+
+void ** sheet_alloc(int rows, int cols, size_t element_size, int flags);
+// allocates a rows by cols sheet of elements of the given size.
+//
+// returns:
+//  the row pointer table, or NULL on failure
+
+#define sheet_alloc_f(rows, cols, flags) \
+    ((float **) sheet_alloc((rows), (cols), sizeof(float), (flags)))
+#define sheet_alloc_d(rows, cols, flags) \
+    ((double **) sheet_alloc((rows), (cols), sizeof(double), (flags)))
+#define sheet_alloc_uc(rows, cols, flags) \
+    ((unsigned char **) sheet_alloc((rows), (cols), sizeof(unsigned char), (flags)))
+
+void sheet_free(void *sheet);
+// frees a sheet from sheet_alloc.  NULL is ignored.
+
+size_t sheet_stride(void *sheet, int rows, int cols, size_t element_size);
+// returns the number of elements from the start of one row to the next.
+// Works for any row pointer table, including those from helper.h.
+
+int sheet_is_contiguous(void *sheet, int rows, int cols, size_t element_size);
+// returns 1 if the rows of the sheet follow each other with no padding
+
+#endif // SHEET_ALLOC_H
@@ -0,0 +1,288 @@
+/*
+ * telemetry.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+// size of a status report
+#define REPORT_SIZE (1024)
+
+static double now(void) {
+// monotonic time in seconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void take_sample(telemetry_t *t, double time) {
+// adds the current counters to the ring of samples
+    telemetry_sample_t *s = &t->samples[t->next_sample];
+
+    s->time = time;
+    s->frames = atomic_load_explicit(&t->frames_done, memory_order_relaxed);
+    s->bytes = atomic_load_explicit(&t->bytes_decoded, memory_order_relaxed);
+
+    t->next_sample = (t->next_sample + 1) % t->msamples;
+    if (t->nsamples < t->msamples)
+        t->nsamples++;
+}
+
+static void window_rates(telemetry_t *t, double window, double *frames, double *bytes) {
+// rates over (roughly) the last window seconds, from the oldest sample in it
+    int latest = (t->next_sample + t->msamples - 1) % t->msamples;
+    int n, k, oldest = latest;
+    double elapsed;
+
+    for (n = 1; n < t->nsamples; ++n) {
+        k = (latest + t->msamples - n) % t->msamples;
+        if (t->samples[latest].time - t->samples[k].time > window)
+            break;
+        oldest = k;
+    }
+
+    elapsed = t->samples[latest].time - t->samples[oldest].time;
+    if (elapsed <= 0.0) {
+        *frames = *bytes = 0.0;
+        return;
+    }
+    *frames = (t->samples[latest].frames - t->samples[oldest].frames)/elapsed;
+    *bytes = (t->samples[latest].bytes - t->samples[oldest].bytes)/elapsed;
+}
+
+static int format_report(telemetry_t *t, char *report, size_t size) {
+// writes the key/value report for the latest sample
+    double fps_10, fps_60, bps_10, bps_60, eta = -1.0;
+    int latest = (t->next_sample + t->msamples - 1) % t->msamples;
+    long done = t->samples[latest].frames;
+
+    window_rates(t, 10.0, &fps_10, &bps_10);
+    window_rates(t, TELEMETRY_WINDOW, &fps_60, &bps_60);
+    if (fps_60 > 0.0) {
+        eta = (t->frames_total - done)/fps_60;
+    }
+
+    return snprintf(report, size,
+            "frames_done %ld\n"
+            "frames_total %ld\n"
+            "fraction_done %.4f\n"
+            "elapsed_s %.1f\n"
+            "frames_per_s_10s %.2f\n"
+            "frames_per_s_60s %.2f\n"
+            "mb_per_s_10s %.2f\n"
+            "mb_per_s_60s %.2f\n"
+            "frame_latency_ms %.3f\n"
+            "eta_s %.0f\n"
+            "read_errors %ld\n"
+            "too_many_tips %ld\n",
+            done, t->frames_total,
+            t->frames_total > 0 ? (double) done/t->frames_total : 1.0,
+            t->samples[latest].time - t->start,
+            fps_10, fps_60, bps_10/1048576.0, bps_60/1048576.0,
+            1e-6*atomic_load_explicit(&t->frame_ns, memory_order_relaxed),
+            eta,
+            atomic_load_explicit(&t->read_errors, memory_order_relaxed),
+            atomic_load_explicit(&t->tip_overflows, memory_order_relaxed));
+}
+
+static void write_status_file(const char *filename, const char *report) {
+// replaces the status file, via a rename so readers never see half a report
+    char temporary[4096];
+    FILE *file;
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+    file = fopen(temporary, "w");
+    if (!file) {
+        return;
+    }
+    fputs(report, file);
+    if (0 == fclose(file)) {
+        rename(temporary, filename);
+    }
+}
+
+static void publish(telemetry_t *t, char *report) {
+// samples the counters and rewrites the status file
+    take_sample(t, now());
+    format_report(t, report, REPORT_SIZE);
+    if (t->status_file) {
+        write_status_file(t->status_file, report);
+    }
+}
+
+static void * telemetry_thread(void *arg) {
+// reports every interval, answering socket connections in between
+    telemetry_t *t = arg;
+    char report[REPORT_SIZE];
+    struct pollfd pfd;
+    double next = now();
+    int timeout, client;
+
+    publish(t, report);
+    next += t->interval;
+
+    while (!atomic_load(&t->stop)) {
+        timeout = (int) (1000.0*(next - now()));
+        if (timeout < 0)
+            timeout = 0;
+        // wake up at least every 100ms to check for stop
+        if (timeout > 100)
+            timeout = 100;
+
+        if (t->listen_fd >= 0) {
+            pfd.fd = t->listen_fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, timeout) > 0) {
+                client = accept(t->listen_fd, NULL, NULL);
+                if (client >= 0) {
+                    if (write(client, report, strlen(report)) < 0) {
+                        // the client went away; nothing to do
+                    }
+                    close(client);
+                }
+            }
+        } else {
+            poll(NULL, 0, timeout);
+        }
+
+        if (now() >= next) {
+            publish(t, report);
+            next += t->interval;
+        }
+    }
+
+    return NULL;
+}
+
+static int open_socket(const char *path) {
+// listens on a Unix-domain socket at path, replacing any stale socket
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    if ((0 != bind(fd, (struct sockaddr *) &address, sizeof(address)))
+            || (0 != listen(fd, 8))) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+telemetry_t * telemetry_start(const char *status_file, const char *socket_path,
+        double interval, long frames_total) {
+// starts reporting progress every interval seconds
+    telemetry_t *t;
+
+    t = calloc(1, sizeof(telemetry_t));
+    if (!t) {
+        return NULL;
+    }
+
+    atomic_init(&t->frames_done, 0);
+    atomic_init(&t->bytes_decoded, 0);
+    atomic_init(&t->read_errors, 0);
+    atomic_init(&t->tip_overflows, 0);
+    atomic_init(&t->frame_ns, 0);
+    atomic_init(&t->stop, 0);
+    t->frames_total = frames_total;
+    t->status_file = status_file;
+    t->socket_path = socket_path;
+    t->interval = (interval > 0.0) ? interval : 1.0;
+    t->start = now();
+    t->listen_fd = -1;
+
+    // the ring spans the longest window however short the interval
+    t->msamples = (int) ceil(TELEMETRY_WINDOW/t->interval) + 1;
+    t->samples = calloc(t->msamples, sizeof(telemetry_sample_t));
+    if (!t->samples) {
+        free(t);
+        return NULL;
+    }
+
+    if (socket_path) {
+        t->listen_fd = open_socket(socket_path);
+        if (t->listen_fd < 0) {
+            free(t->samples);
+            free(t);
+            return NULL;
+        }
+    }
+
+    if (0 != pthread_create(&t->thread, NULL, telemetry_thread, t)) {
+        perror("telemetry");
+        if (t->listen_fd >= 0) {
+            close(t->listen_fd);
+            unlink(socket_path);
+        }
+        free(t->samples);
+        free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void telemetry_frame(telemetry_t *t, long long ns, unsigned long long bytes,
+        int read_error, int tip_overflow) {
+// records a processed frame
+    if (!t) {
+        return;
+    }
+    atomic_store_explicit(&t->frame_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->bytes_decoded, bytes, memory_order_relaxed);
+    if (read_error)
+        atomic_fetch_add_explicit(&t->read_errors, 1, memory_order_relaxed);
+    if (tip_overflow)
+        atomic_fetch_add_explicit(&t->tip_overflows, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->frames_done, 1, memory_order_relaxed);
+}
+
+void telemetry_stop(telemetry_t *t) {
+// publishes a final report, stops the reporting thread and frees t
+    char report[REPORT_SIZE];
+
+    if (!t) {
+        return;
+    }
+
+    atomic_store(&t->stop, 1);
+    pthread_join(t->thread, NULL);
+
+    publish(t, report);
+
+    if (t->listen_fd >= 0) {
+        close(t->listen_fd);
+        unlink(t->socket_path);
+    }
+    free(t->samples);
+    free(t);
+}
@@ -0,0 +1,72 @@
+/*
+ * telemetry.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Progress reporting for long runs.  The processing loop only bumps a few
+ * atomic counters; a background thread samples them every interval and
+ * publishes a small key/value status report, by rewriting a status file
+ * and/or answering connections on a Unix-domain socket, e.g.
+ *
+ *   $ socat - UNIX-CONNECT:/tmp/trace.sock
+ *   frames_done 41000
+ *   frames_total 500000
+ *   frames_per_s_10s 812.4
+ *   ...
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+// longest sliding rate window, in seconds
+#define TELEMETRY_WINDOW (60.0)
+
+typedef struct telemetry_sample {
+    double time;
+    long frames;
+    unsigned long long bytes;
+} telemetry_sample_t;
+
+typedef struct telemetry {
+    // updated by the processing loop
+    atomic_long frames_done;
+    atomic_ullong bytes_decoded;
+    atomic_long read_errors;
+    atomic_long tip_overflows;
+    atomic_llong frame_ns;          // time taken by the latest frame
+    long frames_total;
+
+    // owned by the reporting thread
+    const char *status_file;
+    const char *socket_path;
+    double interval;
+    double start;
+    int listen_fd;
+    atomic_int stop;
+    pthread_t thread;
+    telemetry_sample_t *samples;    // enough to span TELEMETRY_WINDOW
+    int msamples;
+    int nsamples;
+    int next_sample;
+} telemetry_t;
+
+telemetry_t * telemetry_start(const char *status_file, const char *socket_path,
+        double interval, long frames_total);
+// starts reporting progress every interval seconds to status_file and/or
+// socket_path (either may be NULL).
+//
+// returns:
+//  the telemetry, or NULL on failure
+
+void telemetry_frame(telemetry_t *t, long long ns, unsigned long long bytes,
+        int read_error, int tip_overflow);
+// records a processed frame: how long it took, how many bytes were
+// decompressed for it and whether reading it failed or it had too many tips.
+// Safe to call with t == NULL.
+
+void telemetry_stop(telemetry_t *t);
+// publishes a final report, stops the reporting thread and frees t
+
+#endif // TELEMETRY_H
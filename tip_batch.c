@@ -0,0 +1,167 @@
+/*
+ * tip_batch.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tip_batch.h"
+#include "tip_trace.h"
+
+tip_batch_t * tip_batch_create(int x, int y, int members, int max_tips) {
+// creates a batch of members x by y sheets
+    tip_batch_t *b;
+    size_t n = (size_t) x*y*members;
+    int f;
+
+    if ((x < 3) || (y < 3) || (members < 1) || (max_tips < 0)) {
+        return NULL;
+    }
+
+    b = calloc(1, sizeof(tip_batch_t));
+    if (!b) {
+        return NULL;
+    }
+    b->x = x;
+    b->y = y;
+    b->members = members;
+    b->max_tips = max_tips;
+    b->kernels = tip_kernels();
+
+    // the frame before the first is all zero
+    for (f = 0; f < 2; ++f) {
+        b->frames[f] = calloc(n, sizeof(float));
+        b->classes[f] = calloc(n, sizeof(unsigned char));
+        if (!b->frames[f] || !b->classes[f]) {
+            tip_batch_destroy(b);
+            return NULL;
+        }
+    }
+
+    b->tips = malloc(((size_t) members*max_tips + 1)*sizeof(point_t));
+    b->ntips = calloc(members, sizeof(int));
+    b->cells = malloc((size_t) x*members*sizeof(int));
+    if (!b->tips || !b->ntips || !b->cells) {
+        tip_batch_destroy(b);
+        return NULL;
+    }
+    return b;
+}
+
+void tip_batch_configure(tip_batch_t *b, float isoline_1, float isoline_2) {
+// sets the isolines
+    b->isoline_1 = isoline_1;
+    b->isoline_2 = isoline_2;
+}
+
+float * tip_batch_next_frame(tip_batch_t *b) {
+// the older of the two frames, which the next push replaces
+    return b->frames[1 - b->current];
+}
+
+void tip_batch_set_member(const tip_batch_t *b, float *frame, int member, float **sheet) {
+// copies member's sheet into its lanes of an interleaved frame
+    float *lane = frame + member;
+    int i, j;
+
+    for (j = 0; j < b->y; ++j) {
+        for (i = 0; i < b->x; ++i) {
+            *lane = sheet[j][i];
+            lane += b->members;
+        }
+    }
+}
+
+int tip_batch_push_frame(tip_batch_t *b, float *frame) {
+// finds every member's tips between frame and the one pushed before it
+    const int members = b->members, row = b->x*members;
+    const float *E_1, *E_2;
+    const unsigned char *c_1, *c_2;
+    float corners_1[4], corners_2[4];
+    float *rows_1[2] = {corners_1, corners_1 + 2}, *rows_2[2] = {corners_2, corners_2 + 2};
+    point_t line_1[4], line_2[4], tip;
+    int ncells, n, k, i, j, m, total = 0;
+    size_t at;
+
+    b->current = 1 - b->current;
+    if (frame != b->frames[b->current]) {
+        memcpy(b->frames[b->current], frame, (size_t) row*b->y*sizeof(float));
+    }
+
+    // the new frame is classified, and the previous frame's classification
+    // reused unless it was made against a different isoline
+    b->kernels->classify_row(b->frames[b->current], b->isoline_1,
+            b->classes[b->current], row*b->y);
+    b->class_isoline[b->current] = b->isoline_1;
+    b->class_valid[b->current] = 1;
+    if (!b->class_valid[1 - b->current] || (b->class_isoline[1 - b->current] != b->isoline_2)) {
+        b->kernels->classify_row(b->frames[1 - b->current], b->isoline_2,
+                b->classes[1 - b->current], row*b->y);
+        b->class_isoline[1 - b->current] = b->isoline_2;
+        b->class_valid[1 - b->current] = 1;
+    }
+
+    E_1 = b->frames[b->current];
+    E_2 = b->frames[1 - b->current];
+    c_1 = b->classes[b->current];
+    c_2 = b->classes[1 - b->current];
+    memset(b->ntips, 0, members*sizeof(int));
+
+    // the cells find_tips visits, 1 to x-2 in each row, for every member
+    for (j = 1; j < b->y - 1; ++j) {
+        ncells = b->kernels->candidate_lanes(c_1 + (size_t) j*row, c_1 + (size_t) (j+1)*row,
+                c_2 + (size_t) j*row, c_2 + (size_t) (j+1)*row, members, row - members,
+                members, b->cells);
+
+        for (n = 0; n < ncells; ++n) {
+            k = b->cells[n];
+            i = k/members;
+            m = k - i*members;
+
+            // the cell's corners, as a 2 by 2 sheet for find_isoline
+            at = (size_t) j*row + k;
+            corners_1[0] = E_1[at];
+            corners_1[1] = E_1[at + members];
+            corners_1[2] = E_1[at + row];
+            corners_1[3] = E_1[at + row + members];
+            corners_2[0] = E_2[at];
+            corners_2[1] = E_2[at + members];
+            corners_2[2] = E_2[at + row];
+            corners_2[3] = E_2[at + row + members];
+
+            if ((2 == find_isoline(b->isoline_1, rows_1, 0, 0, line_1))
+                    && (2 == find_isoline(b->isoline_2, rows_2, 0, 0, line_2))
+                    && calculate_tip_coordinates(line_1, line_2, &tip)) {
+                if (b->ntips[m] < b->max_tips) {
+                    b->tips[(size_t) m*b->max_tips + b->ntips[m]].x = tip.x + i;
+                    b->tips[(size_t) m*b->max_tips + b->ntips[m]].y = tip.y + j;
+                }
+                b->ntips[m]++;
+                total++;
+            }
+        }
+    }
+    return total;
+}
+
+int tip_batch_get_tips(const tip_batch_t *b, int member, const point_t **tips) {
+// member's tips from the last push
+    *tips = b->tips + (size_t) member*b->max_tips;
+    return (b->ntips[member] > b->max_tips) ? -b->ntips[member] : b->ntips[member];
+}
+
+void tip_batch_destroy(tip_batch_t *b) {
+// frees the batch
+    if (!b) {
+        return;
+    }
+    free(b->frames[0]);
+    free(b->frames[1]);
+    free(b->classes[0]);
+    free(b->classes[1]);
+    free(b->tips);
+    free(b->ntips);
+    free(b->cells);
+    free(b);
+}
@@ -0,0 +1,98 @@
+/*
+ * tip_batch.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Tip tracing of many small sheets at once, for ensembles where every member
+ * is the same size and steps through time together.  One call per frame of
+ * the whole ensemble replaces a find_tips call per member, and the frames
+ * are interleaved, member fastest,
+ *
+ *   frame[(j*x + i)*members + m] = member m's value at (i, j)
+ *
+ * so that a row of every member is one contiguous run of x*members values.
+ * Classifying against the isoline is a single pass over the frame, and the
+ * screen for cells the isolines may cross (tip_kernels' candidate_lanes)
+ * works across members in the vector lanes, which a 64 wide sheet alone
+ * barely fills.  Only the few cells that pass are examined member by member.
+ *
+ * Typical use:
+ *
+ *   tip_batch_t *b = tip_batch_create(64, 64, 1000, 20);
+ *   tip_batch_configure(b, -30, -30);
+ *   while (more frames) {
+ *       float *frame = tip_batch_next_frame(b);
+ *       for (m = 0; m < 1000; ++m)
+ *           tip_batch_set_member(b, frame, m, sheet_of_member[m]);
+ *       tip_batch_push_frame(b, frame);
+ *       for (m = 0; m < 1000; ++m)
+ *           ntips = tip_batch_get_tips(b, m, &tips);
+ *   }
+ *   tip_batch_destroy(b);
+ *
+ * As with tip_tracer_t, each frame pushed is paired with the one before it
+ * (the first with an all zero frame), and every member gets exactly the
+ * tips find_tips would give it, in the same order.
+ */
+
+#ifndef TIP_BATCH_H
+#define TIP_BATCH_H
+
+#include "kernels.h"
+#include "point_t.h"
+
+typedef struct tip_batch {
+    int x;
+    int y;
+    int members;
+    float isoline_1;            // isoline on the frame just pushed
+    float isoline_2;            // isoline on the previous frame
+    int max_tips;               // stored for each member
+    const tip_kernels_t *kernels;
+
+    float *frames[2];           // frames[current] is the latest frame
+    unsigned char *classes[2];  // vertex classification of each frame
+    float class_isoline[2];     // isoline each classification was made at
+    int class_valid[2];
+    int current;
+
+    point_t *tips;              // max_tips for each member
+    int *ntips;                 // as find_tips returns, for each member
+    int *cells;                 // candidate lanes of the row being scanned
+} tip_batch_t;
+
+tip_batch_t * tip_batch_create(int x, int y, int members, int max_tips);
+// creates a batch of members x by y sheets, with both isolines at 0 and
+// room for max_tips tips for each member
+//
+// returns:
+//  the batch, or NULL on failure
+
+void tip_batch_configure(tip_batch_t *b, float isoline_1, float isoline_2);
+// sets the isolines.  May be called again between frames.
+
+float * tip_batch_next_frame(tip_batch_t *b);
+// returns the buffer the next frame should be written into, interleaved as
+// above.  Filling this and pushing it avoids any copy.
+
+void tip_batch_set_member(const tip_batch_t *b, float *frame, int member, float **sheet);
+// copies member's sheet[y][x] into its lanes of an interleaved frame
+
+int tip_batch_push_frame(tip_batch_t *b, float *frame);
+// adds a frame, copying it in unless it is the buffer from
+// tip_batch_next_frame, and finds every member's tips between it and the
+// previous one.
+//
+// returns:
+//  the total number of tips found, including any that didn't fit
+
+int tip_batch_get_tips(const tip_batch_t *b, int member, const point_t **tips);
+// points tips at member's tips from the last push
+//
+// returns:
+//  as find_tips: the number of tips, or -n if there were n, more than
+//  max_tips, of which the first max_tips are stored
+
+void tip_batch_destroy(tip_batch_t *b);
+// frees the batch.  NULL is ignored.
+
+#endif // TIP_BATCH_H
@@ -0,0 +1,78 @@
+/*
+ * tip_mask.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <stdlib.h>
+
+#include "tip_mask.h"
+
+static int valid_cell(float **tissue, int i, int j) {
+// whether all four corners of cell (j, i) are tissue
+    return (0.0 != tissue[j][i]) && (0.0 != tissue[j][i+1])
+        && (0.0 != tissue[j+1][i]) && (0.0 != tissue[j+1][i+1]);
+}
+
+tip_mask_t * tip_mask_create(int x, int y, float **tissue) {
+// compiles a mask from tissue[y][x], non-zero where there is tissue
+    tip_mask_t *mask;
+    tip_mask_run_t *runs;
+    int i, j, first, nruns = 0, mruns = 64;
+
+    if ((x < 2) || (y < 2)) {
+        return NULL;
+    }
+
+    mask = calloc(1, sizeof(tip_mask_t));
+    if (!mask) {
+        return NULL;
+    }
+    mask->x = x;
+    mask->y = y;
+    mask->row_runs = malloc(y*sizeof(int));
+    mask->runs = malloc(mruns*sizeof(tip_mask_run_t));
+    if (!mask->row_runs || !mask->runs) {
+        tip_mask_destroy(mask);
+        return NULL;
+    }
+
+    for (j = 0; j < y - 1; ++j) {
+        mask->row_runs[j] = nruns;
+        for (i = 0; i < x - 1; ) {
+            if (!valid_cell(tissue, i, j)) {
+                ++i;
+                continue;
+            }
+            first = i;
+            while ((i < x - 1) && valid_cell(tissue, i, j))
+                ++i;
+
+            if (nruns >= mruns) {
+                mruns *= 2;
+                runs = realloc(mask->runs, mruns*sizeof(tip_mask_run_t));
+                if (!runs) {
+                    tip_mask_destroy(mask);
+                    return NULL;
+                }
+                mask->runs = runs;
+            }
+            mask->runs[nruns].first = first;
+            mask->runs[nruns].end = i;
+            mask->ncells += i - first;
+            nruns++;
+        }
+    }
+    mask->row_runs[y - 1] = nruns;
+
+    return mask;
+}
+
+void tip_mask_destroy(tip_mask_t *mask) {
+// frees the mask
+    if (!mask) {
+        return;
+    }
+    free(mask->row_runs);
+    free(mask->runs);
+    free(mask);
+}
@@ -0,0 +1,39 @@
+/*
+ * tip_mask.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Tissue masks, for sheets where part of the grid isn't tissue (holes,
+ * vessels, irregular outlines).  A mask is compiled once into runs of valid
+ * cells, those with tissue at all four corners, for each row of cells, so
+ * tip detection visits only the tissue and never sees the spurious isoline
+ * crossings at its boundary.
+ */
+
+#ifndef TIP_MASK_H
+#define TIP_MASK_H
+
+typedef struct tip_mask_run {
+    int first;                  // first valid cell of the run
+    int end;                    // one past the last
+} tip_mask_run_t;
+
+typedef struct tip_mask {
+    int x;
+    int y;
+    int *row_runs;              // runs of cell row j are row_runs[j] up to row_runs[j+1]
+    tip_mask_run_t *runs;
+    long ncells;                // number of valid cells
+} tip_mask_t;
+
+tip_mask_t * tip_mask_create(int x, int y, float **tissue);
+// compiles a mask from tissue[y][x], non-zero where there is tissue.  Cell
+// (j, i) is valid if tissue[j][i], tissue[j][i+1], tissue[j+1][i] and
+// tissue[j+1][i+1] are all tissue.
+//
+// returns:
+//  the mask, or NULL on failure
+
+void tip_mask_destroy(tip_mask_t *mask);
+// frees the mask
+
+#endif // TIP_MASK_H
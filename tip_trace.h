@@ -13,6 +13,7 @@
 #define TIP_TRACE_H
 
 #include "point_t.h"
+#include "tip_mask.h"
 
 int find_tips(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
         float isoline_2, int ntips, point_t * tips);
@@ -37,6 +38,23 @@ int find_tips(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
 //  0:              No tips found
 //  >0:             Number of tips found.
 
+int find_tips_masked(int x, int y, float ** sheet_1, float isoline_1, float ** sheet_2,
+        float isoline_2, const tip_mask_t * mask, int ntips, point_t * tips);
+// as find_tips, but only looking in the cells valid in mask (see tip_mask.h),
+// which must be for x by y sheets.  A NULL mask looks everywhere.
+
+int find_phase_singularities(int x, int y, float ** phase, const tip_mask_t * mask,
+        int ntips, point_t * tips, int * charges);
+// finds phase singularities on a sheet of phases (in radians, e.g. from a
+// Hilbert transform over time), the cells around whose corners the phase
+// winds through a whole turn.  Each is reported at the centre of its cell,
+// with its charge, +1 for anticlockwise winding or -1 for clockwise, in
+// charges (if not NULL).  Only the cells find_tips_masked would look at are
+// considered; mask may be NULL.
+//
+// returns:
+//  as find_tips
+
 
 int find_isoline(float isoline, float ** E, int i, int j, point_t * intercepts);
 // this method finds if an isoline crosses the cell considered.  If we
@@ -8,19 +8,65 @@
 #ifndef TIP_TRACE_BINARY_H
 #define TIP_TRACE_BINARY_H
 #include <stdio.h>
-#include "utils/string_list.h"
+#include "utils/frame_list.h"
+#include "telemetry.h"
+#include "trajectory_stats.h"
+#include "activation_map.h"
+#include "tip_mask.h"
 
 typedef enum file_type {
     BINARY_FLOAT,
     BINARY_DOUBLE,
-    TEXT
+    TEXT,
+    ARCHIVE,
+    FRAME_FILE              // .npy or IGB, see frame_file.h
 } file_type_t;
 
-void process_file_list(int x, int y, float dt, float isoline, string_list_t *list,
-        file_type_t file_type, FILE *output);
+typedef struct sheet_window {
+    int x0;                 // columns x0 to x1 - 1
+    int x1;
+    int y0;                 // rows y0 to y1 - 1
+    int y1;
+} sheet_window_t;
+
+typedef struct process_options {
+    long first_frame;       // first frame to report tips for
+    long end_frame;         // one past the last frame to report, <0 for all
+    const char *checkpoint; // file to record progress in, or NULL
+    long checkpoint_every;  // frames between checkpoints
+    telemetry_t *telemetry; // progress reporting, or NULL
+    trajectory_stats_t *stats; // per-trajectory summaries, or NULL
+    int write_trace;        // write every tip to the output
+    int nthreads;           // threads to search each frame with
+    FILE *contours;         // isoline fronts of each frame, or NULL
+    activation_map_t *activation; // per-pixel activation times, or NULL
+    long activation_every;  // frames between writing the map, 0 for at the end
+    struct frame_cache *cache; // cached tips, or NULL
+    const tip_mask_t *mask; // cells to search, or NULL for all
+    long stride;            // frames between samples, 1 to trace every frame
+    float refine_distance;  // tip motion between samples that needs no refining
+    long long phase_memory; // bytes the phase engine may use
+    const char *scratch;    // directory for the phase engine's scratch file, or NULL
+    const sheet_window_t *roi; // the part of the sheet to trace, or NULL for all
+    long long serve_memory; // bytes the query server may keep frames in
+    int serve_workers;      // threads answering query server connections
+    int quantise;           // query server keeps frames as 16 bit levels
+} process_options_t;
+
+void default_process_options(process_options_t *options);
+// fills in options to process every frame, writing every tip, without
+// checkpoints or summaries
+
+void process_file_list(int x, int y, float dt, float isoline, frame_list_t *list,
+        file_type_t file_type, FILE *output, const process_options_t *options);
 // given the dimensions of the tissue and a list of filenames, process each one
 // in turn, printing the tip trace to the give output file.
 //
+// Only frames first_frame up to end_frame are reported, times still being
+// index*dt, so a run can be split into shards by frame range.  Frame n is
+// paired with frame n-1, which is read first when a shard starts part way
+// through the list, so each pair is handled by exactly one shard.
+//
 // arguments:
 //  x:          x dimension of the sheet
 //  y:          y dimension of the sheet
@@ -29,19 +75,105 @@ void process_file_list(int x, int y, float dt, float isoline, string_list_t *lis
 //  list:       list of filenames to process
 //  file_type:  Type of files in the list
 //  output:     file pointer to output too.
+//  options:    frame range and checkpointing, NULL for the defaults
+
+
+struct frame_bus;
+
+void publish_file_list(int x, int y, frame_list_t *list, file_type_t file_type,
+        struct frame_bus *bus, const process_options_t *options);
+// decodes frames first_frame up to end_frame of the list into a frame bus
+// (see frame_bus.h) for other processes to trace, instead of tracing them.
+// Only the frame range and telemetry options are used.  Returns once the
+// last frame is published; destroying the bus then tells consumers it's over.
+
+long process_frame_bus(float dt, float isoline, struct frame_bus *bus, FILE *output,
+        const process_options_t *options);
+// traces the frames published on a bus as a consumer, until the producer
+// finishes.  Frame n is paired with the last frame published before it, and
+// reported at time n*dt.  The frame range, checkpoint, cache, stride and
+// window options are ignored, the producer deciding which frames there are.
+//
+// returns:
+//  the number of frames traced
+//  <0: the bus failed, or the producer died, before the last frame
+
+
+void process_ensemble(int x, int y, float dt, float isoline, frame_list_t **members,
+        const long *member_ids, int nmembers, file_type_t file_type, FILE *output,
+        const process_options_t *options);
+// as process_file_list, for an ensemble of nmembers runs of x by y sheets,
+// members[m] listing the frames of member m.  Each frame of every member is
+// traced together (see tip_batch.h), and each tip written as
+//
+//   time member x y
+//
+// member being member_ids[m].  Only the frame range, write_trace and
+// telemetry options are used.
+
+
+int write_checkpoint(const char *filename, long frame, long offset);
+// atomically records that every frame up to and including frame has been
+// written, the output then being offset bytes long.
+//
+// returns:
+//  0:  success
+//  <0: error
+
+int read_checkpoint(const char *filename, long *frame, long *offset);
+// reads back a checkpoint written by write_checkpoint
+//
+// returns:
+//  0:  success
+//  <0: no usable checkpoint
 
 
+typedef struct read_context read_context_t;
+// the buffers, decompression contexts and open archive or frame file a
+// reader keeps between frames.  A context is used by one thread at a time,
+// so threads reading at once each need their own.
+
+read_context_t * new_read_context(void);
+// creates a context for read_file_window.  Returns NULL if out of memory.
+
+void destroy_read_context(read_context_t *r);
+// frees a context.  NULL is ignored.
+
 int read_file(file_type_t file_type, int x, int y, float **sheet, const char *filename);
-// reads in the given file, assigning the values to sheet.
+// reads in the given file, assigning the values to sheet, with a context
+// shared by every read_file call, so from one thread at a time.
 //
 // file_type:   Type of files in the list
 // x:           x dimension of the sheet
 // y:           y dimension of the sheet
 // sheet[y][x]: 2D sheet of floats
-// filename:    filename to open
+// filename:    filename to open.  For ARCHIVE files this is PATH@FRAME, and
+//              for FRAME_FILE files PATH@FRAME or PATH for the first frame.
 //
 // returns:
 //  0:  success
 //  <0: error
 
+int read_file_window(read_context_t *r, file_type_t file_type, int x, int y,
+        const sheet_window_t *window, float **sheet, const char *filename);
+// as read_file, but reading only the given window of the x by y frame into
+// sheet[y1-y0][x1-x0] (or all of it, if window is NULL), with context r, or
+// read_file's if r is NULL.  Uncompressed binary files are read a row of the
+// window at a time; compressed ones are decoded a piece at a time, keeping
+// only the window and stopping after its last row; text is only parsed
+// within the window.
+
+long read_file_raw(read_context_t *r, const char *filename, void *buffer, size_t size);
+// reads the contents of filename, uncompressed or decoded as its magic bytes
+// say, into buffer, stopping after size bytes, with context r, or
+// read_file's if r is NULL
+//
+// returns:
+//  >=0:    bytes placed in buffer, fewer than size if the file is shorter
+//  <0:     error
+
+unsigned long long read_file_bytes(void);
+// returns the number of bytes decompressed by read_file and read_file_window
+// so far, in every context
+
 #endif // TIP_TRACE_BINARY_H
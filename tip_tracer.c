@@ -0,0 +1,501 @@
+/*
+ * tip_tracer.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "fixed_kernels.h"
+#include "kernels.h"
+#include "sheet_alloc.h"
+#include "tip_trace.h"
+#include "tip_tracer.h"
+
+#define DEFAULT_MAX_TIPS (20)
+
+static void classify_rows(const tip_kernels_t *kernels, float **E, float isoline,
+        unsigned char **classes, int x, int first_row, int end_row) {
+// classifies each vertex of the given rows against the isoline, using the
+// same arithmetic as find_isoline so that skipping a cell never changes the
+// answer.
+    int j;
+
+    for (j = first_row; j < end_row; ++j) {
+        kernels->classify_row(E[j], isoline, classes[j], x);
+    }
+}
+
+static int may_cross(unsigned char **classes, int i, int j) {
+// whether the isoline can cross cell (j, i), for checking single cells
+    unsigned char c = classes[j][i];
+
+    return (c & TIP_TRACER_ON) || (classes[j][i+1] != c)
+        || (classes[j+1][i+1] != c) || (classes[j+1][i] != c);
+}
+
+static inline int isoline_at(tip_tracer_t *t, float isoline, float **E, int i, int j,
+        point_t *intercepts) {
+// find_isoline, specialised for the sheet size if possible
+    if (t->find_isoline) {
+        return t->find_isoline(isoline, E[j] + i, intercepts);
+    }
+    return find_isoline(isoline, E, i, j, intercepts);
+}
+
+static int row_candidates(tip_tracer_t *t, unsigned char **classes_1,
+        unsigned char **classes_2, int j, int first, int end, int *cells) {
+// stores the cells first <= i < end of row j that both isolines may cross,
+// and that are tissue if there's a mask, returning how many there are
+    const tip_mask_t *mask = t->mask;
+    int r, run_first, run_end, ncells = 0;
+
+    if (!mask) {
+        return t->kernels->candidate_cells(classes_1[j], classes_1[j+1],
+                classes_2[j], classes_2[j+1], first, end, cells);
+    }
+
+    for (r = mask->row_runs[j]; r < mask->row_runs[j+1]; ++r) {
+        run_first = (mask->runs[r].first < first) ? first : mask->runs[r].first;
+        run_end = (mask->runs[r].end > end) ? end : mask->runs[r].end;
+        if (run_first < run_end) {
+            ncells += t->kernels->candidate_cells(classes_1[j], classes_1[j+1],
+                    classes_2[j], classes_2[j+1], run_first, run_end, cells + ncells);
+        }
+    }
+    return ncells;
+}
+
+static void scan_band(tip_tracer_band_t *band) {
+// looks for tips in the band's rows of cells, as find_tips does
+    tip_tracer_t *t = band->tracer;
+    float **sheet_1 = t->frames[t->current];
+    float **sheet_2 = t->frames[1 - t->current];
+    unsigned char **classes_1 = t->classes[t->current];
+    unsigned char **classes_2 = t->classes[1 - t->current];
+    // room for a saddle's four intercepts
+    point_t line_1[4], line_2[4], tip;
+    int i, j, n, ncells;
+
+    band->ntips = 0;
+    for (j = band->first_cell_row; j < band->end_cell_row; ++j) {
+        // only cells where both isolines may cross are worth a look: if all
+        // four corners lie strictly on one side, find_isoline finds nothing
+        ncells = row_candidates(t, classes_1, classes_2, j, 1, t->x - 1, band->cells);
+        for (n = 0; n < ncells; ++n) {
+            i = band->cells[n];
+            if ((2 == isoline_at(t, t->isoline_1, sheet_1, i, j, line_1))
+                    && (2 == isoline_at(t, t->isoline_2, sheet_2, i, j, line_2))
+                    && calculate_tip_coordinates(line_1, line_2, &tip)) {
+                if (band->ntips < t->max_tips) {
+                    band->tips[band->ntips].x = tip.x + (i + t->origin_x);
+                    band->tips[band->ntips].y = tip.y + (j + t->origin_y);
+                }
+                band->ntips++;
+            }
+        }
+    }
+}
+
+static void add_segment(tip_tracer_band_t *band, const point_t *a, const point_t *b, int i, int j) {
+// records a piece of the isoline crossing cell (j, i), in sheet coordinates
+    contour_segment_t *s;
+    const tip_tracer_t *t = band->tracer;
+
+    // the isoline just touching a corner
+    if ((a->x == b->x) && (a->y == b->y))
+        return;
+
+    if (band->nsegments >= band->msegments) {
+        band->msegments = (band->msegments < 64) ? 64 : 2*band->msegments;
+        band->segments = realloc(band->segments, band->msegments*sizeof(contour_segment_t));
+        if (!band->segments) {
+            oops("contour segment alloc failure");
+        }
+    }
+    s = &band->segments[band->nsegments++];
+    s->a.x = a->x + (i + t->origin_x);
+    s->a.y = a->y + (j + t->origin_y);
+    s->b.x = b->x + (i + t->origin_x);
+    s->b.y = b->y + (j + t->origin_y);
+}
+
+static void scan_band_contours(tip_tracer_band_t *band) {
+// as scan_band, but keeping every piece of the new frame's isoline found on
+// the way, including in the cells along the edge the tip search leaves out.
+// The tips found are the same, in the same order.
+    tip_tracer_t *t = band->tracer;
+    float **sheet_1 = t->frames[t->current];
+    float **sheet_2 = t->frames[1 - t->current];
+    unsigned char **classes_1 = t->classes[t->current];
+    unsigned char **classes_2 = t->classes[1 - t->current];
+    point_t line_1[4], line_2[4], tip;
+    int i, j, n, ncells, nintercepts;
+
+    band->ntips = 0;
+    band->nsegments = 0;
+    for (j = band->first_contour_row; j < band->end_cell_row; ++j) {
+        ncells = row_candidates(t, classes_1, classes_1, j, 0, t->x - 1, band->cells);
+        for (n = 0; n < ncells; ++n) {
+            i = band->cells[n];
+            nintercepts = isoline_at(t, t->isoline_1, sheet_1, i, j, line_1);
+            // a saddle is crossed twice
+            if ((2 == nintercepts) || (4 == nintercepts)) {
+                add_segment(band, &line_1[0], &line_1[1], i, j);
+            }
+            if (4 == nintercepts) {
+                add_segment(band, &line_1[2], &line_1[3], i, j);
+            }
+
+            if ((2 != nintercepts) || (0 == i) || (j < band->first_cell_row)
+                    || !may_cross(classes_2, i, j))
+                continue;
+            if ((2 == isoline_at(t, t->isoline_2, sheet_2, i, j, line_2))
+                    && calculate_tip_coordinates(line_1, line_2, &tip)) {
+                if (band->ntips < t->max_tips) {
+                    band->tips[band->ntips].x = tip.x + (i + t->origin_x);
+                    band->tips[band->ntips].y = tip.y + (j + t->origin_y);
+                }
+                band->ntips++;
+            }
+        }
+    }
+}
+
+static void scan(tip_tracer_band_t *band) {
+// looks for tips, and the isoline too if it's wanted
+    if (band->tracer->contours) {
+        scan_band_contours(band);
+    } else {
+        scan_band(band);
+    }
+}
+
+static void classify_band(tip_tracer_band_t *band, int reclassify_previous) {
+// classifies the band's rows of the new frame, and of the previous frame if
+// its classification can't be reused
+    tip_tracer_t *t = band->tracer;
+    int c = t->current;
+
+    classify_rows(t->kernels, t->frames[c], t->isoline_1, t->classes[c], t->x,
+            band->first_row, band->end_row);
+    if (reclassify_previous) {
+        classify_rows(t->kernels, t->frames[1 - c], t->isoline_2, t->classes[1 - c], t->x,
+                band->first_row, band->end_row);
+    }
+}
+
+static int previous_needs_classifying(tip_tracer_t *t) {
+// whether the previous frame's classification is missing or stale
+    int p = 1 - t->current;
+    return !t->class_valid[p] || (t->class_isoline[p] != t->isoline_2);
+}
+
+static void touch_band(tip_tracer_band_t *band) {
+// zeroes the band's rows of the frames and classifications.  Being the
+// first to write them, on NUMA machines this places the band's pages on the
+// node of the thread that will work on them.
+    tip_tracer_t *t = band->tracer;
+    int f, j;
+
+    for (f = 0; f < 2; ++f) {
+        for (j = band->first_row; j < band->end_row; ++j) {
+            memset(t->frames[f][j], 0, t->x*sizeof(float));
+            memset(t->classes[f][j], 0, t->x*sizeof(unsigned char));
+        }
+    }
+}
+
+static void * band_thread(void *arg) {
+// runs one band for every frame pushed, until the tracer stops
+    tip_tracer_band_t *band = arg;
+    tip_tracer_t *t = band->tracer;
+
+    while (1) {
+        pthread_barrier_wait(&t->start);
+        if (t->stop)
+            break;
+        if (!t->touched) {
+            touch_band(band);
+            pthread_barrier_wait(&t->finished);
+            continue;
+        }
+        classify_band(band, previous_needs_classifying(t));
+        pthread_barrier_wait(&t->classified);
+        scan(band);
+        pthread_barrier_wait(&t->finished);
+    }
+
+    return NULL;
+}
+
+static void stop_threads(tip_tracer_t *t) {
+// stops the band threads, and frees the bands
+    int b;
+
+    if (t->nbands > 1) {
+        t->stop = 1;
+        pthread_barrier_wait(&t->start);
+        for (b = 1; b < t->nbands; ++b) {
+            pthread_join(t->threads[b], NULL);
+        }
+        pthread_barrier_destroy(&t->start);
+        pthread_barrier_destroy(&t->classified);
+        pthread_barrier_destroy(&t->finished);
+    }
+    if (t->bands) {
+        for (b = 0; b < t->nbands; ++b) {
+            free(t->bands[b].tips);
+            free(t->bands[b].cells);
+            free(t->bands[b].segments);
+        }
+    }
+    free(t->bands);
+    free(t->threads);
+    t->bands = NULL;
+    t->threads = NULL;
+    t->nbands = 0;
+    t->stop = 0;
+}
+
+static int start_threads(tip_tracer_t *t, int nbands) {
+// splits the sheet into bands, starting a thread for each but the first
+    int b, cell_rows = t->y - 2;
+
+    if (nbands < 1)
+        nbands = 1;
+    // no point in bands with no cells in them
+    if (cell_rows > 0 && nbands > cell_rows)
+        nbands = cell_rows;
+
+    t->bands = calloc(nbands, sizeof(tip_tracer_band_t));
+    t->threads = calloc(nbands, sizeof(pthread_t));
+    if (!t->bands || !t->threads) {
+        return -1;
+    }
+    t->nbands = nbands;
+
+    for (b = 0; b < nbands; ++b) {
+        t->bands[b].tracer = t;
+        t->bands[b].first_row = (long) b * t->y / nbands;
+        t->bands[b].end_row = (long) (b + 1) * t->y / nbands;
+        t->bands[b].first_cell_row = 1 + (long) b * cell_rows / nbands;
+        t->bands[b].end_cell_row = 1 + (long) (b + 1) * cell_rows / nbands;
+        t->bands[b].first_contour_row = (0 == b) ? 0 : t->bands[b].first_cell_row;
+        t->bands[b].tips = malloc((t->max_tips + 1)*sizeof(point_t));
+        t->bands[b].cells = malloc(t->x*sizeof(int));
+        if (!t->bands[b].tips || !t->bands[b].cells) {
+            return -1;
+        }
+    }
+
+    if (nbands > 1) {
+        pthread_barrier_init(&t->start, NULL, nbands);
+        pthread_barrier_init(&t->classified, NULL, nbands);
+        pthread_barrier_init(&t->finished, NULL, nbands);
+        for (b = 1; b < nbands; ++b) {
+            if (0 != pthread_create(&t->threads[b], NULL, band_thread, &t->bands[b])) {
+                oops("tip tracer thread");
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+tip_tracer_t * tip_tracer_create(int x, int y) {
+// creates a tracer for x by y sheets
+    tip_tracer_t *t;
+    int f;
+
+    t = calloc(1, sizeof(tip_tracer_t));
+    if (!t) {
+        return NULL;
+    }
+    t->x = x;
+    t->y = y;
+    t->kernels = tip_kernels();
+
+    // the frames are zeroed (the frame before the first being all zero) by
+    // the band threads on first use
+    for (f = 0; f < 2; ++f) {
+        t->frames[f] = sheet_alloc_f(y, x, SHEET_PAD | SHEET_HUGE);
+        t->classes[f] = sheet_alloc_uc(y, x, SHEET_PAD | SHEET_HUGE);
+        if (!t->frames[f] || !t->classes[f]) {
+            tip_tracer_destroy(t);
+            return NULL;
+        }
+    }
+
+    // both frames are laid out alike
+    t->find_isoline = fixed_find_isoline(x, y, sheet_stride(t->frames[0], y, x, sizeof(float)));
+
+    if (0 != tip_tracer_configure(t, 0.0, 0.0, DEFAULT_MAX_TIPS, 1)) {
+        tip_tracer_destroy(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+int tip_tracer_configure(tip_tracer_t *t, float isoline_1, float isoline_2,
+        int max_tips, int nthreads) {
+// sets the isolines, the number of tips stored and the number of threads
+    point_t *tips;
+
+    if (max_tips < 0) {
+        return -1;
+    }
+
+    stop_threads(t);
+
+    t->isoline_1 = isoline_1;
+    t->isoline_2 = isoline_2;
+    t->max_tips = max_tips;
+
+    tips = realloc(t->tips, (max_tips + 1)*sizeof(point_t));
+    if (!tips) {
+        return -1;
+    }
+    t->tips = tips;
+    t->ntips = 0;
+
+    return start_threads(t, nthreads);
+}
+
+static void first_touch(tip_tracer_t *t) {
+// zeroes the frames, each band thread its own rows, before they are first used
+    if (t->touched) {
+        return;
+    }
+    if (t->nbands > 1) {
+        pthread_barrier_wait(&t->start);
+        touch_band(&t->bands[0]);
+        pthread_barrier_wait(&t->finished);
+    } else {
+        touch_band(&t->bands[0]);
+    }
+    t->touched = 1;
+}
+
+float ** tip_tracer_next_frame(tip_tracer_t *t) {
+// returns the buffer the next frame should be written into.  This is the
+// frame before the current one, which the next frame won't be paired with.
+    first_touch(t);
+    return t->frames[1 - t->current];
+}
+
+int tip_tracer_push_frame(tip_tracer_t *t, float **frame) {
+// adds a frame and finds the tips between it and the previous one.
+    float **next;
+    int b, j, n, reclassify;
+
+    first_touch(t);
+    next = t->frames[1 - t->current];
+    if (frame != next) {
+        for (j = 0; j < t->y; ++j) {
+            memcpy(next[j], frame[j], t->x*sizeof(float));
+        }
+    }
+    t->current = 1 - t->current;
+    reclassify = previous_needs_classifying(t);
+
+    if (t->nbands > 1) {
+        pthread_barrier_wait(&t->start);
+        classify_band(&t->bands[0], reclassify);
+        pthread_barrier_wait(&t->classified);
+        scan(&t->bands[0]);
+        pthread_barrier_wait(&t->finished);
+    } else {
+        classify_band(&t->bands[0], reclassify);
+        scan(&t->bands[0]);
+    }
+
+    t->class_isoline[t->current] = t->isoline_1;
+    t->class_valid[t->current] = 1;
+    t->class_isoline[1 - t->current] = t->isoline_2;
+    t->class_valid[1 - t->current] = 1;
+
+    // gather the bands' tips, in row order
+    t->ntips = 0;
+    for (b = 0; b < t->nbands; ++b) {
+        for (n = 0; n < t->bands[b].ntips; ++n) {
+            if (t->ntips < t->max_tips) {
+                t->tips[t->ntips] = t->bands[b].tips[n];
+            }
+            t->ntips++;
+        }
+    }
+
+    // and join the bands' pieces of isoline into fronts
+    if (t->contours) {
+        contours_clear(t->contours);
+        for (b = 0; b < t->nbands; ++b) {
+            contours_add_segments(t->contours, t->bands[b].segments, t->bands[b].nsegments);
+        }
+        contours_stitch(t->contours);
+    }
+
+    return (t->ntips > t->max_tips) ? -t->ntips : t->ntips;
+}
+
+int tip_tracer_get_tips(tip_tracer_t *t, const point_t **tips) {
+// sets *tips to the tips of the latest frame and returns their number
+    *tips = t->tips;
+    return (t->ntips > t->max_tips) ? -t->ntips : t->ntips;
+}
+
+int tip_tracer_set_mask(tip_tracer_t *t, const tip_mask_t *mask) {
+// restricts the search to the valid cells of mask, or lifts it if NULL
+    if (mask && ((mask->x != t->x) || (mask->y != t->y))) {
+        return -1;
+    }
+    t->mask = mask;
+    return 0;
+}
+
+void tip_tracer_set_origin(tip_tracer_t *t, int x0, int y0) {
+// places the frames at (x0, y0) in a larger sheet
+    t->origin_x = x0;
+    t->origin_y = y0;
+}
+
+float ** tip_tracer_frame(tip_tracer_t *t, int age) {
+// returns the latest frame pushed, or the one before it
+    return t->frames[age ? 1 - t->current : t->current];
+}
+
+int tip_tracer_set_contours(tip_tracer_t *t, int enable) {
+// turns contour extraction on or off for the frames pushed from now on
+    if (enable && !t->contours) {
+        t->contours = new_contours();
+    } else if (!enable && t->contours) {
+        destroy_contours(t->contours);
+        t->contours = NULL;
+    }
+    return 0;
+}
+
+const contours_t * tip_tracer_get_contours(tip_tracer_t *t) {
+// returns the isoline fronts of the latest frame, or NULL if not wanted
+    return t->contours;
+}
+
+void tip_tracer_destroy(tip_tracer_t *t) {
+// stops any threads and frees the tracer
+    int f;
+
+    if (!t) {
+        return;
+    }
+    stop_threads(t);
+    destroy_contours(t->contours);
+    for (f = 0; f < 2; ++f) {
+        sheet_free(t->frames[f]);
+        sheet_free(t->classes[f]);
+    }
+    free(t->tips);
+    free(t);
+}
@@ -0,0 +1,167 @@
+/*
+ * tip_tracer.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * A reusable tip tracing context, for applications that trace frame after
+ * frame.  The tracer owns the current and previous frames (aligned, padded
+ * sheets from sheet_alloc.h, first touched by the band threads), a per-vertex
+ * classification of each frame against the isoline (used to skip cells the
+ * isoline can't cross), the tip output buffer and, optionally, a pool of
+ * threads that each scan a band of rows.  After the first few frames no
+ * memory is allocated, and each frame's classification is reused when it
+ * becomes the previous frame.
+ *
+ * Typical use:
+ *
+ *   tip_tracer_t *t = tip_tracer_create(nx, ny);
+ *   tip_tracer_configure(t, -30, -30, 20, 4);
+ *   while (more frames) {
+ *       float **frame = tip_tracer_next_frame(t);
+ *       ... fill frame[y][x] ...
+ *       ntips = tip_tracer_push_frame(t, frame);
+ *       tip_tracer_get_tips(t, &tips);
+ *   }
+ *   tip_tracer_destroy(t);
+ *
+ * Each frame pushed is paired with the one pushed before it (the first with
+ * an all zero frame), exactly as find_tips(x, y, frame, isoline_1, previous,
+ * isoline_2, ...) would, and gives identical tips.
+ */
+
+#ifndef TIP_TRACER_H
+#define TIP_TRACER_H
+
+#include <pthread.h>
+#include "contours.h"
+#include "fixed_kernels.h"
+#include "kernels.h"
+#include "point_t.h"
+#include "tip_mask.h"
+
+// classification of a vertex against the isoline
+#define TIP_TRACER_ABOVE (1)    // value above the isoline
+#define TIP_TRACER_ON    (2)    // value on the isoline, within find_isoline's tolerance
+
+struct tip_tracer;
+
+typedef struct tip_tracer_band {
+    struct tip_tracer *tracer;
+    int first_row;              // rows classified by this band
+    int end_row;
+    int first_cell_row;         // rows of cells scanned by this band
+    int end_cell_row;
+    point_t *tips;
+    int ntips;                  // tips found, possibly more than stored
+    int *cells;                 // candidate cells of the row being scanned
+    int first_contour_row;      // rows of cells traced for contours
+    contour_segment_t *segments; // pieces of isoline found by this band
+    int nsegments;
+    int msegments;
+} tip_tracer_band_t;
+
+typedef struct tip_tracer {
+    int x;
+    int y;
+    float isoline_1;            // isoline on the frame just pushed
+    float isoline_2;            // isoline on the previous frame
+    int max_tips;
+    const tip_kernels_t *kernels; // classification and cell screening
+    fixed_find_isoline_t find_isoline; // specialised for the size, or NULL
+    const tip_mask_t *mask;     // cells to search, or NULL for all
+    int origin_x;               // added to the coordinates of tips and contours
+    int origin_y;
+
+    float **frames[2];          // frames[current] is the latest frame
+    unsigned char **classes[2]; // vertex classification of each frame
+    float class_isoline[2];     // isoline each classification was made at
+    int class_valid[2];
+    int current;
+
+    point_t *tips;
+    int ntips;
+
+    // bands, and the threads running all but the first of them
+    int nbands;
+    tip_tracer_band_t *bands;
+    pthread_t *threads;
+    pthread_barrier_t start;
+    pthread_barrier_t classified;
+    pthread_barrier_t finished;
+    int stop;
+    int touched;                // frames zeroed by their band threads
+
+    contours_t *contours;       // isoline fronts of the latest frame, or NULL
+} tip_tracer_t;
+
+tip_tracer_t * tip_tracer_create(int x, int y);
+// creates a tracer for x by y sheets, with both isolines at 0, room for 20
+// tips and no extra threads.
+//
+// returns:
+//  the tracer, or NULL on failure
+
+int tip_tracer_configure(tip_tracer_t *t, float isoline_1, float isoline_2,
+        int max_tips, int nthreads);
+// sets the isolines, the number of tips stored and the number of threads
+// (including the caller) to scan with.  May be called again between frames.
+//
+// returns:
+//  0:  success
+//  <0: error
+
+float ** tip_tracer_next_frame(tip_tracer_t *t);
+// returns the buffer the next frame should be written into, frame[y][x].
+// Filling this and pushing it avoids any copy.  Its rows are padded, so it
+// must be filled row by row through frame[j], not as one block at frame[0].
+
+int tip_tracer_push_frame(tip_tracer_t *t, float **frame);
+// adds a frame, copying it in unless it is the buffer from
+// tip_tracer_next_frame, and finds the tips between it and the previous one.
+//
+// returns:
+//  as find_tips
+//  -n:             Number of tips found was greater than number allocated. n is
+//                  the actual number found.
+//  0:              No tips found
+//  >0:             Number of tips found.
+
+int tip_tracer_get_tips(tip_tracer_t *t, const point_t **tips);
+// sets *tips to the tips of the latest frame and returns their number, as
+// returned by tip_tracer_push_frame.  Valid until the next push.
+
+int tip_tracer_set_mask(tip_tracer_t *t, const tip_mask_t *mask);
+// restricts the search (and contours) to the valid cells of mask, as
+// find_tips_masked does, or lifts the restriction if mask is NULL.  The mask
+// isn't copied, and must outlive its use.
+//
+// returns:
+//  0:  success
+//  <0: the mask is for a different size of sheet
+
+void tip_tracer_set_origin(tip_tracer_t *t, int x0, int y0);
+// for frames that are a window of a larger sheet, with their first row and
+// column at (x0, y0) in it: tips and contours are then reported in the
+// larger sheet's coordinates, exactly as a search of the whole sheet would
+// give them.
+
+float ** tip_tracer_frame(tip_tracer_t *t, int age);
+// returns the latest frame pushed (age 0) or the one before it (age 1), as
+// paired by the last push.  Valid until tip_tracer_next_frame is filled.
+
+int tip_tracer_set_contours(tip_tracer_t *t, int enable);
+// turns on (or off) assembly of the isoline on each frame pushed into
+// connected fronts, during the same scan as the tip search.  Cells along
+// the edge of the sheet, which the tip search leaves out, are included.
+//
+// returns:
+//  0:  success
+//  <0: error
+
+const contours_t * tip_tracer_get_contours(tip_tracer_t *t);
+// returns the fronts of isoline_1 on the latest frame (see contours.h), or
+// NULL if contours are off.  Valid until the next push.
+
+void tip_tracer_destroy(tip_tracer_t *t);
+// stops any threads and frees the tracer
+
+#endif // TIP_TRACER_H
@@ -0,0 +1,190 @@
+/*
+ * trajectory_stats.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "trajectory_stats.h"
+
+// most tips linked in a single frame; find_tips is limited well below this
+#define MAX_LINK_TIPS (256)
+
+static void start_trajectory(trajectory_stats_t *s, trajectory_t *t, double time) {
+// resets t as a new trajectory born at time
+    memset(t, 0, sizeof(trajectory_t));
+    t->id = s->next_id++;
+    t->birth = time;
+}
+
+static void add_point(trajectory_t *t, double time, float x, float y) {
+// accumulates a tip position into the running sums
+    double r = time - t->birth, mx, my, angle, turn;
+
+    t->npoints++;
+    t->last_time = time;
+    t->x = x;
+    t->y = y;
+    t->sum_t += r;
+    t->sum_tt += r*r;
+    t->sum_x += x;
+    t->sum_y += y;
+    t->sum_xx += (double) x*x;
+    t->sum_yy += (double) y*y;
+    t->sum_tx += r*x;
+    t->sum_ty += r*y;
+
+    // the rotation is followed about the running mean position
+    mx = t->sum_x/t->npoints;
+    my = t->sum_y/t->npoints;
+    if (hypot(x - mx, y - my) < 1e-3) {
+        return;
+    }
+    angle = atan2(y - my, x - mx);
+    if (t->have_angle) {
+        turn = angle - t->prev_angle;
+        while (turn > M_PI)
+            turn -= 2*M_PI;
+        while (turn < -M_PI)
+            turn += 2*M_PI;
+        t->angle += turn;
+    }
+    t->prev_angle = angle;
+    t->have_angle = 1;
+}
+
+static void write_summary(trajectory_stats_t *s, const trajectory_t *t, const char *status) {
+// writes the summary line for a trajectory
+    double n = t->npoints, lifetime = t->last_time - t->birth;
+    double mx = t->sum_x/n, my = t->sum_y/n;
+    double variance, denominator, vx = 0.0, vy = 0.0, revolutions, period = -1.0;
+
+    variance = (t->sum_xx/n - mx*mx) + (t->sum_yy/n - my*my);
+    if (variance < 0.0)
+        variance = 0.0;
+
+    denominator = n*t->sum_tt - t->sum_t*t->sum_t;
+    if (denominator > 0.0) {
+        vx = (n*t->sum_tx - t->sum_t*t->sum_x)/denominator;
+        vy = (n*t->sum_ty - t->sum_t*t->sum_y)/denominator;
+    }
+
+    revolutions = fabs(t->angle)/(2*M_PI);
+    if (revolutions >= 1.0) {
+        period = lifetime/revolutions;
+    }
+
+    fprintf(s->output, "%ld %f %f %f %ld %f %f %f %f %f %f %f %s\n",
+            t->id, t->birth, t->last_time, lifetime, t->npoints, mx, my,
+            sqrt(variance), vx, vy, revolutions, period, status);
+}
+
+trajectory_stats_t * new_trajectory_stats(float link_radius, FILE *output) {
+// creates the trajectory tracker, writing summaries to output
+    trajectory_stats_t *s;
+
+    MALLOC(s, sizeof(trajectory_stats_t), "trajectory stats alloc failure");
+    s->nlive = 0;
+    s->mlive = 32;
+    s->next_id = 0;
+    s->link_radius = link_radius;
+    s->output = output;
+    MALLOC(s->live, s->mlive*sizeof(trajectory_t), "trajectory alloc failure");
+
+    fprintf(output, "# id birth death lifetime npoints mean_x mean_y meander_radius"
+            " drift_vx drift_vy revolutions period status\n");
+
+    return s;
+}
+
+void trajectory_stats_frame(trajectory_stats_t *s, double time, const point_t *tips, int ntips) {
+// links the tips of a frame to the live trajectories, updating their
+// statistics and writing out any that have died
+    int claimed[MAX_LINK_TIPS];
+    int n, k, best_n, best_k, nlive;
+    float d, best, dx, dy;
+
+    if (ntips > MAX_LINK_TIPS) {
+        ntips = MAX_LINK_TIPS;
+    }
+
+    for (n = 0; n < s->nlive; ++n) {
+        s->live[n].matched = 0;
+    }
+    for (k = 0; k < ntips; ++k) {
+        claimed[k] = 0;
+    }
+
+    // greedy matching: repeatedly link the closest free pair in range
+    while (1) {
+        best = s->link_radius;
+        best_n = best_k = -1;
+        for (n = 0; n < s->nlive; ++n) {
+            if (s->live[n].matched)
+                continue;
+            for (k = 0; k < ntips; ++k) {
+                if (claimed[k])
+                    continue;
+                dx = tips[k].x - s->live[n].x;
+                dy = tips[k].y - s->live[n].y;
+                d = sqrtf(dx*dx + dy*dy);
+                if (d <= best) {
+                    best = d;
+                    best_n = n;
+                    best_k = k;
+                }
+            }
+        }
+        if (best_n < 0)
+            break;
+        s->live[best_n].matched = 1;
+        claimed[best_k] = 1;
+        add_point(&s->live[best_n], time, tips[best_k].x, tips[best_k].y);
+    }
+
+    // trajectories with no tip have died
+    nlive = 0;
+    for (n = 0; n < s->nlive; ++n) {
+        if (s->live[n].matched) {
+            s->live[nlive++] = s->live[n];
+        } else {
+            write_summary(s, &s->live[n], "died");
+        }
+    }
+    s->nlive = nlive;
+
+    // and tips with no trajectory are born
+    for (k = 0; k < ntips; ++k) {
+        if (claimed[k])
+            continue;
+        if (s->nlive >= s->mlive) {
+            s->mlive *= 2;
+            s->live = realloc(s->live, s->mlive*sizeof(trajectory_t));
+            if (!s->live) {
+                oops("trajectory alloc failure");
+            }
+        }
+        start_trajectory(s, &s->live[s->nlive], time);
+        add_point(&s->live[s->nlive], time, tips[k].x, tips[k].y);
+        s->live[s->nlive].matched = 1;
+        s->nlive++;
+    }
+}
+
+void destroy_trajectory_stats(trajectory_stats_t *s) {
+// writes out the trajectories still alive and frees the tracker
+    int n;
+
+    if (!s) {
+        return;
+    }
+    for (n = 0; n < s->nlive; ++n) {
+        write_summary(s, &s->live[n], "alive");
+    }
+    fflush(s->output);
+    free(s->live);
+    free(s);
+}
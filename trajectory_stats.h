@@ -0,0 +1,66 @@
+/*
+ * trajectory_stats.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * Per-trajectory summary statistics, computed online as the trace runs.
+ *
+ * Tips in each frame are linked to the live trajectories of the previous
+ * frame by nearest neighbour, within a link radius.  A trajectory that finds
+ * no tip dies, and a tip with no trajectory starts a new one.  Each live
+ * trajectory carries a fixed amount of state (running sums), so memory is
+ * bounded by the number of simultaneous tips, not by the length of the run.
+ *
+ * When a trajectory dies, or the run ends, a summary line is written:
+ *
+ *   id birth death lifetime npoints mean_x mean_y meander_radius
+ *      drift_vx drift_vy revolutions period status
+ *
+ *  meander_radius: rms distance of the tip from its mean position
+ *  drift_v:        least squares velocity of the tip
+ *  revolutions:    net turns of the tip about its running mean position
+ *  period:         lifetime/revolutions, or -1 for less than one revolution
+ *  status:         died, or alive if the run ended first
+ */
+
+#ifndef TRAJECTORY_STATS_H
+#define TRAJECTORY_STATS_H
+
+#include <stdio.h>
+#include "point_t.h"
+
+typedef struct trajectory {
+    long id;
+    double birth;               // time of the first tip
+    double last_time;           // time of the latest tip
+    float x, y;                 // latest position
+    long npoints;
+    double sum_t, sum_tt;       // times are relative to birth
+    double sum_x, sum_y;
+    double sum_xx, sum_yy;
+    double sum_tx, sum_ty;
+    double angle;               // unwrapped angle about the mean position
+    double prev_angle;
+    int have_angle;
+    int matched;
+} trajectory_t;
+
+typedef struct trajectory_stats {
+    trajectory_t *live;
+    int nlive;
+    int mlive;
+    long next_id;
+    float link_radius;
+    FILE *output;
+} trajectory_stats_t;
+
+trajectory_stats_t * new_trajectory_stats(float link_radius, FILE *output);
+// creates the trajectory tracker, writing summaries to output
+
+void trajectory_stats_frame(trajectory_stats_t *s, double time, const point_t *tips, int ntips);
+// links the tips of a frame to the live trajectories, updating their
+// statistics and writing out any that have died
+
+void destroy_trajectory_stats(trajectory_stats_t *s);
+// writes out the trajectories still alive and frees the tracker
+
+#endif // TRAJECTORY_STATS_H
@@ -0,0 +1,237 @@
+/*
+ * frame_list.c
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_list.h"
+
+static char * widen_pattern(const char *pattern, int conversions) {
+// checks the pattern holds exactly the given number of integer conversions,
+// and returns a copy of it with the first taking a long.  With more than
+// one, the rest is escaped, so that formatting substitutes the first and
+// leaves the others, and any %%, as written.  Returns NULL if the pattern is
+// not usable.
+    const char *p, *start;
+    char *format, *out;
+    int found = 0, escape = (conversions > 1);
+
+    // an extra 'l' is added, and at worst every other '%' is doubled
+    format = malloc(2*strlen(pattern) + 2);
+    if (!format) {
+        return NULL;
+    }
+
+    out = format;
+    for (p = pattern; *p; ++p) {
+        if ('%' != *p) {
+            *out++ = *p;
+            continue;
+        }
+        if ('%' == p[1]) {
+            *out++ = *p;
+            *out++ = *++p;
+            if (escape) {
+                *out++ = '%';
+                *out++ = '%';
+            }
+            continue;
+        }
+        // flags, width and precision
+        start = p++;
+        while (*p && strchr("-+ #0123456789.", *p)) {
+            ++p;
+        }
+        if (found > 0) {
+            // later conversions are kept as they are
+            *out++ = '%';
+        }
+        memcpy(out, start, p - start);
+        out += p - start;
+        // any length modifier of the first is replaced by our own
+        while (*p && strchr("hlqjzt", *p)) {
+            if (found > 0) {
+                *out++ = *p;
+            }
+            ++p;
+        }
+        if (!*p || !strchr("diuxXo", *p)) {
+            free(format);
+            return NULL;
+        }
+        if (0 == found) {
+            *out++ = 'l';
+        }
+        *out++ = *p;
+        ++found;
+    }
+    *out = 0;
+
+    if (conversions != found) {
+        free(format);
+        return NULL;
+    }
+    return format;
+}
+
+char * bind_pattern(const char *pattern, long value) {
+// substitutes value for the first of the pattern's two integer conversions
+    char *format, *bound = NULL;
+    int length;
+
+    format = widen_pattern(pattern, 2);
+    if (!format) {
+        return NULL;
+    }
+    length = snprintf(NULL, 0, format, value);
+    if (length >= 0) {
+        bound = malloc(length + 1);
+    }
+    if (bound) {
+        snprintf(bound, length + 1, format, value);
+    }
+    free(format);
+    return bound;
+}
+
+frame_list_t * new_frame_list(string_list_t *names) {
+// creates a frame list from explicit names, taking ownership of the list
+    frame_list_t *f;
+
+    f = calloc(1, sizeof(frame_list_t));
+    if (f) {
+        f->names = names;
+    }
+    return f;
+}
+
+frame_list_t * new_pattern_frame_list(const char *pattern, long start, long end, long step) {
+// creates a frame list from a pattern containing exactly one integer
+// conversion.
+    frame_list_t *f;
+
+    if ((step < 1) || (end < start)) {
+        fprintf(stderr, "Bad frame range %ld:%ld:%ld\n", start, end, step);
+        return NULL;
+    }
+
+    f = calloc(1, sizeof(frame_list_t));
+    if (!f) {
+        return NULL;
+    }
+
+    f->format = widen_pattern(pattern, 1);
+    if (!f->format) {
+        fprintf(stderr, "Pattern '%s' must contain exactly one integer conversion (e.g. %%06d)\n", pattern);
+        free(f);
+        return NULL;
+    }
+    f->start = start;
+    f->step = step;
+    f->count = (end - start + step - 1) / step;
+
+    // sized for the pattern plus a long's worth of digits and padding
+    f->buffer_size = strlen(pattern) + 64;
+    f->buffer = malloc(f->buffer_size);
+    if (!f->buffer) {
+        free(f->format);
+        free(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+int parse_frame_range(const char *range, long *start, long *end, long *step) {
+// parses START:END[:STEP], the step defaulting to 1.  Returns 0 on success.
+    char *p;
+
+    *start = strtol(range, &p, 10);
+    if ((p == range) || (':' != *p)) {
+        return -1;
+    }
+    range = p + 1;
+    *end = strtol(range, &p, 10);
+    if (p == range) {
+        return -1;
+    }
+    *step = 1;
+    if (':' == *p) {
+        range = p + 1;
+        *step = strtol(range, &p, 10);
+        if (p == range) {
+            return -1;
+        }
+    }
+    return (0 == *p) ? 0 : -1;
+}
+
+void destroy_frame_list(frame_list_t *f) {
+// destroys a frame list, freeing all memory
+    if (NULL != f) {
+        destroy_string_list(f->names);
+        free(f->format);
+        free(f->buffer);
+        free(f);
+    }
+}
+
+long frame_list_length(frame_list_t *f) {
+// returns the number of frames in the list
+    return f->names ? string_list_length(f->names) : f->count;
+}
+
+long frame_list_number(frame_list_t *f, long index) {
+// returns the frame number of the frame at index
+    return f->names ? index : f->start + index*f->step;
+}
+
+const char * frame_list_at(frame_list_t *f, long index) {
+// returns the name of the frame at index, or NULL if out of bounds.
+    int length;
+
+    if (f->names) {
+        return string_list_at(f->names, index);
+    }
+
+    if ((index < 0) || (index >= f->count)) {
+        return NULL;
+    }
+
+    length = snprintf(f->buffer, f->buffer_size, f->format, f->start + index*f->step);
+    if (length >= f->buffer_size) {
+        // very wide padding; grow once and try again
+        char *buffer = realloc(f->buffer, length + 1);
+        if (!buffer) {
+            return NULL;
+        }
+        f->buffer = buffer;
+        f->buffer_size = length + 1;
+        snprintf(f->buffer, f->buffer_size, f->format, f->start + index*f->step);
+    }
+    return f->buffer;
+}
+
+char * frame_list_name(frame_list_t *f, long index) {
+// as frame_list_at, into new memory
+    char *name;
+    int length;
+
+    if (f->names) {
+        name = string_list_at(f->names, index);
+        return name ? strdup(name) : NULL;
+    }
+
+    if ((index < 0) || (index >= f->count)) {
+        return NULL;
+    }
+
+    length = snprintf(NULL, 0, f->format, f->start + index*f->step);
+    name = malloc(length + 1);
+    if (name) {
+        snprintf(name, length + 1, f->format, f->start + index*f->step);
+    }
+    return name;
+}
@@ -0,0 +1,66 @@
+/*
+ * frame_list.h
+ * Jonathan D. Stott <jonathan.stott@gmail.com>
+ *
+ * The sequence of frames to process.  Either an explicit list of names, or a
+ * printf style pattern over a range of frame numbers, e.g.
+ *
+ *   run7/frame_%06d.bin.gz over 0:1000000:10
+ *
+ * Pattern names are generated on demand into a single reused buffer, so a
+ * pattern list costs the same to set up whatever its length.
+ */
+
+#ifndef FRAME_LIST_H
+#define FRAME_LIST_H
+
+#include "string_list.h"
+
+typedef struct frame_list {
+    string_list_t *names;   // explicit names, or NULL for a pattern
+    char *format;           // the pattern, its conversion widened to long
+    long start;             // first frame number
+    long step;              // step between frame numbers
+    long count;             // number of frames in the pattern
+    char *buffer;           // the most recently generated name
+    size_t buffer_size;
+} frame_list_t;
+
+frame_list_t * new_frame_list(string_list_t *names);
+// creates a frame list from explicit names, taking ownership of the list
+
+frame_list_t * new_pattern_frame_list(const char *pattern, long start, long end, long step);
+// creates a frame list from a pattern containing exactly one integer
+// conversion (%d, %06d, %x, ...), over frame numbers start, start+step, ...
+// up to but not including end.  Returns NULL if the pattern or range is bad.
+
+char * bind_pattern(const char *pattern, long value);
+// substitutes value for the first integer conversion of pattern, returning
+// (in new memory) a pattern holding the rest, e.g. "m%03d/f%06d.bin" and 7
+// give "m007/f%06d.bin".  Returns NULL unless pattern has exactly two integer
+// conversions, of the kinds new_pattern_frame_list takes.
+
+int parse_frame_range(const char *range, long *start, long *end, long *step);
+// parses START:END[:STEP], the step defaulting to 1.  Returns 0 on success.
+
+void destroy_frame_list(frame_list_t *f);
+// destroys a frame list, freeing all memory
+
+long frame_list_length(frame_list_t *f);
+// returns the number of frames in the list
+
+long frame_list_number(frame_list_t *f, long index);
+// returns the frame number of the frame at index: start + index*step for a
+// pattern, so that its time is the same whatever the step, or index itself
+// for a list of names
+
+const char * frame_list_at(frame_list_t *f, long index);
+// returns the name of the frame at index, or NULL if out of bounds.  The name
+// is only valid until the next call.
+
+char * frame_list_name(frame_list_t *f, long index);
+// returns a copy, to be freed, of the name of the frame at index, or NULL if
+// out of bounds or out of memory.  Unlike frame_list_at, it reuses no
+// buffer, so can be called from several threads at once.
+
+#endif // FRAME_LIST_H
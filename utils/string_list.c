@@ -3,19 +3,21 @@
  * Jonathan D. Stott <jonathan.stott@gmail.com>
  *
  */
+#define _POSIX_C_SOURCE 200809L
 #include <malloc.h>
 #include <string.h>
+#include <ctype.h>
 #include "string_list.h"
 
-static int next_size_up(int size) {
+static size_t next_size_up(size_t size, size_t minimum) {
 // returns the next power of two size that can contain all the current data
 // by sizing up in powers of 2, should avoid too many resize operations which
 // should improve the speed.
-   if (size < DEFAULT_LIST_SIZE) {
+   if (size < minimum) {
        // if we're this small, just set to the default and return
-        return DEFAULT_LIST_SIZE;
+        return minimum;
    } else {
-        int new_size = DEFAULT_LIST_SIZE;
+        size_t new_size = minimum;
         while (new_size <= size) {
             new_size = new_size * 2;
         }
@@ -31,10 +33,15 @@ string_list_t * new_string_list(void) {
     if (s != NULL) { // if that is successful, start to assign values
         s->len = 0;
         s->mlen = DEFAULT_LIST_SIZE;
-        s->list = malloc(s->mlen*sizeof(char*));
-        if (s->list != NULL) { // check we allocated the initial size
+        s->arena_len = 0;
+        s->arena_size = DEFAULT_ARENA_SIZE;
+        s->offsets = malloc(s->mlen*sizeof(size_t));
+        s->arena = malloc(s->arena_size*sizeof(char));
+        if ((s->offsets != NULL) && (s->arena != NULL)) {
             return s;          // if so, return it.
-        } else {               // if not, free the array and return NULL
+        } else {               // if not, free the arrays and return NULL
+            free(s->offsets);
+            free(s->arena);
             free(s);
             return NULL;
         }
@@ -45,69 +52,88 @@ string_list_t * new_string_list(void) {
 
 void destroy_string_list(string_list_t *s) {
 // destroys a string_list, freeing all memory
-    int i;
     if (NULL != s) {
-        if (s->mlen > 0) {
-            if (s->list) {
-                for (i = 0; i < s->mlen; ++i) {
-                    if (s->list[i]) {
-                        free(s->list[i]);
-                        s->list[i] = NULL;
-                    }
-                }
-                s->mlen = 0;
-            }
-            free(s->list);
-            s->list = NULL;
-        }
-        // make sure we free it, even if we somehow had mlen == 0
-        if (s->list) {
-            free(s->list);
-            s->list = NULL;
-        }
+        free(s->offsets);
+        free(s->arena);
+        s->offsets = NULL;
+        s->arena = NULL;
+        s->len = s->mlen = 0;
         free(s);
-        s = NULL;
     }
-
 }
 
 
-int string_list_push(string_list_t *s, const char *c) {
-// adds a new string to the list, resizing if needed
-    char *string;
-    int to_move;
-
-    // allocate space for a new string
-    string = malloc(MAX_STRING_LENGTH*sizeof(char));
-    if (!string) {
-        return -1;
+static int string_list_append(string_list_t *s, const char *c, size_t length) {
+// appends length characters of c as a new string, resizing if needed
+    // if the arena is too small, double it until it fits.
+    if (s->arena_len + length + 1 > s->arena_size) {
+        size_t size = next_size_up(s->arena_len + length + 1, DEFAULT_ARENA_SIZE);
+        char *arena = realloc(s->arena, size*sizeof(char));
+        if (NULL == arena) {
+            return -1;
+        }
+        s->arena = arena;
+        s->arena_size = size;
     }
 
-    // figure out how much we need to copy.
-    to_move = (strlen(c) >= MAX_STRING_LENGTH) ? MAX_STRING_LENGTH : strlen(c)+1;
-
-    memmove(string, c, to_move);
-
     // if our array is longer than our available memory
     // we need more memory
     if (s->len >= s->mlen) {
-        int size = next_size_up(s->mlen);
-        s->list = realloc(s->list, size*sizeof(char*));
-        if (NULL == s->list) {
+        int size = next_size_up(s->mlen, DEFAULT_LIST_SIZE);
+        size_t *offsets = realloc(s->offsets, size*sizeof(size_t));
+        if (NULL == offsets) {
             return -1;
         }
+        s->offsets = offsets;
         s->mlen = size;
     }
 
-    s->list[s->len] = string;
+    memcpy(s->arena + s->arena_len, c, length);
+    s->arena[s->arena_len + length] = 0;
+
+    s->offsets[s->len] = s->arena_len;
+    s->arena_len += length + 1;
     s->len++;
     return s->len;
+}
+
+int string_list_push(string_list_t *s, const char *c) {
+// adds a new string to the list, resizing if needed
+    return string_list_append(s, c, strlen(c));
+}
+
+int string_list_read(string_list_t *s, FILE *input) {
+// pushes every whitespace separated word in input onto the list.
+    char *line = NULL, *start, *end;
+    size_t line_size = 0;
+
+    // one reused line buffer; words are copied straight into the arena
+    while (-1 != getline(&line, &line_size, input)) {
+        start = line;
+        while (*start) {
+            while (*start && isspace((unsigned char) *start))
+                ++start;
+            if (!*start)
+                break;
+            end = start;
+            while (*end && !isspace((unsigned char) *end))
+                ++end;
+            if (-1 == string_list_append(s, start, end - start)) {
+                free(line);
+                return -1;
+            }
+            start = end;
+        }
+    }
 
+    free(line);
+    return s->len;
 }
+
 char * string_list_at(string_list_t *s, int index) {
 // returns pointer to the string at the given index, or NULL if out of bounds
     if (index < s->len && index > -1) {
-        return s->list[index];
+        return s->arena + s->offsets[index];
     } else {
         return NULL;
     }
@@ -118,4 +144,3 @@ int string_list_length(string_list_t *s) {
 // returns the length of the stringlist.
     return s->len;
 }
-
@@ -2,19 +2,28 @@
  * string_list.h
  * Jonathan D. Stott <jonathan.stott@gmail.com>
  *
+ * A growable list of strings.  The strings are stored back to back in a
+ * single arena, so pushing a name costs no allocation beyond the occasional
+ * doubling of the arena and of the offset table, and there is no limit on
+ * the length of a string.
  */
 
 #ifndef STRING_LIST_H
 #define STRING_LIST_H
 
+#include <stdio.h>
+
 #define DEFAULT_LIST_SIZE (8)
-#define MAX_STRING_LENGTH (64)
+#define DEFAULT_ARENA_SIZE (4096)
 
 
 typedef struct string_list {
     int mlen;
     int len;
-    char ** list;
+    size_t * offsets;   // start of each string in the arena
+    char * arena;       // the strings, each nul terminated
+    size_t arena_len;
+    size_t arena_size;
 } string_list_t;
 
 string_list_t * new_string_list(void);
@@ -26,8 +35,13 @@ void destroy_string_list(string_list_t *s);
 int string_list_push(string_list_t *s, const char *c);
 // adds a new string to the list, resizing if needed
 
+int string_list_read(string_list_t *s, FILE *input);
+// pushes every whitespace separated word in input onto the list.  Returns the
+// new length of the list, or -1 on failure.
+
 char * string_list_at(string_list_t *s, int index);
-// returns pointer to the string at the given index, or NULL if out of bounds
+// returns pointer to the string at the given index, or NULL if out of bounds.
+// The pointer is only valid until the next push.
 
 int string_list_length(string_list_t *s);
 // returns the length of the stringlist.